@@ -1,4 +1,5 @@
 #include "6502Core.h"
+#include "Recompiler.h"
 #include <cassert>
 #include <cstdint>
 #include <functional>
@@ -12,9 +13,11 @@ static  CPUCore6502::InstructionDetails g_InstructionDetails[256] = {
  CPUCore6502::CPUCore6502(MemoryMap& mem) : 
      // m_State(),
      m_Cycles(0),
+     m_Halted(false),
      m_Memory(mem),
      m_PreexecutionCallBack(nullptr),
-     m_PostexecutionCallBack(nullptr) {
+     m_PostexecutionCallBack(nullptr),
+     m_Recompiler(nullptr) {
     
      Reset();
 }
@@ -42,6 +45,27 @@ void CPUCore6502::Reset() {
     m_State.SetFlags(0x24);
 
     m_Cycles = 7;
+    m_Halted = false;
+}
+
+bool CPUCore6502::Implemented(uint8_t opcode) {
+    return g_InstructionDetails[opcode].Delegate != &CPUCore6502::Unimplemented;
+}
+
+const CPUCore6502::InstructionDetails& CPUCore6502::Details(uint8_t opcode) {
+    return g_InstructionDetails[opcode];
+}
+
+void CPUCore6502::SaveState(State& state) const {
+    state.Registers = m_State;
+    state.Cycles = m_Cycles;
+    state.Halted = m_Halted;
+}
+
+void CPUCore6502::LoadState(const State& state) {
+    m_State = state.Registers;
+    m_Cycles = state.Cycles;
+    m_Halted = state.Halted;
 }
 
 void CPUCore6502::Execute() {
@@ -72,6 +96,20 @@ void CPUCore6502::Execute() {
     m_State.PC += details.InstructionSize;
 
     std::invoke(details.Delegate, this, info);
+
+    // OAM DMA halts the CPU, plus one alignment cycle when it lands on an odd cycle
+    uint32_t stall = m_Memory.TakeStallCycles();
+    if (stall != 0) {
+        m_Cycles += stall + (m_Cycles & 1);
+    }
+}
+
+uint32_t CPUCore6502::ExecuteBlock(uint64_t limit, uint16_t& lastPC) {
+    if (m_Recompiler == nullptr || m_Halted ||
+        m_PreexecutionCallBack != nullptr || m_PostexecutionCallBack != nullptr) {
+        return 0;
+    }
+    return m_Recompiler->Run(m_State, m_Cycles, limit, lastPC);
 }
 
 void CPUCore6502::Push(uint8_t val) {
@@ -346,8 +384,9 @@ void CPUCore6502::AddBranchCycles(uint16_t oldPC, uint16_t newPC, uint32_t pageC
 
 void CPUCore6502::IRQ() {
     // https://www.pagetable.com/?p=410
+    // Hardware interrupts push B clear, only BRK sets it
     Push16(PC());
-    Push(m_State.P | 0x10);
+    Push((m_State.P & ~0x10) | 0x20);
     PC() = Read16(0xFFFE);
     m_State.I = 1;
     m_Cycles += 7;
@@ -355,13 +394,21 @@ void CPUCore6502::IRQ() {
 
 void CPUCore6502::NMI() {
     // https://www.pagetable.com/?p=410
+    // Hardware interrupts push B clear
     Push16(PC());
-    Push(m_State.P | 0x10);
+    Push((m_State.P & ~0x10) | 0x20);
     PC() = Read16(0xFFFA);
     m_State.I = 1;
     m_Cycles += 7;
 }
 
+void CPUCore6502::KIL(const DynamicExecutionInfo& info) {
+    // Locks up the real chip until reset.  The KIL's size is 0, so PC stays
+    // on it and every Execute() runs it again.
+    // https://www.nesdev.org/wiki/CPU_unofficial_opcodes
+    m_Halted = true;
+}
+
 void CPUCore6502::Unimplemented(const DynamicExecutionInfo& info) {
     assert(0);
 }
@@ -371,9 +418,12 @@ void CPUCore6502::ADC(const DynamicExecutionInfo& info) {
     uint8_t b = Value(info);
     uint8_t c = m_State.C;
 
-    A() = a + b + c;
+    // Carry out of the full 9 bit sum; comparing the result against a misses
+    // it when b + c is exactly 256
+    uint16_t sum = a + b + c;
+    A() = (uint8_t)sum;
 
-    SetC(A() < a);
+    SetC(sum > 0xff);
     SetN(A());
     SetZ(A());
 
@@ -504,6 +554,10 @@ void CPUCore6502::CLD(const DynamicExecutionInfo& info) {
     m_State.D = 0;
 }
 
+void CPUCore6502::CLI(const DynamicExecutionInfo& info) {
+    m_State.I = 0;
+}
+
 void CPUCore6502::CLV(const DynamicExecutionInfo& info) {
     m_State.V = 0;
 }
@@ -768,9 +822,12 @@ void CPUCore6502::SBC(const DynamicExecutionInfo& info) {
     uint8_t b = ~Value(info);
     uint8_t c = m_State.C;
 
-    A() = a + b + c;
+    // Carry out of the full 9 bit sum; comparing the result against a misses
+    // it when b + c is exactly 256
+    uint16_t sum = a + b + c;
+    A() = (uint8_t)sum;
 
-    SetC(A() < a);
+    SetC(sum > 0xff);
     SetN(A());
     SetZ(A());
 
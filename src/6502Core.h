@@ -6,6 +6,8 @@
 
 namespace raunnes {
 
+class Recompiler;
+
 class CPUCore6502 {
 public:
     class CPUCore6502State {
@@ -89,6 +91,13 @@ public:
 
     typedef void(*ExecutionCallBack)(const InstructionDetails&, const DynamicExecutionInfo&, const CPUCore6502State&, const MemoryMap&, const uint64_t cycles);
 
+    // Everything that changes as the CPU runs, for snapshots
+    struct State {
+        CPUCore6502State Registers;
+        uint64_t Cycles;
+        bool Halted;
+    };
+
 public:
     CPUCore6502(MemoryMap& mem);
     ~CPUCore6502();
@@ -99,6 +108,37 @@ public:
     void Reset();
     void Execute();
 
+    // Runs a translated block from PC instead, if the attached recompiler has
+    // one that's sure to finish before cycle limit.  Returns the instructions
+    // it ran, 0 meaning Execute() is next; lastPC is where the last of them
+    // started.  Never with an execution callback installed, those want to
+    // see every instruction.
+    uint32_t ExecuteBlock(uint64_t limit, uint16_t& lastPC);
+    void AttachRecompiler(Recompiler* recompiler) { m_Recompiler = recompiler; }
+
+    uint64_t Cycles() const { return m_Cycles; }
+
+    // Lets time pass without executing anything, for skipping over loop
+    // iterations that are known to repeat exactly
+    void SkipCycles(uint64_t cycles) { m_Cycles += cycles; }
+
+    const CPUCore6502State& Registers() const { return m_State; }
+
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+    // I flag, IRQs wait while it's set
+    bool InterruptsDisabled() const { return m_State.I != 0; }
+
+    // A KIL opcode has jammed the CPU.  It keeps executing the KIL, so time
+    // still passes, until Reset().
+    bool Halted() const { return m_Halted; }
+
+    // False for the unofficial opcodes that aren't emulated and would assert
+    static bool Implemented(uint8_t opcode);
+
+    static const InstructionDetails& Details(uint8_t opcode);
+
     void Push(uint8_t val);
     void Push16(uint16_t val);
     uint8_t Pop();
@@ -139,6 +179,7 @@ public:
     void NMI();
 
     void Unimplemented(const DynamicExecutionInfo& info);
+    void KIL(const DynamicExecutionInfo& info);
 
     void ADC(const DynamicExecutionInfo& info);
     void AND(const DynamicExecutionInfo& info);
@@ -155,6 +196,7 @@ public:
     void BVS(const DynamicExecutionInfo& info);
     void CLC(const DynamicExecutionInfo& info);
     void CLD(const DynamicExecutionInfo& info);
+    void CLI(const DynamicExecutionInfo& info);
     void CLV(const DynamicExecutionInfo& info);
     void CPX(const DynamicExecutionInfo& info);
     void CPY(const DynamicExecutionInfo& info);
@@ -211,9 +253,11 @@ public:
 private:
     CPUCore6502State m_State;
     uint64_t m_Cycles;
+    bool m_Halted;
     MemoryMap& m_Memory;
     ExecutionCallBack m_PreexecutionCallBack;
     ExecutionCallBack m_PostexecutionCallBack;
+    Recompiler* m_Recompiler;
 
 };
 }
@@ -0,0 +1,664 @@
+#include "APU.h"
+
+#include "6502Core.h"
+#include "MemoryMap.h"
+
+#include <algorithm>
+
+namespace raunnes {
+
+// https://www.nesdev.org/wiki/APU_Length_Counter
+static const uint8_t kLengths[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t kDuty[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },     // 12.5%
+    { 0, 1, 1, 0, 0, 0, 0, 0 },     // 25%
+    { 0, 1, 1, 1, 1, 0, 0, 0 },     // 50%
+    { 1, 0, 0, 1, 1, 1, 1, 1 },     // 25% negated
+};
+
+static const uint8_t kTriangle[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+// NTSC, in CPU cycles
+static const uint16_t kNoisePeriods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t kDMCRates[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// Frame counter steps in CPU cycles from the start of the sequence.  The last
+// one ends it; the four step sequence raises the IRQ there.
+static const uint32_t kFourStep[4] = { 7457, 14913, 22371, 29829 };
+static const uint32_t kFiveStep[5] = { 7457, 14913, 22371, 29829, 37281 };
+static const uint32_t kFourStepPeriod = 29830;
+static const uint32_t kFiveStepPeriod = 37282;
+
+// What each step clocks: envelopes and the triangle's linear counter every
+// quarter frame, length counters and sweeps every half
+static const uint8_t kClockQuarter = 0x01;
+static const uint8_t kClockHalf = 0x02;
+static const uint8_t kFourStepClocks[4] = { kClockQuarter, kClockQuarter | kClockHalf, kClockQuarter, kClockQuarter | kClockHalf };
+static const uint8_t kFiveStepClocks[5] = { kClockQuarter, kClockQuarter | kClockHalf, kClockQuarter, 0, kClockQuarter | kClockHalf };
+
+// Output per unit of each channel's level, from the linear approximation of
+// the mixer scaled so everything at once stays inside 16 bits.  Linear, so
+// each channel can add its own steps without looking at the others.
+// https://www.nesdev.org/wiki/APU_Mixer#Linear_Approximation
+static const int32_t kPulseGain = 211;
+static const int32_t kTriangleGain = 238;
+static const int32_t kNoiseGain = 138;
+static const int32_t kDMCGain = 94;
+
+// Writes held before the log is played back early
+static const size_t kMaxLoggedWrites = 1024;
+
+APU::APU(MemoryMap& memory) :
+    m_Map(memory),
+    m_Clock(nullptr),
+    m_BlipStart(0),
+    m_Time(0),
+    m_Triangle(),
+    m_Noise(),
+    m_DMC(),
+    m_FiveStep(false),
+    m_FrameIRQInhibit(false),
+    m_FrameStart(0),
+    m_FrameStep(0),
+    m_FrameIRQ(false),
+    m_DMCIRQ(false),
+    m_IRQCycle(UINT64_MAX) {
+
+    m_Pulse[0] = Pulse();
+    m_Pulse[1] = Pulse();
+    m_Pulse[0].OnesComplement = 1;
+
+    m_Noise.Shift = 1;
+
+    m_DMC.Rate = kDMCRates[0];
+    m_DMC.BitsRemaining = 8;
+    m_DMC.Silence = true;
+
+    m_Log.reserve(kMaxLoggedWrites);
+
+    SetSampleRate(48000);
+    UpdateIRQCycle();
+}
+
+APU::~APU() {
+}
+
+void APU::AttachClock(const CPUCore6502* cpu) {
+    m_Clock = cpu;
+
+    // Power on acts like $4017 = 0 written now
+    m_Time = Now();
+    m_BlipStart = m_Time;
+    m_FrameStart = m_Time;
+    m_FrameStep = 0;
+    m_Pulse[0].NextClock = m_Time;
+    m_Pulse[1].NextClock = m_Time;
+    m_Triangle.NextClock = m_Time;
+    m_Noise.NextClock = m_Time;
+    m_DMC.NextClock = m_Time;
+    UpdateIRQCycle();
+}
+
+void APU::SetSampleRate(uint32_t sampleRate) {
+    // Room for the quarter second EndFrame() keeps plus plenty of frame
+    m_Blip.SetRates(kClockRate, sampleRate, sampleRate / 2);
+}
+
+void APU::SetRateAdjust(double ratio) {
+    m_Blip.SetClockRate(kClockRate / ratio);
+}
+
+void APU::SaveState(State& state) const {
+    m_Blip.SaveState(state.Blip);
+    state.BlipStart = m_BlipStart;
+    state.Time = m_Time;
+
+    if (state.Log.capacity() < kMaxLoggedWrites) {
+        state.Log.reserve(kMaxLoggedWrites);
+    }
+    state.Log.assign(m_Log.begin(), m_Log.end());
+
+    state.PulseChannels[0] = m_Pulse[0];
+    state.PulseChannels[1] = m_Pulse[1];
+    state.TriangleChannel = m_Triangle;
+    state.NoiseChannel = m_Noise;
+    state.DMCChannel = m_DMC;
+
+    state.FiveStep = m_FiveStep;
+    state.FrameIRQInhibit = m_FrameIRQInhibit;
+    state.FrameStart = m_FrameStart;
+    state.FrameStep = m_FrameStep;
+
+    state.FrameIRQ = m_FrameIRQ;
+    state.DMCIRQ = m_DMCIRQ;
+    state.IRQCycle = m_IRQCycle;
+}
+
+void APU::LoadState(const State& state) {
+    m_Blip.LoadState(state.Blip);
+    m_BlipStart = state.BlipStart;
+    m_Time = state.Time;
+    m_Log.assign(state.Log.begin(), state.Log.end());
+
+    m_Pulse[0] = state.PulseChannels[0];
+    m_Pulse[1] = state.PulseChannels[1];
+    m_Triangle = state.TriangleChannel;
+    m_Noise = state.NoiseChannel;
+    m_DMC = state.DMCChannel;
+
+    m_FiveStep = state.FiveStep;
+    m_FrameIRQInhibit = state.FrameIRQInhibit;
+    m_FrameStart = state.FrameStart;
+    m_FrameStep = state.FrameStep;
+
+    m_FrameIRQ = state.FrameIRQ;
+    m_DMCIRQ = state.DMCIRQ;
+    m_IRQCycle = state.IRQCycle;
+}
+
+uint64_t APU::Now() const {
+    return m_Clock != nullptr ? m_Clock->Cycles() : m_Time;
+}
+
+void APU::WriteRegister(uint16_t address, uint8_t value) {
+    uint64_t cycle = Now();
+
+    if (address == 0x4010 || address == 0x4015 || address == 0x4017) {
+        Sync(cycle);
+        Apply(cycle, address, value);
+        UpdateIRQCycle();
+        return;
+    }
+
+    if (m_Log.size() == kMaxLoggedWrites) {
+        Sync(cycle);
+    }
+    m_Log.push_back({ cycle, address, value });
+}
+
+uint8_t APU::ReadStatus() {
+    Sync(Now());
+
+    uint8_t status = 0;
+    status |= m_Pulse[0].Length > 0 ? 0x01 : 0;
+    status |= m_Pulse[1].Length > 0 ? 0x02 : 0;
+    status |= m_Triangle.Length > 0 ? 0x04 : 0;
+    status |= m_Noise.Length > 0 ? 0x08 : 0;
+    status |= m_DMC.BytesRemaining > 0 ? 0x10 : 0;
+    status |= m_FrameIRQ ? 0x40 : 0;
+    status |= m_DMCIRQ ? 0x80 : 0;
+
+    m_FrameIRQ = false;
+    UpdateIRQCycle();
+    return status;
+}
+
+void APU::EndFrame() {
+    uint64_t now = Now();
+    Sync(now);
+
+    m_Blip.EndFrame((uint32_t)(now - m_BlipStart));
+    m_BlipStart = now;
+
+    uint32_t limit = SampleRate() / 4;
+    if (m_Blip.SamplesAvailable() > limit) {
+        m_Blip.ReadSamples(nullptr, m_Blip.SamplesAvailable() - limit);
+    }
+}
+
+void APU::Sync(uint64_t cycle) {
+    for (const LoggedWrite& write : m_Log) {
+        Run(write.Cycle);
+        Apply(write.Cycle, write.Address, write.Value);
+    }
+    m_Log.clear();
+
+    Run(cycle);
+    UpdateIRQCycle();
+}
+
+void APU::Run(uint64_t cycle) {
+    for (;;) {
+        const uint32_t* steps = m_FiveStep ? kFiveStep : kFourStep;
+        uint64_t event = m_FrameStart + steps[m_FrameStep];
+        if (event > cycle) {
+            break;
+        }
+
+        RunChannels(event);
+
+        const uint8_t* clocks = m_FiveStep ? kFiveStepClocks : kFourStepClocks;
+        if (clocks[m_FrameStep] & kClockQuarter) {
+            ClockQuarterFrame();
+        }
+        if (clocks[m_FrameStep] & kClockHalf) {
+            ClockHalfFrame();
+        }
+
+        bool last = m_FrameStep == (m_FiveStep ? 4u : 3u);
+        if (last) {
+            if (!m_FiveStep && !m_FrameIRQInhibit) {
+                m_FrameIRQ = true;
+            }
+            m_FrameStart += m_FiveStep ? kFiveStepPeriod : kFourStepPeriod;
+            m_FrameStep = 0;
+        }
+        else {
+            m_FrameStep++;
+        }
+
+        UpdateOutputs(event);
+    }
+
+    RunChannels(cycle);
+    m_Time = std::max(m_Time, cycle);
+}
+
+void APU::RunChannels(uint64_t cycle) {
+    RunPulse(m_Pulse[0], cycle);
+    RunPulse(m_Pulse[1], cycle);
+    RunTriangle(cycle);
+    RunNoise(cycle);
+    RunDMC(cycle);
+}
+
+void APU::Apply(uint64_t cycle, uint16_t address, uint8_t value) {
+    switch (address) {
+    case 0x4000:
+    case 0x4004: {
+        Pulse& pulse = m_Pulse[(address >> 2) & 1];
+        pulse.Duty = value >> 6;
+        pulse.Env.Loop = (value & 0x20) != 0;
+        pulse.Env.Constant = (value & 0x10) != 0;
+        pulse.Env.Volume = value & 0x0f;
+        break;
+    }
+    case 0x4001:
+    case 0x4005: {
+        Pulse& pulse = m_Pulse[(address >> 2) & 1];
+        pulse.SweepEnabled = (value & 0x80) != 0;
+        pulse.SweepPeriod = (value >> 4) & 0x07;
+        pulse.SweepNegate = (value & 0x08) != 0;
+        pulse.SweepShift = value & 0x07;
+        pulse.SweepReload = true;
+        break;
+    }
+    case 0x4002:
+    case 0x4006: {
+        Pulse& pulse = m_Pulse[(address >> 2) & 1];
+        pulse.Timer = (pulse.Timer & 0x0700) | value;
+        break;
+    }
+    case 0x4003:
+    case 0x4007: {
+        Pulse& pulse = m_Pulse[(address >> 2) & 1];
+        pulse.Timer = (pulse.Timer & 0x00ff) | ((value & 0x07) << 8);
+        if (pulse.Enabled) {
+            pulse.Length = kLengths[value >> 3];
+        }
+        pulse.Step = 0;
+        pulse.Env.Start = true;
+        break;
+    }
+    case 0x4008:
+        m_Triangle.Control = (value & 0x80) != 0;
+        m_Triangle.LinearPeriod = value & 0x7f;
+        break;
+    case 0x400a:
+        m_Triangle.Timer = (m_Triangle.Timer & 0x0700) | value;
+        break;
+    case 0x400b:
+        m_Triangle.Timer = (m_Triangle.Timer & 0x00ff) | ((value & 0x07) << 8);
+        if (m_Triangle.Enabled) {
+            m_Triangle.Length = kLengths[value >> 3];
+        }
+        m_Triangle.LinearReload = true;
+        break;
+    case 0x400c:
+        m_Noise.Env.Loop = (value & 0x20) != 0;
+        m_Noise.Env.Constant = (value & 0x10) != 0;
+        m_Noise.Env.Volume = value & 0x0f;
+        break;
+    case 0x400e:
+        m_Noise.Mode = (value & 0x80) != 0;
+        m_Noise.Period = value & 0x0f;
+        break;
+    case 0x400f:
+        if (m_Noise.Enabled) {
+            m_Noise.Length = kLengths[value >> 3];
+        }
+        m_Noise.Env.Start = true;
+        break;
+    case 0x4010:
+        m_DMC.IRQEnabled = (value & 0x80) != 0;
+        m_DMC.Loop = (value & 0x40) != 0;
+        m_DMC.Rate = kDMCRates[value & 0x0f];
+        if (!m_DMC.IRQEnabled) {
+            m_DMCIRQ = false;
+        }
+        break;
+    case 0x4011:
+        m_DMC.Level = value & 0x7f;
+        break;
+    case 0x4012:
+        m_DMC.SampleAddress = 0xc000 | (value << 6);
+        break;
+    case 0x4013:
+        m_DMC.SampleLength = (value << 4) | 1;
+        break;
+    case 0x4015:
+        m_Pulse[0].Enabled = (value & 0x01) != 0;
+        m_Pulse[1].Enabled = (value & 0x02) != 0;
+        m_Triangle.Enabled = (value & 0x04) != 0;
+        m_Noise.Enabled = (value & 0x08) != 0;
+        m_Pulse[0].Length = m_Pulse[0].Enabled ? m_Pulse[0].Length : 0;
+        m_Pulse[1].Length = m_Pulse[1].Enabled ? m_Pulse[1].Length : 0;
+        m_Triangle.Length = m_Triangle.Enabled ? m_Triangle.Length : 0;
+        m_Noise.Length = m_Noise.Enabled ? m_Noise.Length : 0;
+
+        if (value & 0x10) {
+            if (m_DMC.BytesRemaining == 0) {
+                RestartDMC();
+                FetchDMC(cycle);
+            }
+        }
+        else {
+            m_DMC.BytesRemaining = 0;
+        }
+        m_DMCIRQ = false;
+        break;
+    case 0x4017:
+        // The sequence restarts 3 or 4 cycles later depending on where in an
+        // APU cycle the write lands.  Five step mode clocks everything
+        // straight away.
+        m_FiveStep = (value & 0x80) != 0;
+        m_FrameIRQInhibit = (value & 0x40) != 0;
+        if (m_FrameIRQInhibit) {
+            m_FrameIRQ = false;
+        }
+        m_FrameStart = cycle + ((cycle & 1) ? 4 : 3);
+        m_FrameStep = 0;
+        if (m_FiveStep) {
+            ClockQuarterFrame();
+            ClockHalfFrame();
+        }
+        break;
+    }
+
+    UpdateOutputs(cycle);
+}
+
+void APU::UpdateIRQCycle() {
+    if (m_FrameIRQ || m_DMCIRQ) {
+        m_IRQCycle = 0;
+        return;
+    }
+
+    m_IRQCycle = UINT64_MAX;
+
+    if (!m_FiveStep && !m_FrameIRQInhibit) {
+        m_IRQCycle = m_FrameStart + kFourStep[3];
+    }
+
+    // Bytes are fetched as the output unit empties the buffer, every 8th
+    // clock once it's going.  The IRQ is raised when the last one is.
+    if (m_DMC.IRQEnabled && !m_DMC.Loop && m_DMC.BytesRemaining > 0) {
+        uint64_t reload = m_DMC.NextClock + (uint64_t)(m_DMC.BitsRemaining - 1) * m_DMC.Rate;
+        uint64_t last = reload + (uint64_t)(m_DMC.BytesRemaining - 1) * 8 * m_DMC.Rate;
+        m_IRQCycle = std::min(m_IRQCycle, last);
+    }
+}
+
+static void ClockEnvelope(uint8_t& divider, uint8_t& decay, bool& start, uint8_t period, bool loop) {
+    if (start) {
+        start = false;
+        decay = 15;
+        divider = period;
+    }
+    else if (divider == 0) {
+        divider = period;
+        if (decay > 0) {
+            decay--;
+        }
+        else if (loop) {
+            decay = 15;
+        }
+    }
+    else {
+        divider--;
+    }
+}
+
+void APU::ClockQuarterFrame() {
+    for (Pulse& pulse : m_Pulse) {
+        ClockEnvelope(pulse.Env.Divider, pulse.Env.Decay, pulse.Env.Start, pulse.Env.Volume, pulse.Env.Loop);
+    }
+    ClockEnvelope(m_Noise.Env.Divider, m_Noise.Env.Decay, m_Noise.Env.Start, m_Noise.Env.Volume, m_Noise.Env.Loop);
+
+    if (m_Triangle.LinearReload) {
+        m_Triangle.Linear = m_Triangle.LinearPeriod;
+    }
+    else if (m_Triangle.Linear > 0) {
+        m_Triangle.Linear--;
+    }
+    if (!m_Triangle.Control) {
+        m_Triangle.LinearReload = false;
+    }
+}
+
+void APU::ClockHalfFrame() {
+    for (Pulse& pulse : m_Pulse) {
+        if (!pulse.Env.Loop && pulse.Length > 0) {
+            pulse.Length--;
+        }
+
+        if (pulse.SweepDivider == 0 && pulse.SweepEnabled && pulse.SweepShift > 0 && !PulseMuted(pulse)) {
+            uint16_t change = pulse.Timer >> pulse.SweepShift;
+            if (pulse.SweepNegate) {
+                pulse.Timer -= std::min<uint16_t>(pulse.Timer, change + pulse.OnesComplement);
+            }
+            else {
+                pulse.Timer += change;
+            }
+        }
+
+        if (pulse.SweepDivider == 0 || pulse.SweepReload) {
+            pulse.SweepDivider = pulse.SweepPeriod;
+            pulse.SweepReload = false;
+        }
+        else {
+            pulse.SweepDivider--;
+        }
+    }
+
+    if (!m_Triangle.Control && m_Triangle.Length > 0) {
+        m_Triangle.Length--;
+    }
+    if (!m_Noise.Env.Loop && m_Noise.Length > 0) {
+        m_Noise.Length--;
+    }
+}
+
+bool APU::PulseMuted(const Pulse& pulse) const {
+    // Muted by the sweep unit even when it isn't enabled
+    if (pulse.Timer < 8) {
+        return true;
+    }
+    return !pulse.SweepNegate && pulse.Timer + (pulse.Timer >> pulse.SweepShift) > 0x7ff;
+}
+
+static uint8_t EnvelopeVolume(bool constant, uint8_t volume, uint8_t decay) {
+    return constant ? volume : decay;
+}
+
+int32_t APU::PulseOutput(const Pulse& pulse) const {
+    if (pulse.Length == 0 || PulseMuted(pulse) || !kDuty[pulse.Duty][pulse.Step]) {
+        return 0;
+    }
+    return EnvelopeVolume(pulse.Env.Constant, pulse.Env.Volume, pulse.Env.Decay);
+}
+
+int32_t APU::NoiseOutput() const {
+    if (m_Noise.Length == 0 || (m_Noise.Shift & 1)) {
+        return 0;
+    }
+    return EnvelopeVolume(m_Noise.Env.Constant, m_Noise.Env.Volume, m_Noise.Env.Decay);
+}
+
+void APU::UpdateOutputs(uint64_t cycle) {
+    SetAmplitude(m_Pulse[0].Amplitude, PulseOutput(m_Pulse[0]), kPulseGain, cycle);
+    SetAmplitude(m_Pulse[1].Amplitude, PulseOutput(m_Pulse[1]), kPulseGain, cycle);
+    SetAmplitude(m_Noise.Amplitude, NoiseOutput(), kNoiseGain, cycle);
+    SetAmplitude(m_DMC.Amplitude, m_DMC.Level, kDMCGain, cycle);
+}
+
+void APU::SetAmplitude(int32_t& amplitude, int32_t value, int32_t gain, uint64_t cycle) {
+    if (value != amplitude) {
+        m_Blip.AddDelta((uint32_t)(cycle - m_BlipStart), (value - amplitude) * gain);
+        amplitude = value;
+    }
+}
+
+void APU::RunPulse(Pulse& pulse, uint64_t end) {
+    if (pulse.NextClock >= end) {
+        return;
+    }
+
+    uint64_t period = (pulse.Timer + 1) * 2;
+
+    uint32_t volume = EnvelopeVolume(pulse.Env.Constant, pulse.Env.Volume, pulse.Env.Decay);
+    if (pulse.Length == 0 || volume == 0 || PulseMuted(pulse)) {
+        // Silent whatever the step, so only where it ends up matters
+        uint64_t steps = (end - pulse.NextClock + period - 1) / period;
+        pulse.Step = (uint8_t)((pulse.Step + steps) & 7);
+        pulse.NextClock += steps * period;
+        return;
+    }
+
+    const uint8_t* duty = kDuty[pulse.Duty];
+    while (pulse.NextClock < end) {
+        pulse.Step = (pulse.Step + 1) & 7;
+        SetAmplitude(pulse.Amplitude, duty[pulse.Step] ? volume : 0, kPulseGain, pulse.NextClock);
+        pulse.NextClock += period;
+    }
+}
+
+void APU::RunTriangle(uint64_t end) {
+    if (m_Triangle.NextClock >= end) {
+        return;
+    }
+
+    // Stops where it is when either counter runs out.  Periods under 2 are
+    // ultrasonic and only cost time and a pop, so they hold too.
+    if (m_Triangle.Length == 0 || m_Triangle.Linear == 0 || m_Triangle.Timer < 2) {
+        m_Triangle.NextClock = end;
+        return;
+    }
+
+    uint64_t period = m_Triangle.Timer + 1;
+    while (m_Triangle.NextClock < end) {
+        m_Triangle.Step = (m_Triangle.Step + 1) & 31;
+        SetAmplitude(m_Triangle.Amplitude, kTriangle[m_Triangle.Step], kTriangleGain, m_Triangle.NextClock);
+        m_Triangle.NextClock += period;
+    }
+}
+
+void APU::RunNoise(uint64_t end) {
+    uint64_t period = kNoisePeriods[m_Noise.Period];
+    int32_t volume = m_Noise.Length > 0 ? EnvelopeVolume(m_Noise.Env.Constant, m_Noise.Env.Volume, m_Noise.Env.Decay) : 0;
+    uint32_t tap = m_Noise.Mode ? 6 : 1;
+
+    // The shift register keeps going while silent so the pattern carries on
+    // where it would have
+    uint16_t shift = m_Noise.Shift;
+    while (m_Noise.NextClock < end) {
+        uint16_t feedback = (shift ^ (shift >> tap)) & 1;
+        shift = (shift >> 1) | (feedback << 14);
+        if (volume != 0) {
+            SetAmplitude(m_Noise.Amplitude, (shift & 1) ? 0 : volume, kNoiseGain, m_Noise.NextClock);
+        }
+        m_Noise.NextClock += period;
+    }
+    m_Noise.Shift = shift;
+}
+
+void APU::RunDMC(uint64_t end) {
+    while (m_DMC.NextClock < end) {
+        if (m_DMC.Silence && !m_DMC.BufferFull) {
+            // Nothing left to play or fetch, only the bit count moves
+            uint64_t clocks = (end - m_DMC.NextClock + m_DMC.Rate - 1) / m_DMC.Rate;
+            m_DMC.BitsRemaining = (uint8_t)((m_DMC.BitsRemaining - 1 + 8 - clocks % 8) % 8 + 1);
+            m_DMC.NextClock += clocks * m_DMC.Rate;
+            return;
+        }
+
+        if (!m_DMC.Silence) {
+            if (m_DMC.Shift & 1) {
+                if (m_DMC.Level <= 125) {
+                    m_DMC.Level += 2;
+                }
+            }
+            else if (m_DMC.Level >= 2) {
+                m_DMC.Level -= 2;
+            }
+            SetAmplitude(m_DMC.Amplitude, m_DMC.Level, kDMCGain, m_DMC.NextClock);
+        }
+        m_DMC.Shift >>= 1;
+
+        if (--m_DMC.BitsRemaining == 0) {
+            m_DMC.BitsRemaining = 8;
+            if (m_DMC.BufferFull) {
+                m_DMC.Silence = false;
+                m_DMC.Shift = m_DMC.Buffer;
+                m_DMC.BufferFull = false;
+                FetchDMC(m_DMC.NextClock);
+            }
+            else {
+                m_DMC.Silence = true;
+            }
+        }
+
+        m_DMC.NextClock += m_DMC.Rate;
+    }
+}
+
+// Sample bytes are read when they're needed during playback, which is after
+// the CPU has moved on, so the cycles the fetch steals from the CPU aren't
+// taken
+void APU::FetchDMC(uint64_t cycle) {
+    if (m_DMC.BufferFull || m_DMC.BytesRemaining == 0) {
+        return;
+    }
+
+    m_DMC.Buffer = m_Map.Peek(m_DMC.Address);
+    m_DMC.BufferFull = true;
+    m_DMC.Address = m_DMC.Address == 0xffff ? 0x8000 : m_DMC.Address + 1;
+
+    if (--m_DMC.BytesRemaining == 0) {
+        if (m_DMC.Loop) {
+            RestartDMC();
+        }
+        else if (m_DMC.IRQEnabled) {
+            m_DMCIRQ = true;
+        }
+    }
+}
+
+void APU::RestartDMC() {
+    m_DMC.Address = m_DMC.SampleAddress;
+    m_DMC.BytesRemaining = m_DMC.SampleLength;
+}
+
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BlipBuffer.h"
+
+namespace raunnes {
+
+class CPUCore6502;
+class MemoryMap;
+
+// The 2A03's sound: two pulses, triangle, noise and DMC, plus the frame
+// counter and its IRQ.
+// https://www.nesdev.org/wiki/APU
+//
+// Like the PPU it runs lazily, but more so.  Register writes are only logged
+// with the CPU cycle they happened on; the log is played back and the
+// channels run in one batch at the end of each frame, emitting amplitude
+// changes into a BlipBuffer.  Channels step from one timer event to the next
+// rather than ticking every cycle, and silent channels skip ahead
+// arithmetically.
+//
+// Reading $4015, and the writes that can move an IRQ ($4010, $4015, $4017),
+// catch up first.  Nothing else can change when the IRQ line next goes low,
+// so IRQCycle() stays exact between them and the CPU checks it with one
+// compare per instruction.
+class APU {
+public:
+    // NTSC CPU clock, cycles a second
+    static const uint32_t kClockRate = 1789773;
+
+    // Everything that changes as the APU runs, including the samples not yet
+    // read, for snapshots.  Defined below.
+    struct State;
+
+public:
+    APU(MemoryMap& memory);
+    ~APU();
+
+    // Writes are timestamped with cpu's cycle count
+    void AttachClock(const CPUCore6502* cpu);
+
+    // Default 48000.  Clears any samples not yet read.
+    void SetSampleRate(uint32_t sampleRate);
+    uint32_t SampleRate() const { return m_Blip.SampleRate(); }
+
+    // Makes ratio times as many samples per emulated second, for keeping an
+    // audio device fed whose clock doesn't quite match the emulator's pacing
+    void SetRateAdjust(double ratio);
+
+    // $4000-$4013, $4015, $4017
+    void WriteRegister(uint16_t address, uint8_t value);
+
+    // $4015, clears the frame IRQ
+    uint8_t ReadStatus();
+
+    // CPU cycle the IRQ line goes (or went) low, UINT64_MAX if it won't
+    // without another register access
+    uint64_t IRQCycle() const { return m_IRQCycle; }
+
+    // Runs everything up to the CPU's current cycle and makes the samples up
+    // to there readable.  Samples nobody reads are dropped once about a
+    // quarter of a second has built up.
+    void EndFrame();
+
+    uint32_t SamplesAvailable() const { return m_Blip.SamplesAvailable(); }
+    uint32_t ReadSamples(int16_t* out, uint32_t count) { return m_Blip.ReadSamples(out, count); }
+
+    // The sample rate and rate adjustment are settings, not state, and are
+    // left alone
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+public:
+    APU(const APU&) = delete;
+    APU& operator=(const APU&) = delete;
+
+private:
+    // https://www.nesdev.org/wiki/APU_Envelope
+    struct Envelope {
+        bool Start;
+        bool Loop;          // also the length counter halt
+        bool Constant;
+        uint8_t Volume;     // constant volume, or the divider period
+        uint8_t Divider;
+        uint8_t Decay;
+    };
+
+    // https://www.nesdev.org/wiki/APU_Pulse
+    struct Pulse {
+        Envelope Env;
+        uint8_t Duty;
+        uint8_t Step;
+        uint16_t Timer;
+        uint8_t Length;
+        bool Enabled;
+
+        // https://www.nesdev.org/wiki/APU_Sweep
+        bool SweepEnabled;
+        bool SweepNegate;
+        bool SweepReload;
+        uint8_t SweepPeriod;
+        uint8_t SweepShift;
+        uint8_t SweepDivider;
+        uint16_t OnesComplement;    // 1 for pulse 1, which negates one lower
+
+        uint64_t NextClock;
+        int32_t Amplitude;
+    };
+
+    // https://www.nesdev.org/wiki/APU_Triangle
+    struct Triangle {
+        bool Control;       // also the length counter halt
+        uint8_t LinearPeriod;
+        uint8_t Linear;
+        bool LinearReload;
+        uint8_t Step;
+        uint16_t Timer;
+        uint8_t Length;
+        bool Enabled;
+
+        uint64_t NextClock;
+        int32_t Amplitude;
+    };
+
+    // https://www.nesdev.org/wiki/APU_Noise
+    struct Noise {
+        Envelope Env;
+        bool Mode;
+        uint8_t Period;     // index into the period table
+        uint16_t Shift;
+        uint8_t Length;
+        bool Enabled;
+
+        uint64_t NextClock;
+        int32_t Amplitude;
+    };
+
+    // https://www.nesdev.org/wiki/APU_DMC
+    struct DMC {
+        bool IRQEnabled;
+        bool Loop;
+        uint16_t Rate;      // CPU cycles per output bit
+        uint8_t Level;
+        uint16_t SampleAddress;
+        uint16_t SampleLength;
+
+        uint16_t Address;
+        uint16_t BytesRemaining;
+        uint8_t Buffer;
+        bool BufferFull;
+        uint8_t Shift;
+        uint8_t BitsRemaining;
+        bool Silence;
+
+        uint64_t NextClock;
+        int32_t Amplitude;
+    };
+
+    struct LoggedWrite {
+        uint64_t Cycle;
+        uint16_t Address;
+        uint8_t Value;
+    };
+
+    uint64_t Now() const;
+
+    // Plays the log back and runs everything up to cycle
+    void Sync(uint64_t cycle);
+    void Run(uint64_t cycle);
+    void RunChannels(uint64_t cycle);
+    void Apply(uint64_t cycle, uint16_t address, uint8_t value);
+    void UpdateIRQCycle();
+
+    void ClockQuarterFrame();
+    void ClockHalfFrame();
+
+    void RunPulse(Pulse& pulse, uint64_t end);
+    void RunTriangle(uint64_t end);
+    void RunNoise(uint64_t end);
+    void RunDMC(uint64_t end);
+    void FetchDMC(uint64_t cycle);
+    void RestartDMC();
+
+    bool PulseMuted(const Pulse& pulse) const;
+    int32_t PulseOutput(const Pulse& pulse) const;
+    int32_t NoiseOutput() const;
+    void UpdateOutputs(uint64_t cycle);
+
+    void SetAmplitude(int32_t& amplitude, int32_t value, int32_t gain, uint64_t cycle);
+
+private:
+    MemoryMap& m_Map;
+    const CPUCore6502* m_Clock;
+    BlipBuffer m_Blip;
+    uint64_t m_BlipStart;       // cycle the blip frame being built starts on
+
+    uint64_t m_Time;            // everything has run up to here
+    std::vector<LoggedWrite> m_Log;
+
+    Pulse m_Pulse[2];
+    Triangle m_Triangle;
+    Noise m_Noise;
+    DMC m_DMC;
+
+    // https://www.nesdev.org/wiki/APU_Frame_Counter
+    bool m_FiveStep;
+    bool m_FrameIRQInhibit;
+    uint64_t m_FrameStart;      // cycle the current sequence started on
+    uint32_t m_FrameStep;       // next step in it
+
+    bool m_FrameIRQ;
+    bool m_DMCIRQ;
+    uint64_t m_IRQCycle;
+};
+
+// The first save sizes the vectors, later ones reuse them
+struct APU::State {
+    BlipBuffer::State Blip;
+    uint64_t BlipStart;
+    uint64_t Time;
+    std::vector<LoggedWrite> Log;
+
+    Pulse PulseChannels[2];
+    Triangle TriangleChannel;
+    Noise NoiseChannel;
+    DMC DMCChannel;
+
+    bool FiveStep;
+    bool FrameIRQInhibit;
+    uint64_t FrameStart;
+    uint32_t FrameStep;
+
+    bool FrameIRQ;
+    bool DMCIRQ;
+    uint64_t IRQCycle;
+};
+
+}
@@ -0,0 +1,180 @@
+#include "AudioOutput.h"
+
+#include "APU.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace raunnes {
+
+// Furthest the rate is ever pushed from 1.  Twice the half percent of clock
+// difference it's meant to keep up with, so even then there's room to steer
+// the fill back; 1% is a sixth of a semitone, and only comes up briefly.
+static const double kMaxAdjust = 0.01;
+
+// How much of each new fill reading goes into the average, about 20 frames
+static const double kFillSmoothing = 0.05;
+
+// Per frame share of the fill error the integral picks up, so a steady clock
+// difference ends up fully corrected rather than leaving the fill off target
+static const double kIntegralGain = 0.005;
+
+static uint32_t RingCapacity(uint32_t target) {
+    // Room for the target, the frame on top of it and plenty of slack
+    uint32_t capacity = 1024;
+    while (capacity < target * 4) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+AudioOutput::AudioOutput(uint32_t sampleRate, uint32_t latencyMs) :
+    m_Ring(RingCapacity(sampleRate * latencyMs / 1000)),
+    m_SampleRate(sampleRate),
+    m_Target(sampleRate * latencyMs / 1000),
+    m_Primed(false),
+    m_SmoothedFill(0),
+    m_Integral(0),
+    m_Ratio(1.0),
+    m_Overruns(0),
+    m_Last(0),
+    m_Underruns(0) {
+    m_SmoothedFill = m_Target;
+}
+
+AudioOutput::~AudioOutput() {
+}
+
+void AudioOutput::Push(APU& apu) {
+    if (apu.SampleRate() != m_SampleRate) {
+        apu.SetSampleRate(m_SampleRate);
+    }
+
+    TraceSpan span("Audio push");
+    span.SetCount(apu.SamplesAvailable());
+
+    int16_t buffer[1024];
+    if (!m_Primed) {
+        std::fill(buffer, buffer + 1024, (int16_t)0);
+        uint32_t fill = m_Ring.Fill() + apu.SamplesAvailable();
+        while (fill < m_Target) {
+            uint32_t count = std::min(m_Target - fill, 1024u);
+            m_Ring.Write(buffer, count);
+            fill += count;
+        }
+        m_Primed = true;
+    }
+
+    while (uint32_t count = apu.ReadSamples(buffer, 1024)) {
+        uint32_t written = m_Ring.Write(buffer, count);
+        if (written < count) {
+            m_Overruns.fetch_add(count - written, std::memory_order_relaxed);
+        }
+    }
+
+    // PI control on the smoothed fill: too full makes fewer samples per
+    // emulated second, too empty more
+    double fill = m_Ring.Fill();
+    m_SmoothedFill += (fill - m_SmoothedFill) * kFillSmoothing;
+
+    double error = (m_SmoothedFill - m_Target) / m_Target;
+    error = std::max(-1.0, std::min(1.0, error));
+    m_Integral = std::max(-1.0, std::min(1.0, m_Integral + error * kIntegralGain));
+
+    double adjust = std::max(-1.0, std::min(1.0, error + m_Integral));
+    double ratio = 1.0 - kMaxAdjust * adjust;
+    m_Ratio.store(ratio, std::memory_order_relaxed);
+    apu.SetRateAdjust(ratio);
+}
+
+void AudioOutput::Pull(int16_t* out, uint32_t count) {
+    TraceSpan span("Audio pull");
+    span.SetCount(count);
+
+    uint32_t read = m_Ring.Read(out, count);
+    if (read > 0) {
+        m_Last = out[read - 1];
+    }
+
+    if (read < count) {
+        for (uint32_t i = read; i < count; i++) {
+            out[i] = m_Last;
+        }
+        m_Underruns.fetch_add(count - read, std::memory_order_relaxed);
+    }
+}
+
+AudioOutput::Stats AudioOutput::GetStats() const {
+    Stats stats;
+    stats.Fill = m_Ring.Fill();
+    stats.LatencyMs = stats.Fill * 1000.0 / m_SampleRate;
+    stats.Ratio = m_Ratio.load(std::memory_order_relaxed);
+    stats.Underruns = m_Underruns.load(std::memory_order_relaxed);
+    stats.Overruns = m_Overruns.load(std::memory_order_relaxed);
+    return stats;
+}
+
+NullAudioDevice::NullAudioDevice(AudioOutput& output, uint32_t chunk, double speed) :
+    m_Output(output),
+    m_Chunk(chunk),
+    m_Speed(speed),
+    m_Running(false),
+    m_Pulled(0),
+    m_Buffer(chunk),
+    m_Seconds(0) {
+}
+
+NullAudioDevice::~NullAudioDevice() {
+    Stop();
+}
+
+void NullAudioDevice::Start() {
+    if (m_Thread.joinable()) {
+        return;
+    }
+
+    m_Running.store(true);
+    m_Thread = std::thread(&NullAudioDevice::Run, this);
+}
+
+void NullAudioDevice::Stop() {
+    m_Running.store(false);
+    if (m_Thread.joinable()) {
+        m_Thread.join();
+    }
+}
+
+void NullAudioDevice::Advance(double seconds) {
+    // Counted from the start like Run()'s deadlines, so rounding never
+    // accumulates
+    m_Seconds += seconds;
+    PullUntil((uint64_t)(m_Seconds * m_Output.SampleRate() * m_Speed));
+}
+
+void NullAudioDevice::Run() {
+    Trace::SetThreadName("Audio");
+
+    // Deadlines are counted in samples from the start so rounding never
+    // accumulates
+    auto start = std::chrono::steady_clock::now();
+
+    while (m_Running.load(std::memory_order_relaxed)) {
+        PullUntil(SamplesPulled() + m_Chunk);
+
+        auto due = start + std::chrono::nanoseconds((uint64_t)(SamplesPulled() * 1e9 / (m_Output.SampleRate() * m_Speed)));
+        std::this_thread::sleep_until(due);
+    }
+}
+
+void NullAudioDevice::PullUntil(uint64_t samples) {
+    uint64_t pulled = SamplesPulled();
+    while (pulled + m_Chunk <= samples) {
+        m_Output.Pull(m_Buffer.data(), m_Chunk);
+        pulled += m_Chunk;
+        m_Pulled.store(pulled, std::memory_order_relaxed);
+    }
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "SampleRing.h"
+
+namespace raunnes {
+
+class APU;
+
+// Carries the APU's samples to an audio device that runs on its own clock.
+//
+// The emulation thread pushes a frame's samples at a time into a lock-free
+// ring and the device's callback pulls from it.  Video pacing decides how
+// fast frames come, so the two clocks drift; rather than let the ring run dry
+// or overflow, each push looks at how full it is and nudges the APU's
+// resampling ratio (at most a percent, and once settled only as far as the
+// clocks differ, too little to hear) to hold the fill, and with it the
+// latency, steady.
+// https://docs.libretro.com/development/cores/dynamic-rate-control/
+//
+// The resampling itself is the APU's BlipBuffer, whose windowed-sinc
+// polyphase kernel goes straight from the CPU clock to the device rate.
+class AudioOutput {
+public:
+    struct Stats {
+        uint32_t Fill;          // samples queued right now
+        double LatencyMs;       // the same in time
+        double Ratio;           // current rate adjustment, 1 is none
+        uint64_t Underruns;     // samples the device wanted that weren't there
+        uint64_t Overruns;      // samples that didn't fit
+    };
+
+public:
+    // latencyMs is how much audio to keep queued just after each frame is
+    // pushed; on average it's about half a frame less
+    AudioOutput(uint32_t sampleRate, uint32_t latencyMs = 30);
+    ~AudioOutput();
+
+    uint32_t SampleRate() const { return m_SampleRate; }
+
+    // Emulation thread, after every frame.  Moves everything the APU has into
+    // the ring and steers its rate.  The first push tops the ring up to the
+    // target with silence, there being no other way to fill it but slowly
+    // through the rate.
+    void Push(APU& apu);
+
+    // Device thread.  Always fills count, repeating the last sample for any
+    // it doesn't have.
+    void Pull(int16_t* out, uint32_t count);
+
+    Stats GetStats() const;
+
+public:
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
+
+private:
+    SampleRing m_Ring;
+    uint32_t m_SampleRate;
+    uint32_t m_Target;
+
+    // Producer side
+    bool m_Primed;
+    double m_SmoothedFill;
+    double m_Integral;
+    std::atomic<double> m_Ratio;
+    std::atomic<uint64_t> m_Overruns;
+
+    // Consumer side
+    int16_t m_Last;
+    std::atomic<uint64_t> m_Underruns;
+};
+
+// Plays to nowhere in real time: pulls chunk samples from an AudioOutput every
+// chunk / sample rate seconds on its own thread, like a sound card would.  For
+// running without a sound device and for testing the rate control, which can
+// also drive it from its own clock with Advance() instead of starting it.
+class NullAudioDevice {
+public:
+    // speed above 1 plays faster than the sample rate, like a sound card
+    // whose crystal runs fast, to test drift
+    NullAudioDevice(AudioOutput& output, uint32_t chunk = 256, double speed = 1.0);
+    ~NullAudioDevice();
+
+    void Start();
+    void Stop();
+
+    // Not started: plays seconds of time at once, pulling every chunk that
+    // falls due in it
+    void Advance(double seconds);
+
+    uint64_t SamplesPulled() const { return m_Pulled.load(std::memory_order_relaxed); }
+
+public:
+    NullAudioDevice(const NullAudioDevice&) = delete;
+    NullAudioDevice& operator=(const NullAudioDevice&) = delete;
+
+private:
+    void Run();
+    void PullUntil(uint64_t samples);
+
+private:
+    AudioOutput& m_Output;
+    uint32_t m_Chunk;
+    double m_Speed;
+
+    std::thread m_Thread;
+    std::atomic<bool> m_Running;
+    std::atomic<uint64_t> m_Pulled;
+    std::vector<int16_t> m_Buffer;
+    double m_Seconds;
+};
+
+}
@@ -0,0 +1,175 @@
+#include "BlipBuffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace raunnes {
+
+// Kernel taps are Q15, each phase sums to 1.0
+static const int32_t kKernelBits = 15;
+
+// The integrator leaks 1 / 2^kBassShift per sample, a high pass around 15 Hz
+// at 48 kHz that keeps DC from building up, like the console's own output
+// capacitors.
+static const int32_t kBassShift = 9;
+
+BlipBuffer::BlipBuffer() :
+    m_Factor(0),
+    m_Offset(0),
+    m_SampleRate(0),
+    m_Available(0),
+    m_End(0),
+    m_Integrator(0) {
+
+    // Windowed sinc impulse, cut off a little under Nyquist, sampled at each
+    // sub-sample phase.  The impulse sits kTaps / 2 samples in, which is the
+    // buffer's latency.
+    const double kPi = 3.14159265358979323846;
+    const double cutoff = 0.9;
+
+    for (uint32_t phase = 0; phase < kPhases; phase++) {
+        double taps[kTaps];
+        double sum = 0;
+
+        for (uint32_t i = 0; i < kTaps; i++) {
+            double d = (double)i - kTaps / 2 - (double)phase / kPhases;
+            double x = kPi * cutoff * d;
+            double sinc = x == 0 ? 1.0 : sin(x) / x;
+
+            double w = 0;
+            if (fabs(d) <= kTaps / 2) {
+                double t = 2 * kPi * d / kTaps;
+                w = 0.42 + 0.5 * cos(t) + 0.08 * cos(2 * t);   // Blackman
+            }
+
+            taps[i] = sinc * w;
+            sum += taps[i];
+        }
+
+        // Round so every phase adds up to exactly 1.0, or steps would drift
+        int32_t total = 0;
+        uint32_t largest = 0;
+        for (uint32_t i = 0; i < kTaps; i++) {
+            m_Kernel[phase][i] = (int16_t)lround(taps[i] / sum * (1 << kKernelBits));
+            total += m_Kernel[phase][i];
+            if (m_Kernel[phase][i] > m_Kernel[phase][largest]) {
+                largest = i;
+            }
+        }
+        m_Kernel[phase][largest] += (int16_t)((1 << kKernelBits) - total);
+    }
+}
+
+BlipBuffer::~BlipBuffer() {
+}
+
+void BlipBuffer::SetRates(double clockRate, uint32_t sampleRate, uint32_t maxSamples) {
+    m_SampleRate = sampleRate;
+    SetClockRate(clockRate);
+    m_Deltas.assign(maxSamples + kTaps, 0);
+    Clear();
+}
+
+void BlipBuffer::SetClockRate(double clockRate) {
+    m_Factor = (uint64_t)(m_SampleRate / clockRate * 4294967296.0);
+}
+
+void BlipBuffer::Clear() {
+    std::fill(m_Deltas.begin(), m_Deltas.end(), 0);
+    m_Offset = 0;
+    m_Available = 0;
+    m_End = 0;
+    m_Integrator = 0;
+}
+
+void BlipBuffer::SaveState(State& state) const {
+    state.Offset = m_Offset;
+    state.Available = m_Available;
+    state.End = m_End;
+    state.Integrator = m_Integrator;
+
+    if (state.Deltas.size() != m_Deltas.size()) {
+        state.Deltas.resize(m_Deltas.size());
+    }
+    std::copy(m_Deltas.begin(), m_Deltas.begin() + m_End, state.Deltas.begin());
+}
+
+void BlipBuffer::LoadState(const State& state) {
+    if (state.Deltas.size() != m_Deltas.size()) {
+        Clear();
+        return;
+    }
+
+    // Everything past either end is zero, so only the longer one needs
+    // touching
+    std::copy(state.Deltas.begin(), state.Deltas.begin() + state.End, m_Deltas.begin());
+    if (m_End > state.End) {
+        std::fill(m_Deltas.begin() + state.End, m_Deltas.begin() + m_End, 0);
+    }
+
+    m_Offset = state.Offset;
+    m_Available = state.Available;
+    m_End = state.End;
+    m_Integrator = state.Integrator;
+}
+
+void BlipBuffer::AddDelta(uint32_t time, int32_t delta) {
+    uint64_t position = m_Offset + time * m_Factor;
+    uint32_t index = (uint32_t)(position >> 32);
+    uint32_t phase = (uint32_t)(position >> (32 - 5)) & (kPhases - 1);
+
+    // Only possible if the caller let a frame run past maxSamples
+    if (index + kTaps > m_Deltas.size()) {
+        assert(0);
+        return;
+    }
+
+    m_End = std::max(m_End, index + kTaps);
+
+    int32_t* out = &m_Deltas[index];
+    const int16_t* kernel = m_Kernel[phase];
+    for (uint32_t i = 0; i < kTaps; i++) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+void BlipBuffer::EndFrame(uint32_t time) {
+    m_Offset += time * m_Factor;
+    m_Available = (uint32_t)(m_Offset >> 32);
+    m_End = std::max(m_End, m_Available);
+    assert(m_Available + kTaps <= m_Deltas.size());
+}
+
+uint32_t BlipBuffer::ReadSamples(int16_t* out, uint32_t count) {
+    count = std::min(count, m_Available);
+    if (count == 0) {
+        return 0;
+    }
+
+    int32_t integrator = m_Integrator;
+    for (uint32_t i = 0; i < count; i++) {
+        int32_t sample = integrator >> kKernelBits;
+        integrator += m_Deltas[i];
+        sample = std::max(-32768, std::min(32767, sample));
+        if (out != nullptr) {
+            out[i] = (int16_t)sample;
+        }
+        integrator -= sample << (kKernelBits - kBassShift);
+    }
+    m_Integrator = integrator;
+
+    // Slide what's left down to the start: the tails of impulses past the
+    // end and anything already added for the frame being built
+    uint32_t remaining = m_End - count;
+    memmove(m_Deltas.data(), m_Deltas.data() + count, remaining * sizeof(int32_t));
+    std::fill(m_Deltas.begin() + remaining, m_Deltas.begin() + m_End, 0);
+    m_End = remaining;
+
+    m_Available -= count;
+    m_Offset -= (uint64_t)count << 32;
+    return count;
+}
+
+}
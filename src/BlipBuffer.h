@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace raunnes {
+
+// Band-limited step synthesis: turns amplitude changes stamped with a clock
+// time into samples at the output rate, without the aliasing of sampling a
+// square wave directly.
+//
+// Each change is added as a short windowed-sinc impulse at its sub-sample
+// position; reading integrates the impulses back into steps.  Work is per
+// change, not per clock, so a channel that changes level a few thousand
+// times a second costs a few thousand kernel adds however fast it's clocked.
+//
+// http://www.slack.net/~ant/bl-synth/
+class BlipBuffer {
+public:
+    // Kernel length in output samples, and sub-sample positions resolved
+    static const uint32_t kTaps = 16;
+    static const uint32_t kPhases = 32;
+
+    // Samples not yet read and impulses not yet integrated, for snapshots.
+    // The first save sizes Deltas, later ones reuse it.
+    struct State {
+        uint64_t Offset;
+        uint32_t Available;
+        uint32_t End;
+        int32_t Integrator;
+        std::vector<int32_t> Deltas;
+    };
+
+public:
+    BlipBuffer();
+    ~BlipBuffer();
+
+    // clockRate clocks per second in, sampleRate samples per second out,
+    // holding up to maxSamples unread.  Clears the buffer.
+    void SetRates(double clockRate, uint32_t sampleRate, uint32_t maxSamples);
+
+    uint32_t SampleRate() const { return m_SampleRate; }
+
+    // Changes the input rate, keeping what's buffered.  For steering the
+    // output rate a little against another clock.
+    void SetClockRate(double clockRate);
+
+    // delta is the change in amplitude at time, in clocks since the last
+    // EndFrame().  Times needn't be in order but have to stay within the
+    // frame being built.
+    void AddDelta(uint32_t time, int32_t delta);
+
+    // Makes the samples before time (in the same clocks) readable and starts
+    // the next frame's times there
+    void EndFrame(uint32_t time);
+
+    uint32_t SamplesAvailable() const { return m_Available; }
+
+    // Reads up to count samples, out may be null to throw them away.
+    // Returns how many were read.
+    uint32_t ReadSamples(int16_t* out, uint32_t count);
+
+    void Clear();
+
+    // Rates aren't part of the state; loading one saved at another sample
+    // rate just clears the buffer
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+public:
+    BlipBuffer(const BlipBuffer&) = delete;
+    BlipBuffer& operator=(const BlipBuffer&) = delete;
+
+private:
+    // Positions are output samples in 32.32 fixed point
+    uint64_t m_Factor;      // per clock
+    uint64_t m_Offset;      // start of the current frame, fraction carried over
+    uint32_t m_SampleRate;
+
+    std::vector<int32_t> m_Deltas;      // maxSamples + kTaps
+    uint32_t m_Available;
+    uint32_t m_End;         // past the last delta touched
+    int32_t m_Integrator;
+
+    int16_t m_Kernel[kPhases][kTaps];
+};
+
+}
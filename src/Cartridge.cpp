@@ -0,0 +1,174 @@
+#include "Cartridge.h"
+
+#include "RomDatabase.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace raunnes {
+
+Cartridge::Cartridge() :
+    m_HasCHRRAM(false),
+    m_Mapper(0),
+    m_Mirroring(MirroringHorizontal),
+    m_Region(RegionNTSC),
+    m_HasBattery(false),
+    m_Accuracy(PPUAccuracyScanline),
+    m_HeaderFixed(false),
+    m_Fingerprint() {
+}
+
+Cartridge::~Cartridge() {
+}
+
+bool Cartridge::Load(const std::string& path, const RomDatabase* db) {
+    std::ifstream romFile(path, std::ios::in | std::ios::binary);
+    if (!romFile.good()) {
+        m_Error = "can't open the file";
+        return false;
+    }
+
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(romFile)), std::istreambuf_iterator<char>());
+
+    if (!Load(image.data(), image.size(), db)) {
+        return false;
+    }
+
+    m_Path = path;
+    return true;
+}
+
+bool Cartridge::Load(const uint8_t* image, size_t size, const RomDatabase* db) {
+    const size_t headerSize = 16;
+    const size_t trainerSize = 512;
+
+    if (size < headerSize || memcmp(image, "NES\x1a", 4) != 0) {
+        m_Error = "not an iNES image";
+        return false;
+    }
+
+    const uint8_t* header = image;
+    uint8_t flags6 = header[6];
+    uint8_t flags7 = header[7];
+
+    bool nes20 = (flags7 & 0x0c) == 0x08;
+
+    // Old dumping tools wrote their name ("DiskDude!") over bytes 7-15, which
+    // turns into garbage in the upper mapper nibble.
+    bool dirty = !nes20 && (header[12] | header[13] | header[14] | header[15]) != 0;
+
+    size_t prgSize = header[4];
+    size_t chrSize = header[5];
+    if (nes20) {
+        prgSize |= (size_t)(header[9] & 0x0f) << 8;
+        chrSize |= (size_t)(header[9] & 0xf0) << 4;
+    }
+    prgSize *= 0x4000;
+    chrSize *= 0x2000;
+
+    m_Mapper = flags6 >> 4;
+    if (!dirty) {
+        m_Mapper |= flags7 & 0xf0;
+    }
+    if (nes20) {
+        m_Mapper |= (uint32_t)(header[8] & 0x0f) << 8;
+    }
+
+    if (flags6 & 0x08) {
+        m_Mirroring = MirroringFourScreen;
+    } else {
+        m_Mirroring = (flags6 & 0x01) ? MirroringVertical : MirroringHorizontal;
+    }
+
+    m_HasBattery = (flags6 & 0x02) != 0;
+
+    if (nes20) {
+        switch (header[12] & 0x03) {
+        case 1:
+            m_Region = RegionPAL;
+            break;
+        case 3:
+            m_Region = RegionDendy;
+            break;
+        default:
+            m_Region = RegionNTSC;
+            break;
+        }
+    } else {
+        m_Region = (!dirty && (header[9] & 0x01)) ? RegionPAL : RegionNTSC;
+    }
+
+    size_t offset = headerSize;
+    if (flags6 & 0x04) {
+        offset += trainerSize;
+    }
+
+    if (prgSize == 0 || offset + prgSize + chrSize > size) {
+        m_Error = "the image is shorter than its header says";
+        return false;
+    }
+
+    m_PRG.assign(image + offset, image + offset + prgSize);
+    offset += prgSize;
+
+    m_CHR.assign(image + offset, image + offset + chrSize);
+    m_HasCHRRAM = chrSize == 0;
+
+    m_Fingerprint = RomFingerprint::Compute(m_PRG.data(), m_PRG.size(), m_CHR.data(), m_CHR.size());
+
+    if (m_HasCHRRAM) {
+        m_CHR.assign(0x2000, 0);
+    }
+
+    m_Accuracy = PPUAccuracyScanline;
+    m_HeaderFixed = false;
+
+    if (db != nullptr) {
+        const RomDatabase::Entry* entry = db->Find(m_Fingerprint.Crc32, m_Fingerprint.Sha1String());
+
+        if (entry != nullptr) {
+            if (entry->Mapper >= 0 && (uint32_t)entry->Mapper != m_Mapper) {
+                m_Mapper = entry->Mapper;
+                m_HeaderFixed = true;
+            }
+            if (entry->Mirroring >= 0 && entry->Mirroring != m_Mirroring) {
+                m_Mirroring = (Mirroring)entry->Mirroring;
+                m_HeaderFixed = true;
+            }
+            if (entry->Region >= 0 && entry->Region != m_Region) {
+                m_Region = (Region)entry->Region;
+                m_HeaderFixed = true;
+            }
+            if (entry->Battery >= 0 && (entry->Battery != 0) != m_HasBattery) {
+                m_HasBattery = entry->Battery != 0;
+                m_HeaderFixed = true;
+            }
+            // Not a header field, so doesn't count as a fix
+            if (entry->PPUAccuracy >= 0) {
+                m_Accuracy = (PPUAccuracy)entry->PPUAccuracy;
+            }
+        }
+    }
+
+    // Checked after the database has had its say, it may know better
+    char error[96];
+    if (m_Mapper != 0) {
+        snprintf(error, sizeof(error), "mapper %u isn't supported, only 0 (NROM)", m_Mapper);
+    } else if (prgSize != 0x4000 && prgSize != 0x8000) {
+        snprintf(error, sizeof(error), "%zu KiB of PRG ROM, NROM has 16 or 32", prgSize / 1024);
+    } else if (chrSize > 0x2000) {
+        snprintf(error, sizeof(error), "%zu KiB of CHR ROM, NROM has at most 8", chrSize / 1024);
+    } else if (m_Region != RegionNTSC) {
+        snprintf(error, sizeof(error), "%s isn't supported, only NTSC", m_Region == RegionPAL ? "PAL" : "Dendy");
+    } else {
+        m_Error.clear();
+        return true;
+    }
+
+    m_Error = error;
+    return false;
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "RomHash.h"
+
+namespace raunnes {
+
+class RomDatabase;
+
+// An iNES / NES 2.0 image split into PRG and CHR, with the header decoded
+// and, if the ROM is known to the database, corrected.
+//
+// Only what the emulator can actually run loads: NTSC NROM (mapper 0) with
+// 16 or 32 KiB of PRG and at most 8 KiB of CHR.  Anything else fails with
+// the reason in Error() rather than running as something it isn't.
+//
+// https://www.nesdev.org/wiki/INES
+// https://www.nesdev.org/wiki/NES_2.0
+class Cartridge {
+public:
+    enum Mirroring {
+        MirroringHorizontal = 0,
+        MirroringVertical,
+        MirroringFourScreen,
+        MirroringSingleScreenLower,     // mapper controlled only
+        MirroringSingleScreenUpper,
+    };
+
+    enum Region {
+        RegionNTSC = 0,
+        RegionPAL,
+        RegionDendy,
+    };
+
+    // How faithfully the PPU has to run for this ROM.  Scanline renders a
+    // line at a time and is what nearly everything needs; Dot runs the real
+    // fetch pipeline for mid-scanline effects.
+    enum PPUAccuracy {
+        PPUAccuracyScanline = 0,
+        PPUAccuracyDot,
+    };
+
+public:
+    Cartridge();
+    ~Cartridge();
+
+    // db may be null, in which case the header is taken as is
+    bool Load(const std::string& path, const RomDatabase* db);
+    bool Load(const uint8_t* image, size_t size, const RomDatabase* db);
+
+    // Why the last Load() failed
+    const std::string& Error() const { return m_Error; }
+
+    const std::vector<uint8_t>& PRG() const { return m_PRG; }
+    const std::vector<uint8_t>& CHR() const { return m_CHR; }
+    bool HasCHRRAM() const { return m_HasCHRRAM; }
+
+    uint32_t Mapper() const { return m_Mapper; }
+    Mirroring Mirror() const { return m_Mirroring; }
+    Region RomRegion() const { return m_Region; }
+    bool HasBattery() const { return m_HasBattery; }
+    PPUAccuracy Accuracy() const { return m_Accuracy; }
+
+    // True if the database overrode anything from the header
+    bool HeaderFixed() const { return m_HeaderFixed; }
+
+    const RomFingerprint& Fingerprint() const { return m_Fingerprint; }
+    const std::string& Path() const { return m_Path; }
+
+public:
+    Cartridge(const Cartridge&) = delete;
+    Cartridge& operator=(const Cartridge&) = delete;
+
+private:
+    std::vector<uint8_t> m_PRG;
+    std::vector<uint8_t> m_CHR;
+    bool m_HasCHRRAM;
+
+    uint32_t m_Mapper;
+    Mirroring m_Mirroring;
+    Region m_Region;
+    bool m_HasBattery;
+    PPUAccuracy m_Accuracy;
+    bool m_HeaderFixed;
+
+    RomFingerprint m_Fingerprint;
+    std::string m_Path;
+    std::string m_Error;
+};
+
+}
@@ -0,0 +1,168 @@
+#include "Compositor.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAUNNES_X86 1
+#endif
+
+namespace raunnes {
+
+namespace {
+
+bool CompositeScalar(const uint8_t* bg, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t greyscaleMask, uint8_t* out, uint32_t count) {
+    bool hit = false;
+
+    for (uint32_t x = 0; x < count; x++) {
+        uint8_t b = bg[x];
+        uint8_t s = sprites[x];
+        uint8_t addr = (b & 0x03) ? b : 0;
+
+        if ((s & 0x03) && (!(b & 0x03) || !(s & 0x40))) {
+            addr = s & 0x1f;
+        }
+
+        if ((s & 0x80) && (s & 0x03) && (b & 0x03)) {
+            hit = true;
+        }
+
+        out[x] = palette[addr] & greyscaleMask;
+    }
+
+    return hit;
+}
+
+#if RAUNNES_X86
+// SSE2 has no byte shuffle, so the mux and the hit test run 16 wide and the
+// palette lookup is done per byte from the muxed addresses.
+bool CompositeSSE2(const uint8_t* bg, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t greyscaleMask, uint8_t* out, uint32_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i pixelBits = _mm_set1_epi8(0x03);
+    const __m128i addressBits = _mm_set1_epi8(0x1f);
+    const __m128i behindBit = _mm_set1_epi8(0x40);
+    const __m128i sprite0Bit = _mm_set1_epi8((char)0x80);
+
+    int hits = 0;
+    alignas(16) uint8_t addr[16];
+
+    for (uint32_t x = 0; x < count; x += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(bg + x));
+        __m128i s = _mm_loadu_si128((const __m128i*)(sprites + x));
+
+        __m128i bgClear = _mm_cmpeq_epi8(_mm_and_si128(b, pixelBits), zero);
+        __m128i spriteClear = _mm_cmpeq_epi8(_mm_and_si128(s, pixelBits), zero);
+        __m128i front = _mm_cmpeq_epi8(_mm_and_si128(s, behindBit), zero);
+
+        // sprite opaque && (bg transparent || sprite in front)
+        __m128i useSprite = _mm_andnot_si128(spriteClear, _mm_or_si128(bgClear, front));
+        __m128i a = _mm_or_si128(_mm_and_si128(useSprite, _mm_and_si128(s, addressBits)),
+            _mm_andnot_si128(_mm_or_si128(useSprite, bgClear), b));
+        _mm_store_si128((__m128i*)addr, a);
+
+        // sprite 0 && sprite opaque && bg opaque
+        __m128i zeroHit = _mm_andnot_si128(_mm_or_si128(spriteClear, bgClear), _mm_and_si128(s, sprite0Bit));
+        hits |= _mm_movemask_epi8(zeroHit);
+
+        for (uint32_t i = 0; i < 16; i++) {
+            out[x + i] = palette[addr[i]] & greyscaleMask;
+        }
+    }
+
+    return hits != 0;
+}
+
+// AVX2 does the palette lookup with vpshufb: background and sprite palettes are
+// 16 entries each, so a shuffle against each half of palette RAM and a blend
+// replaces the table load.
+__attribute__((target("avx2")))
+bool CompositeAVX2(const uint8_t* bg, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t greyscaleMask, uint8_t* out, uint32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i pixelBits = _mm256_set1_epi8(0x03);
+    const __m256i indexBits = _mm256_set1_epi8(0x0f);
+    const __m256i behindBit = _mm256_set1_epi8(0x40);
+    const __m256i sprite0Bit = _mm256_set1_epi8((char)0x80);
+    const __m256i grey = _mm256_set1_epi8((char)greyscaleMask);
+
+    const __m256i bgPalette = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette));
+    const __m256i spritePalette = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(palette + 16)));
+
+    __m256i hits = zero;
+
+    for (uint32_t x = 0; x < count; x += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)(bg + x));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(sprites + x));
+
+        __m256i bgClear = _mm256_cmpeq_epi8(_mm256_and_si256(b, pixelBits), zero);
+        __m256i spriteClear = _mm256_cmpeq_epi8(_mm256_and_si256(s, pixelBits), zero);
+        __m256i front = _mm256_cmpeq_epi8(_mm256_and_si256(s, behindBit), zero);
+
+        __m256i useSprite = _mm256_andnot_si256(spriteClear, _mm256_or_si256(bgClear, front));
+
+        __m256i bgColor = _mm256_shuffle_epi8(bgPalette, _mm256_andnot_si256(bgClear, b));
+        __m256i spriteColor = _mm256_shuffle_epi8(spritePalette, _mm256_and_si256(s, indexBits));
+        __m256i color = _mm256_blendv_epi8(bgColor, spriteColor, useSprite);
+
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_and_si256(color, grey));
+
+        hits = _mm256_or_si256(hits, _mm256_andnot_si256(_mm256_or_si256(spriteClear, bgClear), _mm256_and_si256(s, sprite0Bit)));
+    }
+
+    return !_mm256_testz_si256(hits, hits);
+}
+#endif
+
+}
+
+CompositeKernel BestCompositeKernel() {
+#if RAUNNES_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return CompositeKernelAVX2;
+    }
+    return CompositeKernelSSE2;
+#else
+    return CompositeKernelScalar;
+#endif
+}
+
+CompositeFunction GetCompositeFunction(CompositeKernel kernel) {
+    switch (kernel) {
+    case CompositeKernelScalar:
+        return CompositeScalar;
+#if RAUNNES_X86
+    case CompositeKernelSSE2:
+        return CompositeSSE2;
+    case CompositeKernelAVX2:
+        return __builtin_cpu_supports("avx2") ? CompositeAVX2 : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const char* CompositeKernelName(CompositeKernel kernel) {
+    switch (kernel) {
+    case CompositeKernelScalar:
+        return "scalar";
+    case CompositeKernelSSE2:
+        return "sse2";
+    case CompositeKernelAVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+bool CompositeKernelFromName(const char* name, CompositeKernel& kernel) {
+    for (int i = CompositeKernelScalar; i <= CompositeKernelAVX2; i++) {
+        if (strcmp(name, CompositeKernelName((CompositeKernel)i)) == 0) {
+            kernel = (CompositeKernel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
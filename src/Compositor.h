@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+namespace raunnes {
+
+// Final per-pixel step of the renderer: background / sprite priority,
+// transparency, palette lookup, greyscale and sprite 0 hit.
+//
+// bg       palette address 0-15.  Low two bits 0 == transparent, whatever the
+//          palette bits say, and shows the backdrop color
+// sprites  palette address 16-31 in bits 0-4, bit 6 set for behind background,
+//          bit 7 set for pixels of sprite 0.  Low two bits 0 == transparent
+// palette  the 32 bytes of palette RAM
+// out      NES color index per pixel
+//
+// count must be a multiple of 32.  Returns true if an opaque sprite 0 pixel
+// landed on an opaque background pixel.
+typedef bool (*CompositeFunction)(const uint8_t* bg, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t greyscaleMask, uint8_t* out, uint32_t count);
+
+enum CompositeKernel {
+    CompositeKernelScalar = 0,
+    CompositeKernelSSE2,
+    CompositeKernelAVX2,
+};
+
+// Widest kernel the CPU we're running on supports
+CompositeKernel BestCompositeKernel();
+
+// nullptr if the kernel isn't built for this target
+CompositeFunction GetCompositeFunction(CompositeKernel kernel);
+
+const char* CompositeKernelName(CompositeKernel kernel);
+
+// The other way round; false if name isn't one of them
+bool CompositeKernelFromName(const char* name, CompositeKernel& kernel);
+
+}
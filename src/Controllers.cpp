@@ -0,0 +1,115 @@
+#include "Controllers.h"
+
+#include "Input.h"
+
+namespace raunnes {
+
+// Only bit 0 is driven; the rest is whatever was last on the data bus, which
+// for an absolute read of $4016 / $4017 is the high byte of the address
+// https://www.nesdev.org/wiki/Open_bus_behavior
+static const uint8_t kOpenBus = 0x40;
+
+Controllers::Controllers() :
+    m_Input(nullptr),
+    m_Strobe(false),
+    m_Speculative(false),
+    m_FramePolls(0),
+    m_FrameAged(0),
+    m_FrameAgeTotal(0),
+    m_FrameAgeMax(0),
+    m_Polls(0),
+    m_PollsLastFrame(0),
+    m_AgeUs(0),
+    m_MaxAgeUs(0) {
+    m_Shift[0] = 0;
+    m_Shift[1] = 0;
+}
+
+Controllers::~Controllers() {
+}
+
+void Controllers::AttachInput(const InputSnapshot* input) {
+    m_Input = input;
+}
+
+void Controllers::Latch() {
+    uint64_t stamp = 0;
+    uint16_t buttons = m_Input != nullptr ? m_Input->GetAll(&stamp) : 0;
+    m_Shift[0] = (uint8_t)buttons;
+    m_Shift[1] = (uint8_t)(buttons >> 8);
+
+    if (stamp != 0 && !m_Speculative) {
+        uint64_t now = InputSnapshot::Now();
+        uint64_t age = now > stamp ? now - stamp : 0;
+        m_FrameAged++;
+        m_FrameAgeTotal += age;
+        m_FrameAgeMax = age > m_FrameAgeMax ? age : m_FrameAgeMax;
+    }
+}
+
+void Controllers::Write(uint8_t value) {
+    bool strobe = (value & 0x01) != 0;
+
+    // The registers reload for as long as the strobe is high, so the buttons
+    // that count are the ones held when it drops
+    if (m_Strobe && !strobe) {
+        Latch();
+        if (!m_Speculative) {
+            m_FramePolls++;
+            m_Polls.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    m_Strobe = strobe;
+}
+
+uint8_t Controllers::Read(uint32_t port) {
+    port &= 0x01;
+
+    // With the strobe high every read reloads, so it's always A
+    if (m_Strobe) {
+        Latch();
+        return kOpenBus | (m_Shift[port] & 0x01);
+    }
+
+    uint8_t bit = m_Shift[port] & 0x01;
+    m_Shift[port] = (m_Shift[port] >> 1) | 0x80;
+    return kOpenBus | bit;
+}
+
+void Controllers::EndFrame() {
+    m_PollsLastFrame.store(m_FramePolls, std::memory_order_relaxed);
+
+    // Frames where the game didn't look keep the last ages
+    if (m_FrameAged > 0) {
+        m_AgeUs.store((double)m_FrameAgeTotal / m_FrameAged, std::memory_order_relaxed);
+        m_MaxAgeUs.store((double)m_FrameAgeMax, std::memory_order_relaxed);
+    }
+
+    m_FramePolls = 0;
+    m_FrameAged = 0;
+    m_FrameAgeTotal = 0;
+    m_FrameAgeMax = 0;
+}
+
+void Controllers::SaveState(State& state) const {
+    state.Shift[0] = m_Shift[0];
+    state.Shift[1] = m_Shift[1];
+    state.Strobe = m_Strobe;
+}
+
+void Controllers::LoadState(const State& state) {
+    m_Shift[0] = state.Shift[0];
+    m_Shift[1] = state.Shift[1];
+    m_Strobe = state.Strobe;
+}
+
+Controllers::Stats Controllers::GetStats() const {
+    Stats stats;
+    stats.Polls = m_Polls.load(std::memory_order_relaxed);
+    stats.PollsLastFrame = m_PollsLastFrame.load(std::memory_order_relaxed);
+    stats.AgeUs = m_AgeUs.load(std::memory_order_relaxed);
+    stats.MaxAgeUs = m_MaxAgeUs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}
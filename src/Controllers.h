@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace raunnes {
+
+class InputSnapshot;
+
+// The two standard controller ports.  Writing 1 then 0 to bit 0 of $4016
+// loads each pad's buttons into an 8 bit shift register, and each read of
+// $4016 / $4017 shifts one button out of bit 0, A first.  Past the 8th read
+// the official pads return 1s.
+// https://www.nesdev.org/wiki/Standard_controller
+//
+// The host's buttons are read from the InputSnapshot at the moment the game
+// strobes, not once per host frame, so whatever the UI thread stored last
+// reaches the game however the two are scheduled.  How often games latch
+// and how old the input was by then are kept as metrics.
+class Controllers {
+public:
+    struct Stats {
+        uint64_t Polls;             // latches since power on
+        uint32_t PollsLastFrame;
+        double AgeUs;               // sample to latch, averaged over the last frame that latched
+        double MaxAgeUs;            // worst in that frame
+    };
+
+    // The shift registers and strobe, for snapshots.  The metrics aren't
+    // part of it.
+    struct State {
+        uint8_t Shift[2];
+        bool Strobe;
+    };
+
+public:
+    Controllers();
+    ~Controllers();
+
+    // Buttons come from here, none are held without one
+    void AttachInput(const InputSnapshot* input);
+    const InputSnapshot* Input() const { return m_Input; }
+
+    // $4016 writes, only the strobe bit is wired
+    void Write(uint8_t value);
+
+    // port 0 for $4016, 1 for $4017
+    uint8_t Read(uint32_t port);
+
+    // Called at the end of every frame to publish its metrics
+    void EndFrame();
+
+    // While set, latches aren't counted: the frames are run ahead and thrown
+    // away (see RunAhead), the game will latch again for real
+    void SetSpeculative(bool speculative) { m_Speculative = speculative; }
+
+    // Any thread
+    Stats GetStats() const;
+
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+public:
+    Controllers(const Controllers&) = delete;
+    Controllers& operator=(const Controllers&) = delete;
+
+private:
+    void Latch();
+
+private:
+    const InputSnapshot* m_Input;
+    uint8_t m_Shift[2];
+    bool m_Strobe;
+    bool m_Speculative;
+
+    // This frame, emulation thread only
+    uint32_t m_FramePolls;
+    uint32_t m_FrameAged;
+    uint64_t m_FrameAgeTotal;
+    uint64_t m_FrameAgeMax;
+
+    std::atomic<uint64_t> m_Polls;
+    std::atomic<uint32_t> m_PollsLastFrame;
+    std::atomic<double> m_AgeUs;
+    std::atomic<double> m_MaxAgeUs;
+};
+
+}
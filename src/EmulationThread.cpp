@@ -0,0 +1,119 @@
+#include "EmulationThread.h"
+
+#include "AudioOutput.h"
+#include "RunAhead.h"
+#include "SaveRam.h"
+#include "Trace.h"
+
+namespace raunnes {
+
+// NTSC runs 60.0988 frames a second
+// https://www.nesdev.org/wiki/Cycle_reference_chart
+static const std::chrono::nanoseconds kFramePeriod(16639267);
+
+EmulationThread::EmulationThread(NESDriver& driver, TripleBuffer<PPU::Frame>& frames, SaveRam* saveRam) :
+    m_Driver(driver),
+    m_Frames(frames),
+    m_SaveRam(saveRam),
+    m_Audio(nullptr),
+    m_RunAhead(nullptr),
+    m_Running(false),
+    m_Uncapped(false),
+    m_Paused(false),
+    m_RenderInterval(1),
+    m_FramesRun(0),
+    m_FrameCallBack(nullptr),
+    m_FrameCallBackContext(nullptr) {
+}
+
+EmulationThread::~EmulationThread() {
+    Stop();
+}
+
+void EmulationThread::Start() {
+    if (m_Thread.joinable()) {
+        return;
+    }
+
+    if (m_RunAhead != nullptr) {
+        m_RunAhead->AttachFrameExchange(&m_Frames);
+    } else {
+        m_Driver.AttachFrameExchange(&m_Frames);
+    }
+    m_Driver.Pads().AttachInput(&m_Input);
+    m_Running.store(true);
+    m_Thread = std::thread(&EmulationThread::Run, this);
+}
+
+void EmulationThread::Stop() {
+    m_Running.store(false);
+    if (m_Thread.joinable()) {
+        m_Thread.join();
+    }
+    m_Driver.Pads().AttachInput(nullptr);
+}
+
+void EmulationThread::InstallFrameCallBack(FrameCallBack cb, void* context) {
+    m_FrameCallBack = cb;
+    m_FrameCallBackContext = context;
+}
+
+void EmulationThread::Run() {
+    Trace::SetThreadName("Emulation");
+    auto deadline = std::chrono::steady_clock::now();
+
+    while (m_Running.load(std::memory_order_relaxed)) {
+        if (m_Paused.load(std::memory_order_relaxed)) {
+            if (m_FrameCallBack != nullptr) {
+                m_FrameCallBack(m_Driver, m_FrameCallBackContext);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            deadline = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        {
+            TraceSpan span("Frame");
+            uint64_t frame = m_FramesRun.load(std::memory_order_relaxed);
+            span.SetCount((uint32_t)frame);
+
+            bool render = frame % m_RenderInterval.load(std::memory_order_relaxed) == 0;
+            if (m_RunAhead != nullptr) {
+                m_RunAhead->RunFrame(render);
+            } else {
+                m_Driver.RunFrame(render);
+            }
+            m_FramesRun.fetch_add(1, std::memory_order_relaxed);
+
+            if (m_Audio != nullptr) {
+                m_Audio->Push(m_Driver.Apu());
+            }
+
+            if (m_FrameCallBack != nullptr) {
+                m_FrameCallBack(m_Driver, m_FrameCallBackContext);
+            }
+
+            // PRG-RAM is written from this thread, so it's flushed from here too
+            if (m_SaveRam != nullptr) {
+                m_SaveRam->FlushIfDue();
+            }
+        }
+
+        if (m_Uncapped.load(std::memory_order_relaxed)) {
+            deadline = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        deadline += kFramePeriod;
+        auto now = std::chrono::steady_clock::now();
+        if (deadline > now) {
+            std::this_thread::sleep_until(deadline);
+        }
+        else if (now - deadline > kFramePeriod * 4) {
+            // Too far behind to catch up, e.g. after the debugger stopped us
+            deadline = now;
+        }
+    }
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "Input.h"
+#include "NESDriver.h"
+#include "TripleBuffer.h"
+
+namespace raunnes {
+
+class AudioOutput;
+class RunAhead;
+class SaveRam;
+
+// Runs a NESDriver a whole frame at a time on its own thread, publishing each
+// finished frame to a triple buffer.  The UI thread only polls events and
+// presents what's there, so neither side waits on the other.
+//
+// Paced to the NTSC frame rate unless uncapped.  Everything the UI changes
+// (input, pacing, pause) goes through atomics.
+class EmulationThread {
+public:
+    // Called on the emulation thread after every frame, while the emulated
+    // machine is stopped at vblank, and every 10ms while paused
+    typedef void(*FrameCallBack)(NESDriver& driver, void* context);
+
+public:
+    EmulationThread(NESDriver& driver, TripleBuffer<PPU::Frame>& frames, SaveRam* saveRam);
+    ~EmulationThread();
+
+    void Start();
+    void Stop();
+
+    void SetUncapped(bool uncapped) { m_Uncapped.store(uncapped, std::memory_order_relaxed); }
+    bool Uncapped() const { return m_Uncapped.load(std::memory_order_relaxed); }
+
+    // Only every Nth frame is drawn and published, the rest skip pixel output
+    void SetRenderInterval(uint32_t interval) { m_RenderInterval.store(interval ? interval : 1, std::memory_order_relaxed); }
+
+    void SetPaused(bool paused) { m_Paused.store(paused, std::memory_order_relaxed); }
+    bool Paused() const { return m_Paused.load(std::memory_order_relaxed); }
+
+    // The controllers read this when the game latches them
+    InputSnapshot& Input() { return m_Input; }
+
+    // Set before Start()
+    void InstallFrameCallBack(FrameCallBack cb, void* context);
+
+    // Each frame's audio is pushed here, set before Start()
+    void AttachAudio(AudioOutput* audio) { m_Audio = audio; }
+
+    // Frames are run through this, driving the same NESDriver, set before
+    // Start()
+    void AttachRunAhead(RunAhead* runAhead) { m_RunAhead = runAhead; }
+
+    uint64_t FramesRun() const { return m_FramesRun.load(std::memory_order_relaxed); }
+
+public:
+    EmulationThread(const EmulationThread&) = delete;
+    EmulationThread& operator=(const EmulationThread&) = delete;
+
+private:
+    void Run();
+
+private:
+    NESDriver& m_Driver;
+    TripleBuffer<PPU::Frame>& m_Frames;
+    SaveRam* m_SaveRam;
+    AudioOutput* m_Audio;
+    RunAhead* m_RunAhead;
+
+    std::thread m_Thread;
+    std::atomic<bool> m_Running;
+    std::atomic<bool> m_Uncapped;
+    std::atomic<bool> m_Paused;
+    std::atomic<uint32_t> m_RenderInterval;
+    std::atomic<uint64_t> m_FramesRun;
+
+    InputSnapshot m_Input;
+
+    FrameCallBack m_FrameCallBack;
+    void* m_FrameCallBackContext;
+};
+
+}
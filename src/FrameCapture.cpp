@@ -0,0 +1,427 @@
+#include "FrameCapture.h"
+
+#include "Palette.h"
+#include "RomHash.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#ifdef RAUNNES_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace raunnes {
+
+static const uint32_t kPixelCount = PPU::kScreenWidth * PPU::kScreenHeight;
+
+// PNG rows are a filter type byte followed by the pixels
+static const uint32_t kPNGRowSize = 1 + PPU::kScreenWidth * 3;
+static const uint32_t kPNGRawSize = kPNGRowSize * PPU::kScreenHeight;
+
+static const uint8_t kPNGSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void PutBE32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+// Chunk is length, type, data, CRC of type + data.  data has to already be in
+// place 8 bytes after chunk.
+// https://www.w3.org/TR/png/#5Chunk-layout
+static size_t FinishChunk(uint8_t* chunk, const char* type, uint32_t size) {
+    PutBE32(chunk, size);
+    memcpy(chunk + 4, type, 4);
+    PutBE32(chunk + 8 + size, Crc32(chunk + 4, 4 + size));
+    return 12 + size;
+}
+
+#ifndef RAUNNES_HAVE_ZLIB
+static uint32_t Adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        // Largest run that can't overflow before the modulo
+        size_t run = std::min<size_t>(size, 5552);
+        size -= run;
+        while (run--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+#endif
+
+// Worst case size of the zlib stream for one frame
+static size_t DeflateBound() {
+#ifdef RAUNNES_HAVE_ZLIB
+    return compressBound(kPNGRawSize);
+#else
+    return 2 + (kPNGRawSize / 65535 + 1) * 5 + kPNGRawSize + 4;
+#endif
+}
+
+// zlib stream of data into out, which has DeflateBound() bytes.  Without zlib
+// the data goes in stored (uncompressed) deflate blocks, which is still a
+// valid PNG, just a big one.
+// https://www.rfc-editor.org/rfc/rfc1951#section-3.2.4
+static bool Deflate(const uint8_t* data, size_t size, uint8_t* out, size_t& outSize) {
+#ifdef RAUNNES_HAVE_ZLIB
+    uLongf length = (uLongf)DeflateBound();
+    if (compress2(out, &length, data, (uLong)size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return false;
+    }
+    outSize = length;
+    return true;
+#else
+    uint8_t* p = out;
+    *p++ = 0x78;
+    *p++ = 0x01;
+
+    uint32_t adler = Adler32(data, size);
+    do {
+        uint32_t block = (uint32_t)std::min<size_t>(size, 65535);
+        size -= block;
+        *p++ = size == 0 ? 1 : 0;
+        *p++ = (uint8_t)block;
+        *p++ = (uint8_t)(block >> 8);
+        *p++ = (uint8_t)~block;
+        *p++ = (uint8_t)(~block >> 8);
+        memcpy(p, data, block);
+        p += block;
+        data += block;
+    } while (size > 0);
+
+    PutBE32(p, adler);
+    outSize = (p + 4) - out;
+    return true;
+#endif
+}
+
+FrameCapture::FrameCapture() :
+    m_Options(),
+    m_Stream(nullptr),
+    m_PendingHead(0),
+    m_PendingCount(0),
+    m_Stopping(false),
+    m_Submitted(0),
+    m_Written(0),
+    m_Dropped(0),
+    m_Failed(0),
+    m_Queued(0),
+    m_PeakQueued(0) {
+}
+
+FrameCapture::~FrameCapture() {
+    Close();
+}
+
+bool FrameCapture::FormatFromPath(const std::string& path, Format& format) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if (extension == "y4m") {
+        format = FormatY4M;
+    } else if (extension == "rgb" || extension == "raw") {
+        format = FormatRawRGB;
+    } else if (extension == "png") {
+        format = FormatPNG;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* FrameCapture::FormatName(Format format) {
+    switch (format) {
+    case FormatY4M:
+        return "y4m";
+    case FormatRawRGB:
+        return "rgb";
+    case FormatPNG:
+        return "png";
+    }
+    return "unknown";
+}
+
+bool FrameCapture::Open(const Options& options, const Palette& palette) {
+    Close();
+
+    m_Options = options;
+    m_Options.QueueDepth = std::max<uint32_t>(options.QueueDepth, 1);
+    m_Options.FrameStep = std::max<uint32_t>(options.FrameStep, 1);
+
+    // BT.601 limited range, the integer form
+    // https://en.wikipedia.org/wiki/YCbCr#ITU-R_BT.601_conversion
+    for (uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+        const uint32_t* colors = palette.Colors((uint8_t)emphasis);
+        for (uint32_t i = 0; i < 64; i++) {
+            const uint8_t* rgba = (const uint8_t*)&colors[i];
+            int r = rgba[0];
+            int g = rgba[1];
+            int b = rgba[2];
+
+            m_RGB[emphasis][i][0] = (uint8_t)r;
+            m_RGB[emphasis][i][1] = (uint8_t)g;
+            m_RGB[emphasis][i][2] = (uint8_t)b;
+
+            m_YUV[emphasis][i][0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            m_YUV[emphasis][i][1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            m_YUV[emphasis][i][2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    uint32_t workers = 1;
+
+    if (m_Options.CaptureFormat == FormatPNG) {
+        workers = m_Options.Workers;
+        if (workers == 0) {
+            // The emulation thread keeps one
+            uint32_t threads = std::thread::hardware_concurrency();
+            workers = threads > 1 ? threads - 1 : 1;
+        }
+    } else {
+        m_Stream = fopen(m_Options.Path.c_str(), "wb");
+        if (m_Stream == nullptr) {
+            return false;
+        }
+
+        if (m_Options.CaptureFormat == FormatY4M) {
+            // NTSC is 39375000 / 655171 = 60.0988 frames a second
+            // https://wiki.multimedia.cx/index.php/YUV4MPEG2
+            fprintf(m_Stream, "YUV4MPEG2 W%u H%u F39375000:%u Ip A1:1 C444\n",
+                PPU::kScreenWidth, PPU::kScreenHeight, 655171 * m_Options.FrameStep);
+        }
+    }
+
+    m_Slots.resize(m_Options.QueueDepth);
+    m_Pending.resize(m_Options.QueueDepth);
+    m_Free.clear();
+    for (uint32_t i = 0; i < m_Options.QueueDepth; i++) {
+        m_Free.push_back(m_Options.QueueDepth - 1 - i);
+    }
+    m_PendingHead = 0;
+    m_PendingCount = 0;
+    m_Stopping = false;
+
+    m_Submitted.store(0);
+    m_Written.store(0);
+    m_Dropped.store(0);
+    m_Failed.store(0);
+    m_Queued.store(0);
+    m_PeakQueued.store(0);
+
+    for (uint32_t i = 0; i < workers; i++) {
+        m_Workers.emplace_back(&FrameCapture::Work, this);
+    }
+    return true;
+}
+
+void FrameCapture::Close() {
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stopping = true;
+    }
+    m_WorkReady.notify_all();
+
+    for (std::thread& worker : m_Workers) {
+        worker.join();
+    }
+    m_Workers.clear();
+
+    if (m_Stream != nullptr) {
+        fclose(m_Stream);
+        m_Stream = nullptr;
+    }
+}
+
+bool FrameCapture::Submit(const PPU::Frame& frame) {
+    m_Submitted.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (m_Free.empty() || m_Stopping) {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slot = m_Free.back();
+        m_Free.pop_back();
+    }
+
+    // The slot is ours until it's queued, so the copy happens outside the lock
+    memcpy(&m_Slots[slot], &frame, sizeof(PPU::Frame));
+
+    uint32_t queued = m_Queued.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (queued > m_PeakQueued.load(std::memory_order_relaxed)) {
+        m_PeakQueued.store(queued, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Pending[(m_PendingHead + m_PendingCount) % m_Pending.size()] = slot;
+        m_PendingCount++;
+    }
+    m_WorkReady.notify_one();
+    return true;
+}
+
+FrameCapture::Stats FrameCapture::GetStats() const {
+    Stats stats;
+    stats.Submitted = m_Submitted.load(std::memory_order_relaxed);
+    stats.Written = m_Written.load(std::memory_order_relaxed);
+    stats.Dropped = m_Dropped.load(std::memory_order_relaxed);
+    stats.Failed = m_Failed.load(std::memory_order_relaxed);
+    stats.Queued = m_Queued.load(std::memory_order_relaxed);
+    stats.PeakQueued = m_PeakQueued.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FrameCapture::Work() {
+    // Scratch for one frame, allocated once per worker
+    std::vector<uint8_t> pixels(std::max(kPNGRawSize, kPixelCount * 3));
+    std::vector<uint8_t> encoded;
+    if (m_Options.CaptureFormat == FormatPNG) {
+        encoded.resize(sizeof(kPNGSignature) + 25 + 12 + DeflateBound() + 12);
+    }
+
+    for (;;) {
+        uint32_t slot;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_WorkReady.wait(lock, [this] { return m_PendingCount > 0 || m_Stopping; });
+            if (m_PendingCount == 0) {
+                return;
+            }
+            slot = m_Pending[m_PendingHead];
+            m_PendingHead = (m_PendingHead + 1) % m_Pending.size();
+            m_PendingCount--;
+        }
+
+        if (Write(m_Slots[slot], pixels, encoded)) {
+            m_Written.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_Failed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Free.push_back(slot);
+        }
+        m_Queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+bool FrameCapture::Write(const PPU::Frame& frame, std::vector<uint8_t>& pixels, std::vector<uint8_t>& encoded) {
+    switch (m_Options.CaptureFormat) {
+    case FormatY4M:
+        ToYUV(frame, pixels.data());
+        return fwrite("FRAME\n", 1, 6, m_Stream) == 6 &&
+            fwrite(pixels.data(), 1, kPixelCount * 3, m_Stream) == kPixelCount * 3;
+
+    case FormatRawRGB:
+        ToRGB(frame, pixels.data());
+        return fwrite(pixels.data(), 1, kPixelCount * 3, m_Stream) == kPixelCount * 3;
+
+    case FormatPNG:
+        return WritePNG(frame, pixels, encoded);
+    }
+    return false;
+}
+
+void FrameCapture::ToRGB(const PPU::Frame& frame, uint8_t* out) const {
+    const uint8_t* index = frame.Pixels;
+    for (uint32_t y = 0; y < PPU::kScreenHeight; y++) {
+        const uint8_t (*colors)[3] = m_RGB[frame.LineEmphasis[y] & 0x07];
+        for (uint32_t x = 0; x < PPU::kScreenWidth; x++) {
+            memcpy(out, colors[*index++ & 0x3f], 3);
+            out += 3;
+        }
+    }
+}
+
+// Planar, a whole Y plane then Cb then Cr
+void FrameCapture::ToYUV(const PPU::Frame& frame, uint8_t* out) const {
+    uint8_t* planeY = out;
+    uint8_t* planeU = out + kPixelCount;
+    uint8_t* planeV = out + kPixelCount * 2;
+
+    const uint8_t* index = frame.Pixels;
+    for (uint32_t y = 0; y < PPU::kScreenHeight; y++) {
+        const uint8_t (*colors)[3] = m_YUV[frame.LineEmphasis[y] & 0x07];
+        for (uint32_t x = 0; x < PPU::kScreenWidth; x++) {
+            const uint8_t* yuv = colors[*index++ & 0x3f];
+            *planeY++ = yuv[0];
+            *planeU++ = yuv[1];
+            *planeV++ = yuv[2];
+        }
+    }
+}
+
+// 8 bit RGB, no filtering: the flat NES picture deflates well enough as is
+// https://www.w3.org/TR/png/
+bool FrameCapture::WritePNG(const PPU::Frame& frame, std::vector<uint8_t>& pixels, std::vector<uint8_t>& encoded) {
+    uint8_t* raw = pixels.data();
+    for (uint32_t y = 0; y < PPU::kScreenHeight; y++) {
+        raw[y * kPNGRowSize] = 0;
+    }
+
+    // Convert straight into the rows, past each filter byte
+    const uint8_t* index = frame.Pixels;
+    for (uint32_t y = 0; y < PPU::kScreenHeight; y++) {
+        const uint8_t (*colors)[3] = m_RGB[frame.LineEmphasis[y] & 0x07];
+        uint8_t* out = raw + y * kPNGRowSize + 1;
+        for (uint32_t x = 0; x < PPU::kScreenWidth; x++) {
+            memcpy(out, colors[*index++ & 0x3f], 3);
+            out += 3;
+        }
+    }
+
+    uint8_t* p = encoded.data();
+    memcpy(p, kPNGSignature, sizeof(kPNGSignature));
+    p += sizeof(kPNGSignature);
+
+    uint8_t* header = p + 8;
+    PutBE32(header, PPU::kScreenWidth);
+    PutBE32(header + 4, PPU::kScreenHeight);
+    header[8] = 8;      // bit depth
+    header[9] = 2;      // truecolor
+    header[10] = 0;     // deflate
+    header[11] = 0;     // adaptive filtering
+    header[12] = 0;     // not interlaced
+    p += FinishChunk(p, "IHDR", 13);
+
+    size_t compressed;
+    if (!Deflate(raw, kPNGRawSize, p + 8, compressed)) {
+        return false;
+    }
+    p += FinishChunk(p, "IDAT", (uint32_t)compressed);
+    p += FinishChunk(p, "IEND", 0);
+
+    std::string path = m_Options.Path;
+    size_t dot = path.find_last_of('.');
+    char number[32];
+    snprintf(number, sizeof(number), "_%06llu", (unsigned long long)frame.Number);
+    path.insert(dot == std::string::npos ? path.size() : dot, number);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    size_t size = p - encoded.data();
+    bool written = fwrite(encoded.data(), 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PPU.h"
+
+namespace raunnes {
+
+class Palette;
+
+// Writes finished frames to disk without holding up emulation.
+//
+// Submit() copies the frame into one of a fixed number of slots and returns;
+// worker threads convert and write them.  When every slot is still waiting
+// the frame is dropped and counted rather than waited on, so memory stays at
+// QueueDepth frames however far behind the disk or encoder falls.
+//
+// Y4M and raw RGB are single streams written in order by one worker.  PNG
+// sequences write one file per frame and compress on all the workers.
+class FrameCapture {
+public:
+    enum Format {
+        FormatY4M = 0,      // 4:4:4 BT.601, plays / converts with ffmpeg as is
+        FormatRawRGB,       // 256x240 rgb24 back to back, no header
+        FormatPNG,          // name.png -> name_<frame number>.png
+    };
+
+    struct Options {
+        Format CaptureFormat;
+        std::string Path;
+        uint32_t Workers;       // PNG only, 0 == one per spare hardware thread
+        uint32_t QueueDepth;    // frames in flight before dropping
+        uint32_t FrameStep;     // emulated frames per captured one, for the Y4M frame rate
+    };
+
+    struct Stats {
+        uint64_t Submitted;
+        uint64_t Written;
+        uint64_t Dropped;       // no free slot when submitted
+        uint64_t Failed;        // couldn't be written
+        uint32_t Queued;        // waiting or being written right now
+        uint32_t PeakQueued;
+    };
+
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+    // Format from path's extension: .y4m, .rgb / .raw or .png
+    static bool FormatFromPath(const std::string& path, Format& format);
+    static const char* FormatName(Format format);
+
+    // Colors are copied, palette needn't outlive the capture
+    bool Open(const Options& options, const Palette& palette);
+
+    // Writes everything still queued, then stops the workers
+    void Close();
+
+    bool IsOpen() const { return !m_Workers.empty(); }
+
+    // Never blocks on the workers.  False if the frame was dropped.
+    bool Submit(const PPU::Frame& frame);
+
+    Stats GetStats() const;
+
+public:
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+private:
+    void Work();
+    bool Write(const PPU::Frame& frame, std::vector<uint8_t>& pixels, std::vector<uint8_t>& encoded);
+    void ToRGB(const PPU::Frame& frame, uint8_t* out) const;
+    void ToYUV(const PPU::Frame& frame, uint8_t* out) const;
+    bool WritePNG(const PPU::Frame& frame, std::vector<uint8_t>& pixels, std::vector<uint8_t>& encoded);
+
+private:
+    Options m_Options;
+    uint8_t m_RGB[8][64][3];
+    uint8_t m_YUV[8][64][3];
+    FILE* m_Stream;
+
+    // Slots are handed out from m_Free and come back once written.  m_Pending
+    // is a ring of slot indices in submission order.
+    std::vector<PPU::Frame> m_Slots;
+    std::vector<uint32_t> m_Free;
+    std::vector<uint32_t> m_Pending;
+    uint32_t m_PendingHead;
+    uint32_t m_PendingCount;
+    bool m_Stopping;
+
+    mutable std::mutex m_Lock;
+    std::condition_variable m_WorkReady;
+    std::vector<std::thread> m_Workers;
+
+    std::atomic<uint64_t> m_Submitted;
+    std::atomic<uint64_t> m_Written;
+    std::atomic<uint64_t> m_Dropped;
+    std::atomic<uint64_t> m_Failed;
+    std::atomic<uint32_t> m_Queued;
+    std::atomic<uint32_t> m_PeakQueued;
+};
+
+}
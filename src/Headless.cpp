@@ -0,0 +1,260 @@
+#include "Headless.h"
+
+#include "Cartridge.h"
+#include "Compositor.h"
+#include "FrameCapture.h"
+#include "Input.h"
+#include "Movie.h"
+#include "NESDriver.h"
+#include "Palette.h"
+#include "RomDatabase.h"
+#include "RomHash.h"
+#include "RunAhead.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace raunnes {
+
+int RunHeadless(const Cartridge& cartridge, const HeadlessOptions& options) {
+    NESDriver driver(cartridge);
+    if (options.Accuracy >= 0) {
+        driver.Ppu().SetAccuracy((Cartridge::PPUAccuracy)options.Accuracy);
+    }
+    driver.SetIdleSkip(options.IdleSkip);
+    if (options.Recompile && !driver.SetRecompile(true)) {
+        fprintf(stderr, "No recompiler on this host, interpreting\n");
+    }
+    if (options.Composite >= 0 && !driver.Ppu().SetCompositeKernel((CompositeKernel)options.Composite)) {
+        fprintf(stderr, "No %s compositor on this host, using %s\n",
+            CompositeKernelName((CompositeKernel)options.Composite), CompositeKernelName(driver.Ppu().GetCompositeKernel()));
+    }
+
+    Movie movie;
+    InputSnapshot input;
+    if (options.MoviePath != nullptr) {
+        if (!movie.Load(options.MoviePath)) {
+            fprintf(stderr, "Unable to load movie %s\n", options.MoviePath);
+            return 1;
+        }
+        driver.Pads().AttachInput(&input);
+    }
+
+    // With no frames ahead it's a plain RunFrame() plus timing
+    RunAhead runAhead(driver, options.RunAheadThread ? &cartridge : nullptr);
+    runAhead.SetFrames(options.RunAhead);
+
+    FrameCapture capture;
+    if (options.CapturePath != nullptr) {
+        FrameCapture::Options captureOptions;
+        if (!FrameCapture::FormatFromPath(options.CapturePath, captureOptions.CaptureFormat)) {
+            fprintf(stderr, "Don't know how to capture to %s, use .y4m, .rgb or .png\n", options.CapturePath);
+            return 1;
+        }
+        captureOptions.Path = options.CapturePath;
+        captureOptions.Workers = options.CaptureWorkers;
+        captureOptions.QueueDepth = 32;
+        captureOptions.FrameStep = options.RenderEvery > 1 ? options.RenderEvery : 1;
+
+        Palette palette;
+        if (options.PalettePath != nullptr && !palette.Load(options.PalettePath)) {
+            fprintf(stderr, "Unable to load palette %s\n", options.PalettePath);
+            return 1;
+        }
+
+        if (!capture.Open(captureOptions, palette)) {
+            fprintf(stderr, "Unable to open %s\n", options.CapturePath);
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t rendered = 0;
+
+    // Audio is drained every frame and folded into a CRC, like the picture
+    int16_t samples[4096];
+    uint32_t audioCrc = 0;
+    uint64_t audioSamples = 0;
+
+    // Per frame counters, summed to report averages
+    uint64_t perfTotals[PerfCounters::CounterCount] = {};
+
+    for (uint32_t i = 0; i < options.Frames; i++) {
+        bool render = options.RenderEvery <= 1 || (i % options.RenderEvery) == 0 || i + 1 == options.Frames;
+        input.SetAll(movie.ButtonsAt(i));
+        runAhead.RunFrame(render);
+        rendered += render ? 1 : 0;
+
+        PerfCounters::Snapshot perf = driver.Perf().Read();
+        for (uint32_t counter = PerfCounters::CounterInstructions; counter < PerfCounters::CounterPresentNs; counter++) {
+            perfTotals[counter] += perf.Values[counter];
+        }
+
+        while (uint32_t count = driver.Apu().ReadSamples(samples, 4096)) {
+            audioCrc = Crc32((const uint8_t*)samples, count * sizeof(int16_t), audioCrc);
+            audioSamples += count;
+        }
+
+        if (render && capture.IsOpen()) {
+            capture.Submit(runAhead.Picture());
+        }
+    }
+
+    // Timed before the capture drains, it's the emulation speed being reported
+    const PPU::Frame& picture = runAhead.Picture();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::string captureJson;
+    if (capture.IsOpen()) {
+        capture.Close();
+        FrameCapture::Stats stats = capture.GetStats();
+
+        char buffer[160];
+        snprintf(buffer, sizeof(buffer), ",\"capture\":{\"written\":%llu,\"dropped\":%llu,\"failed\":%llu,\"peak_queued\":%u}",
+            (unsigned long long)stats.Written,
+            (unsigned long long)stats.Dropped,
+            (unsigned long long)stats.Failed,
+            stats.PeakQueued);
+        captureJson = buffer;
+    }
+
+    char perfJson[256];
+    double frames = options.Frames ? options.Frames : 1;
+    snprintf(perfJson, sizeof(perfJson), ",\"perf\":{\"instructions\":%.0f,\"translated\":%.0f,\"ppu_catchups\":%.1f,\"idle_cycles\":%.0f,\"frame_us\":%.1f,\"cpu_us\":%.1f,\"ppu_us\":%.1f,\"apu_us\":%.1f}",
+        perfTotals[PerfCounters::CounterInstructions] / frames,
+        perfTotals[PerfCounters::CounterTranslated] / frames,
+        perfTotals[PerfCounters::CounterPPUCatchUps] / frames,
+        perfTotals[PerfCounters::CounterIdleCycles] / frames,
+        perfTotals[PerfCounters::CounterFrameNs] / frames / 1000,
+        perfTotals[PerfCounters::CounterCPUNs] / frames / 1000,
+        perfTotals[PerfCounters::CounterPPUNs] / frames / 1000,
+        perfTotals[PerfCounters::CounterAPUNs] / frames / 1000);
+
+    std::string runAheadJson;
+    if (options.RunAhead > 0) {
+        RunAhead::Stats stats = runAhead.GetStats();
+
+        // A frame of lag saved is a frame period, at the NTSC rate
+        char buffer[192];
+        snprintf(buffer, sizeof(buffer), ",\"run_ahead\":{\"frames\":%u,\"second_instance\":%s,\"real_us\":%.1f,\"added_us\":%.1f,\"second_instance_us\":%.1f,\"lag_saved_ms\":%.1f}",
+            stats.Frames,
+            stats.SecondInstance ? "true" : "false",
+            stats.RealUs,
+            stats.AddedUs,
+            stats.SecondInstanceUs,
+            stats.Frames * 1000.0 / 60.0988);
+        runAheadJson = buffer;
+    }
+
+    uint32_t frameCrc = Crc32(picture.Pixels, PPU::kScreenWidth * PPU::kScreenHeight);
+
+    printf("{\"rom\":\"%s\",\"crc32\":\"%s\",\"ppu\":\"%s\",\"composite\":\"%s\",\"frames\":%u,\"rendered\":%u,\"seconds\":%.6f,\"fps\":%.1f,\"frame_crc32\":\"%08x\",\"audio_samples\":%llu,\"audio_crc32\":\"%08x\",\"input_polls\":%llu%s%s%s}\n",
+        cartridge.Path().c_str(),
+        cartridge.Fingerprint().Crc32String().c_str(),
+        driver.Ppu().Accuracy() == Cartridge::PPUAccuracyDot ? "dot" : "scanline",
+        CompositeKernelName(driver.Ppu().GetCompositeKernel()),
+        options.Frames,
+        rendered,
+        seconds,
+        seconds > 0 ? options.Frames / seconds : 0.0,
+        frameCrc,
+        (unsigned long long)audioSamples,
+        audioCrc,
+        (unsigned long long)driver.Pads().GetStats().Polls,
+        perfJson,
+        runAheadJson.c_str(),
+        captureJson.c_str());
+
+    return 0;
+}
+
+int HeadlessMain(int argc, char** argv) {
+    const char* romPath = "../tests/nestest/nestest.nes";
+    const char* tracePath = nullptr;
+    std::string romDatabasePath = RomDatabase::DefaultPath();
+    HeadlessOptions options = { 600, -1, 1, nullptr, nullptr, 0, 0, false, nullptr, true, false, -1 };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.Frames = (uint32_t)atoi(argv[++i]);
+            }
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.Frames = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--render-every" && i + 1 < argc) {
+            options.RenderEvery = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--palette" && i + 1 < argc) {
+            options.PalettePath = argv[++i];
+        } else if (arg == "--capture" && i + 1 < argc) {
+            options.CapturePath = argv[++i];
+        } else if (arg == "--capture-workers" && i + 1 < argc) {
+            options.CaptureWorkers = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--run-ahead" && i + 1 < argc) {
+            options.RunAhead = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--run-ahead-thread") {
+            options.RunAheadThread = true;
+        } else if (arg == "--movie" && i + 1 < argc) {
+            options.MoviePath = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--no-idle-skip") {
+            options.IdleSkip = false;
+        } else if (arg == "--jit") {
+            options.Recompile = true;
+        } else if (arg == "--composite" && i + 1 < argc) {
+            CompositeKernel kernel;
+            if (!CompositeKernelFromName(argv[++i], kernel)) {
+                fprintf(stderr, "Unknown compositor %s\n", argv[i]);
+                return 1;
+            }
+            options.Composite = kernel;
+        } else if (arg == "--romdb" && i + 1 < argc) {
+            romDatabasePath = argv[++i];
+        } else if (arg == "--ppu" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "dot") {
+                options.Accuracy = Cartridge::PPUAccuracyDot;
+            } else if (mode == "scanline") {
+                options.Accuracy = Cartridge::PPUAccuracyScanline;
+            } else {
+                fprintf(stderr, "Unknown PPU mode %s\n", mode.c_str());
+                return 1;
+            }
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return 1;
+        } else {
+            romPath = argv[i];
+        }
+    }
+
+    RomDatabase romDatabase;
+    if (!romDatabase.Load(romDatabasePath)) {
+        fprintf(stderr, "Unable to load ROM database %s, headers are taken as is\n", romDatabasePath.c_str());
+    }
+
+    Cartridge cartridge;
+    if (!cartridge.Load(romPath, &romDatabase)) {
+        fprintf(stderr, "Unable to load %s: %s\n", romPath, cartridge.Error().c_str());
+        return 1;
+    }
+
+    Trace::SetThreadName("Main");
+    Trace::SetEnabled(tracePath != nullptr);
+
+    int result = RunHeadless(cartridge, options);
+
+    // stdout is the JSON summary, so the trace only speaks up on failure
+    if (tracePath != nullptr && !Trace::Write(tracePath)) {
+        fprintf(stderr, "Unable to write %s\n", tracePath);
+        return 1;
+    }
+    return result;
+}
+
+}
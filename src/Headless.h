@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace raunnes {
+
+class Cartridge;
+
+struct HeadlessOptions {
+    uint32_t Frames;
+    int Accuracy;       // -1 == as the cartridge asks, otherwise Cartridge::PPUAccuracy
+    uint32_t RenderEvery;   // draw pixels every Nth frame only (and always the last), 0 / 1 == all
+    const char* PalettePath;    // nullptr == built in
+    const char* CapturePath;    // .y4m, .rgb or .png sequence of every drawn frame, nullptr == none
+    uint32_t CaptureWorkers;    // PNG encoders, 0 == one per spare core
+    uint32_t RunAhead;          // frames, 0 == off
+    bool RunAheadThread;        // run them on a second instance
+    const char* MoviePath;      // scripted controller input, nullptr == none
+    bool IdleSkip;              // see NESDriver::SetIdleSkip(), normally on
+    bool Recompile;             // see NESDriver::SetRecompile(), normally off
+    int Composite;              // -1 == the widest the host supports, otherwise CompositeKernel
+};
+
+// Runs a cartridge without any window, as fast as it will go, and prints a
+// one line JSON summary to stdout.  The CRC of the last frame makes runs easy
+// to compare.  Captured frames are written in the background; any the
+// writers couldn't keep up with are dropped and counted in the summary.
+int RunHeadless(const Cartridge& cartridge, const HeadlessOptions& options);
+
+// Command line front end for RunHeadless(), shared by raunnes --headless and
+// raunnes_headless:
+//
+//   [--headless [frames]] [--frames n] [--ppu scanline|dot] [--palette file]
+//   [--render-every n] [--capture file] [--capture-workers n] [--run-ahead n]
+//   [--run-ahead-thread] [--movie file] [--trace file] [--no-idle-skip] [--jit]
+//   [--composite scalar|sse2|avx2] [--romdb file] [rom]
+int HeadlessMain(int argc, char** argv);
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace raunnes {
+
+// Standard controller buttons, in the order the shift register reports them
+// https://www.nesdev.org/wiki/Standard_controller
+enum Button {
+    ButtonA = 0x01,
+    ButtonB = 0x02,
+    ButtonSelect = 0x04,
+    ButtonStart = 0x08,
+    ButtonUp = 0x10,
+    ButtonDown = 0x20,
+    ButtonLeft = 0x40,
+    ButtonRight = 0x80,
+};
+
+// Buttons held on both controllers, written by the UI thread and read by the
+// emulation thread whenever the game latches its controllers.  Both pads and
+// the time the host sampled them share one atomic word so a reader always
+// sees a consistent set: buttons in the low 16 bits, steady clock
+// microseconds in the rest (enough for 8 years of uptime).
+class InputSnapshot {
+public:
+    InputSnapshot() : m_State(0) {}
+
+    // Microseconds on the clock Stamp() uses
+    static uint64_t Now() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Stamped with the current time, so call it whenever the host input has
+    // been looked at even if nothing changed
+    void Set(uint32_t port, uint8_t buttons) {
+        uint32_t shift = (port & 0x01) * 8;
+        uint64_t state = m_State.load(std::memory_order_relaxed) & 0xffff;
+        state = (state & ~(0xffull << shift)) | ((uint64_t)buttons << shift);
+        m_State.store(state | (Now() << 16), std::memory_order_release);
+    }
+
+    // Only one thread writes, so no read-modify-write race to worry about
+    void SetAll(uint16_t buttons) { m_State.store(buttons | (Now() << 16), std::memory_order_release); }
+
+    uint8_t Get(uint32_t port) const {
+        return (uint8_t)(m_State.load(std::memory_order_acquire) >> ((port & 0x01) * 8));
+    }
+
+    // Both pads, port 0 in the low byte, and when they were sampled
+    uint16_t GetAll(uint64_t* stamp) const {
+        uint64_t state = m_State.load(std::memory_order_acquire);
+        *stamp = state >> 16;
+        return (uint16_t)state;
+    }
+
+public:
+    InputSnapshot(const InputSnapshot&) = delete;
+    InputSnapshot& operator=(const InputSnapshot&) = delete;
+
+private:
+    std::atomic<uint64_t> m_State;
+};
+
+}
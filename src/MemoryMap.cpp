@@ -1,42 +1,92 @@
 #include "MemoryMap.h"
 
+#include "APU.h"
+#include "Controllers.h"
+#include "PPU.h"
+#include "Recompiler.h"
+#include "SaveRam.h"
+#include "TileCache.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cstring>
 
 namespace raunnes {
-MemoryMap::MemoryMap(uint8_t* prg, uint16_t prgSize, uint8_t* chr, uint16_t chrSize) {
+MemoryMap::MemoryMap(const uint8_t* prg, size_t prgSize, const uint8_t* chr, size_t chrSize, bool chrRAM) :
+    m_Mirroring(Cartridge::MirroringHorizontal),
+    m_PRGRAM(nullptr),
+    m_SaveRam(nullptr),
+    m_PPU(nullptr),
+    m_APU(nullptr),
+    m_Controllers(nullptr),
+    m_TileCache(nullptr),
+    m_Recompiler(nullptr),
+    m_CHRRAM(chrRAM),
+    m_StallCycles(0),
+    m_Accesses() {
     m_Bytes.resize(0x10000);
 
-    assert(prgSize >= 0x4000);
-    assert(prgSize % 0x4000 == 0);
+    // Cartridge::Load() only lets NROM through
+    assert(prgSize == 0x4000 || prgSize == 0x8000);
+    assert(chrSize <= 0x2000);
 
-    for(uint32_t i = 0x6000; i < 0x7fff; i += prgSize) {
-        memcpy(&m_Bytes[i], prg, prgSize);	
-    }
+    // $6000-$7FFF is PRG-RAM, not ROM.  Without a battery it lives in m_Bytes.
+    m_PRGRAM = &m_Bytes[0x6000];
 
-    for (uint32_t i = 0x8000; i < 0xbfff; i += prgSize) {
-        memcpy(&m_Bytes[i], prg, prgSize);
+    // NROM-128 appears twice, NROM-256 fills the space once
+    prgSize = std::min(prgSize, (size_t)0x8000);
+    for (size_t i = 0x8000; i < 0x10000; i += prgSize) {
+        memcpy(&m_Bytes[i], prg, std::min(prgSize, 0x10000 - i));
     }
 
-    for (uint32_t i = 0xc000; i < 0xffff; i += prgSize) {
-        memcpy(&m_Bytes[i], prg, prgSize);
+    m_CHR.assign(chr, chr + std::min(chrSize, (size_t)0x2000));
+    if (m_CHR.size() < 0x2000) {
+        m_CHR.resize(0x2000);
+    }
+    for (uint32_t page = 0; page < 8; page++) {
+        m_PPUPages[page] = &m_CHR[page * 0x400];
+        m_PPUPageWritable[page] = m_CHRRAM;
     }
 
-    // Copy CHR Rom to 0x0 - 0x1fff
-    m_PPUBytes.resize(0x4000);
-    memcpy(&m_PPUBytes[0], chr, chrSize);
+    memset(m_VRAM, 0, sizeof(m_VRAM));
+    SetMirroring(Cartridge::MirroringHorizontal);
 }
 
 MemoryMap::~MemoryMap() {
 }
     
-uint8_t MemoryMap::Read(uint16_t address) const {
+uint8_t MemoryMap::Read(uint16_t address) {
+    if((address >= 0x2000) && (address <= 0x3fff)) {
+        // PPU registers, mirrored every 8 bytes
+        if (m_PPU != nullptr) {
+            if ((address & 0x7) == 0x2) {
+                m_Accesses.StatusReads++;
+            } else {
+                m_Accesses.IOReads++;
+            }
+            return m_PPU->ReadRegister(0x2000 | (address & 0x7));
+        }
+        return m_Bytes[address];
+    }
+    if (address == 0x4015 && m_APU != nullptr) {
+        m_Accesses.IOReads++;
+        return m_APU->ReadStatus();
+    }
+    if ((address == 0x4016 || address == 0x4017) && m_Controllers != nullptr) {
+        m_Accesses.IOReads++;
+        return m_Controllers->Read(address & 0x01);
+    }
+    return Peek(address);
+}
+
+uint8_t MemoryMap::Peek(uint16_t address) const {
     if (address < m_Bytes.size()) {
 
-        if((address >= 0x2000) && (address <= 0x2007)) {
+        if((address >= 0x2000) && (address <= 0x3fff) && m_PPU != nullptr) {
             // PPU registers
             return 0;
+        } else if ((address >= 0x6000) && (address <= 0x7fff)) {
+            return m_PRGRAM[address - 0x6000];
         } else {
             return m_Bytes[address];
         }
@@ -45,39 +95,202 @@ uint8_t MemoryMap::Read(uint16_t address) const {
 }
     
 void MemoryMap::Write(uint16_t address, uint8_t value) {
-    if (address < m_Bytes.size()) {
+    m_Accesses.Writes++;
+
+    if ((address >= 0x2000) && (address <= 0x3fff) && m_PPU != nullptr) {
+        m_PPU->WriteRegister(0x2000 | (address & 0x7), value);
+    } else if (address == 0x4014 && m_PPU != nullptr) {
+        // OAM DMA, copies a page through $2004 while the CPU is halted
+        // https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+        uint16_t page = value << 8;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint8_t data = Read(page | i);
+            m_PPU->WriteRegister(0x2004, data);
+        }
+        m_StallCycles += 513;
+    } else if (address == 0x4016 && m_Controllers != nullptr) {
+        m_Controllers->Write(value);
+    } else if (address >= 0x4000 && address <= 0x4017 && address != 0x4016 && m_APU != nullptr) {
+        m_APU->WriteRegister(address, value);
+    } else if ((address >= 0x6000) && (address <= 0x7fff)) {
+        if (m_Recompiler != nullptr && m_PRGRAM[address - 0x6000] != value) {
+            m_Recompiler->Written(address);
+        }
+        m_PRGRAM[address - 0x6000] = value;
+        if (m_SaveRam != nullptr) {
+            m_SaveRam->MarkDirty(address - 0x6000);
+        }
+    } else if (address < m_Bytes.size()) {
+        if (m_Recompiler != nullptr && m_Bytes[address] != value) {
+            m_Recompiler->Written(address);
+        }
         m_Bytes[address] = value;
     }
 }
 
-uint8_t MemoryMap::ReadPPU(uint16_t address) const {
-    // Address range 	Size 	Description
-    // $0000-$0FFF      $1000 	Pattern table 0
-    // $1000-$1FFF      $1000 	Pattern table 1
-    // $2000-$23FF      $0400 	Nametable 0
-    // $2400-$27FF      $0400 	Nametable 1
-    // $2800-$2BFF      $0400 	Nametable 2
-    // $2C00-$2FFF      $0400 	Nametable 3
-    // $3000-$3EFF      $0F00 	Mirrors of $2000-$2EFF
-    // $3F00-$3F1F      $0020 	Palette RAM indexes
-    // $3F20-$3FFF      $00E0 	Mirrors of $3F00-$3F1F
+uint8_t* MemoryMap::DirectPage(uint8_t page, bool write) {
+    if (page >= 0x20 && page <= 0x3f) {
+        return m_PPU != nullptr ? nullptr : &m_Bytes[page << 8];
+    }
+    if (page == 0x40) {
+        // $4014 is the PPU's, $4015-$4017 the APU's and the controllers'
+        return m_PPU != nullptr || m_APU != nullptr || m_Controllers != nullptr ? nullptr : &m_Bytes[page << 8];
+    }
+    if (page >= 0x60 && page <= 0x7f) {
+        return write && m_SaveRam != nullptr ? nullptr : m_PRGRAM + ((page - 0x60) << 8);
+    }
+    return &m_Bytes[page << 8];
+}
 
-    int size = m_PPUBytes.size();
-    if (address < m_PPUBytes.size()) {
+void MemoryMap::AttachPPU(PPU* ppu) {
+    m_PPU = ppu;
+    if (m_Recompiler != nullptr) {
+        m_Recompiler->InvalidateAll();
+    }
+}
 
-        if((address >= 0x3000) && (address <= 0x3eff)) {
-            return m_PPUBytes[address - 0x1000];
+void MemoryMap::AttachAPU(APU* apu) {
+    m_APU = apu;
+    if (m_Recompiler != nullptr) {
+        m_Recompiler->InvalidateAll();
+    }
+}
 
-        } else if((address >= 0x3f20) && (address <= 0x3fff)) {
-            uint16_t newAddr = 0x3f00 + (address % 0x1f);
-            return m_PPUBytes[newAddr];
-        
-        } else {
-            return m_PPUBytes[address];
+void MemoryMap::AttachControllers(Controllers* controllers) {
+    m_Controllers = controllers;
+    if (m_Recompiler != nullptr) {
+        m_Recompiler->InvalidateAll();
+    }
+}
+
+void MemoryMap::AttachRecompiler(Recompiler* recompiler) {
+    m_Recompiler = recompiler;
+}
+
+void MemoryMap::AttachTileCache(TileCache* tileCache) {
+    m_TileCache = tileCache;
+}
+
+uint32_t MemoryMap::TakeStallCycles() {
+    uint32_t cycles = m_StallCycles;
+    m_StallCycles = 0;
+    return cycles;
+}
+
+void MemoryMap::AttachSaveRam(SaveRam* saveRam) {
+    if (saveRam != nullptr) {
+        assert(saveRam->Size() >= 0x2000);
+        m_PRGRAM = saveRam->Data();
+    } else {
+        m_PRGRAM = &m_Bytes[0x6000];
+    }
+    m_SaveRam = saveRam;
+    if (m_Recompiler != nullptr) {
+        m_Recompiler->InvalidateAll();
+    }
+}
+
+void MemoryMap::SaveState(State& state) const {
+    memcpy(state.Bytes, m_Bytes.data(), sizeof(state.Bytes));
+    memcpy(state.PRGRAM, m_PRGRAM, sizeof(state.PRGRAM));
+    memcpy(state.VRAM, m_VRAM, sizeof(state.VRAM));
+    if (m_CHRRAM) {
+        assert(m_CHR.size() <= sizeof(state.CHRRAM));
+        memcpy(state.CHRRAM, m_CHR.data(), m_CHR.size());
+    }
+    for (uint32_t page = 0; page < 8; page++) {
+        state.CHROffsets[page] = (uint32_t)(m_PPUPages[page] - m_CHR.data());
+    }
+    state.Mirroring = m_Mirroring;
+    state.StallCycles = m_StallCycles;
+}
+
+void MemoryMap::LoadState(const State& state) {
+    // Run-ahead loads every frame, usually over the same code
+    if (m_Recompiler != nullptr) {
+        for (uint32_t page = 0; page < 0x100; page++) {
+            if (m_Recompiler->HasCode(page) &&
+                memcmp(DirectPage((uint8_t)page, false), page >= 0x60 && page <= 0x7f ? &state.PRGRAM[(page - 0x60) << 8] : &state.Bytes[page << 8], 0x100) != 0) {
+                m_Recompiler->InvalidatePage(page);
+            }
         }
-        
     }
-    return 0;
+
+    memcpy(m_Bytes.data(), state.Bytes, sizeof(state.Bytes));
+
+    if (m_SaveRam != nullptr) {
+        // Only what differs goes back, so the file isn't rewritten for nothing
+        for (uint32_t offset = 0; offset < sizeof(state.PRGRAM); offset += 0x100) {
+            if (memcmp(m_PRGRAM + offset, state.PRGRAM + offset, 0x100) != 0) {
+                memcpy(m_PRGRAM + offset, state.PRGRAM + offset, 0x100);
+                m_SaveRam->MarkDirty(offset);
+            }
+        }
+    } else {
+        memcpy(m_PRGRAM, state.PRGRAM, sizeof(state.PRGRAM));
+    }
+
+    memcpy(m_VRAM, state.VRAM, sizeof(m_VRAM));
+
+    if (m_CHRRAM && memcmp(m_CHR.data(), state.CHRRAM, m_CHR.size()) != 0) {
+        memcpy(m_CHR.data(), state.CHRRAM, m_CHR.size());
+        if (m_TileCache != nullptr) {
+            m_TileCache->InvalidateAll();
+        }
+    }
+
+    for (uint32_t page = 0; page < 8; page++) {
+        if (m_PPUPages[page] != &m_CHR[state.CHROffsets[page]]) {
+            MapCHR(page, state.CHROffsets[page]);
+        }
+    }
+
+    if (m_Mirroring != state.Mirroring) {
+        SetMirroring(state.Mirroring);
+    }
+    m_StallCycles = state.StallCycles;
+}
+
+void MemoryMap::WritePPU(uint16_t address, uint8_t value) {
+    uint32_t page = (address >> 10) & 0x0f;
+    if (!m_PPUPageWritable[page]) {
+        return;
+    }
+
+    m_PPUPages[page][address & 0x03ff] = value;
+    if (page < 8 && m_TileCache != nullptr) {
+        m_TileCache->Invalidate((address & 0x1fff) >> 4);
+    }
+}
+
+void MemoryMap::SetMirroring(Cartridge::Mirroring mirroring) {
+    // Which 1 KiB of VRAM each of $2000 / $2400 / $2800 / $2C00 uses
+    static const uint8_t kLayouts[][4] = {
+        { 0, 0, 1, 1 },     // MirroringHorizontal
+        { 0, 1, 0, 1 },     // MirroringVertical
+        { 0, 1, 2, 3 },     // MirroringFourScreen
+        { 0, 0, 0, 0 },     // MirroringSingleScreenLower
+        { 1, 1, 1, 1 },     // MirroringSingleScreenUpper
+    };
+
+    m_Mirroring = mirroring;
+
+    for (uint32_t table = 0; table < 4; table++) {
+        uint8_t* page = &m_VRAM[kLayouts[mirroring][table] * 0x400];
+        m_PPUPages[8 + table] = page;
+        m_PPUPages[12 + table] = page;
+        m_PPUPageWritable[8 + table] = true;
+        m_PPUPageWritable[12 + table] = true;
+    }
+}
+
+void MemoryMap::MapCHR(uint32_t page, uint32_t offset) {
+    assert(page < 8);
+
+    m_PPUPages[page] = &m_CHR[(offset & ~0x3ffu) % m_CHR.size()];
+    if (m_TileCache != nullptr) {
+        m_TileCache->InvalidateRange(page * 0x400, 0x400);
+    }
 }
 
 }
\ No newline at end of file
@@ -4,25 +4,138 @@
 #include <vector>
 #include <cstdint>
 
+#include "Cartridge.h"
+
 namespace raunnes {
 
+class APU;
+class Controllers;
+class PPU;
+class Recompiler;
+class SaveRam;
+class TileCache;
+
+// With nothing attached the CPU side is 64 KiB of flat RAM, which is what
+// single instruction tests want.
 class MemoryMap {
 public:
-    MemoryMap(uint8_t* prg, uint16_t prgSize, uint8_t* chr, uint16_t chrSize);
+    // CPU and PPU memory and the bank mapping, for snapshots.  About 100 KiB,
+    // so it's best kept on the heap and reused.
+    struct State {
+        uint8_t Bytes[0x10000];
+        uint8_t PRGRAM[0x2000];
+        uint8_t VRAM[0x1000];
+        uint8_t CHRRAM[0x2000];     // only with CHR RAM
+        uint32_t CHROffsets[8];
+        Cartridge::Mirroring Mirroring;
+        uint32_t StallCycles;
+    };
+
+public:
+    // prg is 16 KiB, mirrored into both halves of $8000-$FFFF, or 32 KiB;
+    // chr at most 8 KiB
+    MemoryMap(const uint8_t* prg, size_t prgSize, const uint8_t* chr, size_t chrSize, bool chrRAM = false);
     ~MemoryMap();
 
-    uint8_t Read(uint16_t address) const;
+    uint8_t Read(uint16_t address);
     void Write(uint16_t address, uint8_t value);
 
-    uint8_t ReadPPU(uint16_t address) const;
-    
+    // Read without side effects (PPU registers read as 0 once it's attached),
+    // for logging / debuggers
+    uint8_t Peek(uint16_t address) const;
+
+    // PPU bus, $0000-$3FFF, through a table of 1 KiB pages pointing into CHR
+    // ROM / RAM and nametable VRAM.  $3000-$3EFF mirror the nametables.  The
+    // palette at $3F00 belongs to the PPU, which reads the mirrored nametable
+    // underneath it from here.
+    // https://www.nesdev.org/wiki/PPU_memory_map
+    uint8_t ReadPPU(uint16_t address) const {
+        return m_PPUPages[(address >> 10) & 0x0f][address & 0x03ff];
+    }
+    void WritePPU(uint16_t address, uint8_t value);
+
+    // Points the nametable pages at VRAM.  Mappers switch mirroring by
+    // calling this, which only swaps pointers.
+    // https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+    void SetMirroring(Cartridge::Mirroring mirroring);
+    Cartridge::Mirroring Mirroring() const { return m_Mirroring; }
+
+    // Points 1 KiB pattern table page (0-7) at offset into CHR, for mapper
+    // bank switches
+    void MapCHR(uint32_t page, uint32_t offset);
+
+    // $2000-$3FFF go to the PPU's registers once attached
+    void AttachPPU(PPU* ppu);
+
+    // $4000-$4013, $4015 and $4017 go to the APU once attached
+    void AttachAPU(APU* apu);
+
+    // $4016 writes and $4016 / $4017 reads go to the controller ports once
+    // attached
+    void AttachControllers(Controllers* controllers);
+
+    // Told about every change to the pattern tables
+    void AttachTileCache(TileCache* tileCache);
+
+    // CPU cycles owed to the last OAM DMA, cleared by reading them
+    uint32_t TakeStallCycles();
+
+    // Running counts of the accesses that could make code behave differently
+    // the next time it runs, for spotting idle loops.  Every other CPU read
+    // is of memory, which only changes by being written.
+    struct AccessCounts {
+        uint32_t Writes;
+        uint32_t IOReads;       // registers other than PPU status
+        uint32_t StatusReads;   // PPU status, $2002
+    };
+    const AccessCounts& Accesses() const { return m_Accesses; }
+
+    // For writes made straight into DirectPage() memory
+    void CountWrites(uint32_t writes) { m_Accesses.Writes += writes; }
+
+    // Where CPU page (address >> 8) can be read or written directly, or
+    // nullptr when accesses there have to go through Read() / Write(): the
+    // attached registers, and PRG-RAM writes while there's a save file to
+    // tell.  What it returns only changes when something is attached.
+    uint8_t* DirectPage(uint8_t page, bool write);
+
+    // Told about writes that change memory, so it can drop code translated
+    // from there, and about every attachment
+    void AttachRecompiler(Recompiler* recompiler);
+
+    // Moves $6000-$7FFF PRG-RAM into the save file's mapping
+    void AttachSaveRam(SaveRam* saveRam);
+
+    // Loading only touches the tile cache and the save file for what
+    // actually changed
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
 public:
     MemoryMap(const MemoryMap&) = delete;
     MemoryMap& operator=(const MemoryMap&) = delete;
 
 private:
     std::vector<uint8_t> m_Bytes;
-    std::vector<uint8_t> m_PPUBytes;
+    std::vector<uint8_t> m_CHR;
+
+    // 2 KiB in the console plus the 2 KiB four screen carts add
+    uint8_t m_VRAM[0x1000];
+    uint8_t* m_PPUPages[16];
+    bool m_PPUPageWritable[16];
+    Cartridge::Mirroring m_Mirroring;
+
+    uint8_t* m_PRGRAM;      // $6000-$7FFF, 8 KiB
+    SaveRam* m_SaveRam;
+
+    PPU* m_PPU;
+    APU* m_APU;
+    Controllers* m_Controllers;
+    TileCache* m_TileCache;
+    Recompiler* m_Recompiler;
+    bool m_CHRRAM;
+    uint32_t m_StallCycles;
+    AccessCounts m_Accesses;
 };
 
 
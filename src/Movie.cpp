@@ -0,0 +1,117 @@
+#include "Movie.h"
+
+#include "Input.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace raunnes {
+
+static const struct {
+    const char* Name;
+    uint8_t Button;
+} kButtonNames[] = {
+    { "A", ButtonA },
+    { "B", ButtonB },
+    { "Select", ButtonSelect },
+    { "Start", ButtonStart },
+    { "Up", ButtonUp },
+    { "Down", ButtonDown },
+    { "Left", ButtonLeft },
+    { "Right", ButtonRight },
+};
+
+Movie::Movie() {
+}
+
+Movie::~Movie() {
+}
+
+bool Movie::Load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.good()) {
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+
+    return Parse(ss.str());
+}
+
+bool Movie::Parse(const std::string& text) {
+    std::istringstream lines(text);
+    std::string line;
+    uint32_t lineNumber = 0;
+
+    m_Changes.clear();
+
+    while (std::getline(lines, line)) {
+        lineNumber++;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field)) {
+            continue;
+        }
+
+        char* end = nullptr;
+        Change change = { strtoull(field.c_str(), &end, 10), 0 };
+        if (*end != '\0' || (!m_Changes.empty() && change.Frame < m_Changes.back().Frame)) {
+            std::cerr << "movie:" << lineNumber << ": bad frame '" << field << "'\n";
+            return false;
+        }
+
+        while (fields >> field) {
+            if (field == "-") {
+                continue;
+            }
+
+            uint32_t shift = 0;
+            if (field.compare(0, 2, "2:") == 0) {
+                shift = 8;
+                field = field.substr(2);
+            } else if (field.compare(0, 2, "1:") == 0) {
+                field = field.substr(2);
+            }
+
+            uint8_t button = 0;
+            for (const auto& name : kButtonNames) {
+                if (field == name.Name) {
+                    button = name.Button;
+                }
+            }
+            if (button == 0) {
+                std::cerr << "movie:" << lineNumber << ": unknown button '" << field << "'\n";
+                return false;
+            }
+            change.Buttons |= button << shift;
+        }
+
+        // A later line for the same frame wins
+        if (!m_Changes.empty() && m_Changes.back().Frame == change.Frame) {
+            m_Changes.back() = change;
+        } else {
+            m_Changes.push_back(change);
+        }
+    }
+
+    return true;
+}
+
+uint16_t Movie::ButtonsAt(uint64_t frame) const {
+    // The last change at or before frame
+    auto after = std::upper_bound(m_Changes.begin(), m_Changes.end(), frame,
+        [](uint64_t f, const Change& change) { return f < change.Frame; });
+    return after == m_Changes.begin() ? 0 : (after - 1)->Buttons;
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace raunnes {
+
+// Scripted controller input for repeatable runs: benchmarks, profile
+// training, comparing builds.
+//
+// File format, one change per line:
+//
+//   <frame> [1:|2:]<button> ... | -   [# comment]
+//
+// From the start of that frame the pad holds exactly the buttons listed (A B
+// Select Start Up Down Left Right), "-" for none, until a later line changes
+// it.  Buttons are pad 1's unless prefixed 2:.  Frames count from power on
+// and lines have to be in order.
+class Movie {
+public:
+    Movie();
+    ~Movie();
+
+    bool Load(const std::string& path);
+    bool Parse(const std::string& text);
+
+    // Both pads during frame, pad 1 in the low byte as InputSnapshot::SetAll()
+    // takes them
+    uint16_t ButtonsAt(uint64_t frame) const;
+
+    // Frame of the last change
+    uint64_t Length() const { return m_Changes.empty() ? 0 : m_Changes.back().Frame; }
+
+public:
+    Movie(const Movie&) = delete;
+    Movie& operator=(const Movie&) = delete;
+
+private:
+    struct Change {
+        uint64_t Frame;
+        uint16_t Buttons;
+    };
+
+    std::vector<Change> m_Changes;
+};
+
+}
@@ -0,0 +1,253 @@
+#include "NESDriver.h"
+
+#include "Recompiler.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+namespace raunnes {
+
+// A loop whose branch back is at most this far behind its top.  Polling
+// loops are a few instructions; longer ones are rarely idle.
+static const uint16_t kIdleLoopBytes = 32;
+
+// Longest iteration worth checking, in CPU cycles.  Well under the 20 lines
+// PPU::StatusChanges() relies on.
+static const uint64_t kIdleLoopCycles = 256;
+
+NESDriver::NESDriver(const Cartridge& cartridge) :
+    m_Memory(cartridge.PRG().data(), cartridge.PRG().size(),
+        cartridge.CHR().data(), cartridge.CHR().size(), cartridge.HasCHRRAM()),
+    m_CPU(m_Memory),
+    m_PPU(m_Memory),
+    m_APU(m_Memory),
+    m_Frames(nullptr),
+    m_Instructions(0),
+    m_IdleCycles(0),
+    m_Translated(0),
+    m_IdleSkip(true),
+    m_IdleLoop(),
+    m_CPUCycleBase(0) {
+
+    m_Memory.AttachPPU(&m_PPU);
+    m_Memory.AttachAPU(&m_APU);
+    m_Memory.AttachControllers(&m_Controllers);
+    m_Memory.SetMirroring(cartridge.Mirror());
+    m_PPU.SetAccuracy(cartridge.Accuracy());
+
+    m_CPUCycleBase = m_CPU.Cycles();
+    m_PPU.AttachClock(&m_CPU);
+    m_APU.AttachClock(&m_CPU);
+}
+
+NESDriver::~NESDriver() {
+    SetRecompile(false);
+}
+
+void NESDriver::RunFrame(bool render, bool speculative) {
+    uint64_t start = PerfCounters::Now();
+    uint64_t frame = m_PPU.FrameCount();
+    m_PPU.SetSkipRender(!render);
+    m_Controllers.SetSpeculative(speculative);
+
+    while (m_PPU.FrameCount() == frame) {
+        RunUntil(m_PPU.NextVBlankDot());
+    }
+
+    uint64_t apuStart = PerfCounters::Now();
+    m_APU.EndFrame();
+    uint64_t end = PerfCounters::Now();
+
+    uint32_t catchUps;
+    uint64_t ppuNs;
+    m_PPU.TakeCatchUps(catchUps, ppuNs);
+
+    // The PPU's catch-ups happen inside the CPU's time, so it's what's left
+    uint64_t frameNs = end - start;
+    uint64_t apuNs = end - apuStart;
+    if (speculative) {
+        m_Controllers.SetSpeculative(false);
+    } else {
+        m_Controllers.EndFrame();
+        m_Perf.BeginFrame();
+        m_Perf.Set(PerfCounters::CounterInstructions, m_Instructions);
+        m_Perf.Set(PerfCounters::CounterIdleCycles, m_IdleCycles);
+        m_Perf.Set(PerfCounters::CounterTranslated, m_Translated);
+        m_Perf.Set(PerfCounters::CounterPPUCatchUps, catchUps);
+        m_Perf.Set(PerfCounters::CounterFrameNs, frameNs);
+        m_Perf.Set(PerfCounters::CounterPPUNs, ppuNs);
+        m_Perf.Set(PerfCounters::CounterAPUNs, apuNs);
+        m_Perf.Set(PerfCounters::CounterCPUNs, frameNs > ppuNs + apuNs ? frameNs - ppuNs - apuNs : 0);
+        m_Perf.FrameDone(end);
+    }
+
+    // The same times again for the timeline, the catch-ups are already on it
+    if (Trace::Enabled()) {
+        Trace::Record("CPU run", start, apuStart, (uint32_t)m_Instructions);
+        Trace::Record("APU", apuStart, end, m_APU.SamplesAvailable());
+    }
+    // A loop seen last frame is still a loop, keep its count relative
+    m_IdleLoop.Instructions -= m_Instructions;
+    m_Instructions = 0;
+    m_IdleCycles = 0;
+    m_Translated = 0;
+
+    if (m_Frames != nullptr && render) {
+        m_Frames->Publish();
+        m_PPU.SetFrame(&m_Frames->Back());
+    }
+}
+
+void NESDriver::SaveState(State& state) const {
+    m_CPU.SaveState(state.Cpu);
+    m_PPU.SaveState(state.Ppu);
+    m_APU.SaveState(state.Apu);
+    m_Memory.SaveState(state.Memory);
+    m_Controllers.SaveState(state.Pads);
+}
+
+void NESDriver::LoadState(const State& state) {
+    m_CPU.LoadState(state.Cpu);
+    m_PPU.LoadState(state.Ppu);
+    m_APU.LoadState(state.Apu);
+    m_Memory.LoadState(state.Memory);
+    m_Controllers.LoadState(state.Pads);
+
+    // The loop was in another timeline
+    m_IdleLoop.Valid = false;
+}
+
+bool NESDriver::SetRecompile(bool recompile) {
+    if (recompile == Recompiling()) {
+        return true;
+    }
+    if (recompile && !Recompiler::Supported()) {
+        return false;
+    }
+
+    m_Memory.AttachRecompiler(nullptr);
+    m_CPU.AttachRecompiler(nullptr);
+    m_Recompiler.reset();
+
+    if (recompile) {
+        Recompiler::Options options = Recompiler::kDefaultOptions;
+        options.PerfMap = true;
+        m_Recompiler.reset(new Recompiler(m_Memory, options));
+        m_Memory.AttachRecompiler(m_Recompiler.get());
+        m_CPU.AttachRecompiler(m_Recompiler.get());
+    }
+    return true;
+}
+
+void NESDriver::AttachFrameExchange(TripleBuffer<PPU::Frame>* frames) {
+    m_Frames = frames;
+    m_PPU.SetFrame(frames ? &frames->Back() : nullptr);
+}
+
+void NESDriver::RunUntil(uint64_t dot) {
+    // 3 dots per CPU cycle, rounded up so the CPU reaches dot
+    uint64_t target = m_CPUCycleBase + (dot + 2) / 3;
+
+    while (m_CPU.Cycles() < target) {
+        uint16_t pc = m_CPU.Registers().PC;
+        uint32_t ran = 0;
+
+        // A block has to be done before anything below could come due
+        // partway through it: the end of the run or the IRQ.  An NMI needs a
+        // register access, which blocks leave to Execute().
+        if (m_Recompiler != nullptr) {
+            uint64_t limit = target;
+            if (!m_CPU.InterruptsDisabled()) {
+                limit = std::min(limit, m_APU.IRQCycle());
+            }
+            ran = m_CPU.ExecuteBlock(limit, pc);
+            m_Translated += ran;
+        }
+        if (ran == 0) {
+            m_CPU.Execute();
+            ran = 1;
+        }
+        m_Instructions += ran;
+
+        // Raised by a register access that caught the PPU up into vblank, or
+        // by enabling NMI during vblank
+        if (m_PPU.TakeNMI()) {
+            m_CPU.NMI();
+        }
+
+        // The APU's IRQ is level triggered and its timing is known ahead,
+        // so it's one compare until the line actually goes low
+        if (m_CPU.Cycles() >= m_APU.IRQCycle() && !m_CPU.InterruptsDisabled()) {
+            m_CPU.IRQ();
+        }
+
+        // A short jump back, or to itself, might have closed a polling loop.
+        // After a block pc is its last instruction.
+        if (m_IdleSkip && (uint16_t)(pc - m_CPU.Registers().PC) < kIdleLoopBytes) {
+            SkipIdleLoop(target);
+        }
+    }
+
+    m_PPU.CatchUp(dot);
+
+    if (m_PPU.TakeNMI()) {
+        m_CPU.NMI();
+    }
+}
+
+void NESDriver::SkipIdleLoop(uint64_t target) {
+    const CPUCore6502::CPUCore6502State& registers = m_CPU.Registers();
+    const MemoryMap::AccessCounts& accesses = m_Memory.Accesses();
+    IdleLoop& loop = m_IdleLoop;
+    uint64_t now = m_CPU.Cycles();
+
+    // One whole iteration since the last time here, which wrote nothing,
+    // read no register but $2002, didn't see $2002 change (so every read of
+    // it returned what it returns now) and put every register back as it
+    // was.  Anything else it read is memory nobody wrote, so the next
+    // iteration does exactly the same, and so on until something outside
+    // the CPU changes.  An interrupt would have pushed to the stack.
+    bool repeated = loop.Valid &&
+        loop.Registers.PC == registers.PC &&
+        loop.Registers.A == registers.A &&
+        loop.Registers.X == registers.X &&
+        loop.Registers.Y == registers.Y &&
+        loop.Registers.P == registers.P &&
+        loop.Registers.SP == registers.SP &&
+        loop.Accesses.Writes == accesses.Writes &&
+        loop.Accesses.IOReads == accesses.IOReads &&
+        loop.StatusChanges == m_PPU.StatusChanges() &&
+        now - loop.Cycle <= kIdleLoopCycles;
+
+    if (repeated) {
+        uint64_t length = now - loop.Cycle;
+
+        // Every skipped iteration has to finish by the end of the run, the
+        // instruction boundary the IRQ would be taken on, and the first
+        // read that could see $2002 change: a read at cycle c has the PPU
+        // caught up to dot (c - base) * 3.
+        uint64_t last = target;
+        if (!m_CPU.InterruptsDisabled()) {
+            last = std::min(last, m_APU.IRQCycle() - 1);
+        }
+        if (loop.Accesses.StatusReads != accesses.StatusReads) {
+            last = std::min(last, m_CPUCycleBase + (m_PPU.NextStatusChangeDot() + 2) / 3 - 1);
+        }
+
+        if (last > now && length > 0) {
+            uint64_t iterations = (last - now) / length;
+            m_CPU.SkipCycles(iterations * length);
+            m_Instructions += iterations * (m_Instructions - loop.Instructions);
+            m_IdleCycles += iterations * length;
+        }
+    }
+
+    loop.Valid = true;
+    loop.Registers = registers;
+    loop.Cycle = m_CPU.Cycles();
+    loop.Instructions = m_Instructions;
+    loop.Accesses = accesses;
+    loop.StatusChanges = m_PPU.StatusChanges();
+}
+
+}
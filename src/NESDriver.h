@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "6502Core.h"
+#include "APU.h"
+#include "Cartridge.h"
+#include "Controllers.h"
+#include "MemoryMap.h"
+#include "PPU.h"
+#include "PerfCounters.h"
+#include "TripleBuffer.h"
+
+namespace raunnes {
+
+class Recompiler;
+
+// Ties the CPU, PPU, APU and memory map for one cartridge together.  The CPU
+// runs freely; the PPU catches up when its registers are touched and at the
+// predicted start of vblank, where the NMI has to land.  The APU catches up
+// at the end of every frame.
+//
+// Most games spend much of every frame in a loop polling RAM or $2002 for
+// the NMI to come.  Once one iteration of such a loop has been seen to leave
+// the machine exactly as it found it, the CPU jumps over as many more as fit
+// before anything could change what they read.
+//
+// Optionally, hot code runs as x86-64 translated by a Recompiler, a block at
+// a time between the same checks.
+class NESDriver {
+public:
+    // The whole machine, for snapshots.  Around 100 KiB, so allocate one
+    // once and keep saving into it; after the first save neither direction
+    // allocates.  Attachments (frame exchange, save file, input) and
+    // settings aren't part of it.
+    struct State {
+        CPUCore6502::State Cpu;
+        PPU::State Ppu;
+        APU::State Apu;
+        MemoryMap::State Memory;
+        Controllers::State Pads;
+    };
+
+public:
+    NESDriver(const Cartridge& cartridge);
+    ~NESDriver();
+
+    // Runs until the PPU enters vblank, at which point FrameBuffer() holds a
+    // complete picture.  With a frame exchange attached the picture is
+    // published to it instead and FrameBuffer() moves on to the next one.
+    // The frame's audio is ready to read from Apu().
+    //
+    // render false skips pixel output for this frame (see
+    // PPU::SetSkipRender); nothing is published.
+    //
+    // speculative is for frames that are going to be rolled back (see
+    // RunAhead): they don't count towards the input and perf metrics, which
+    // keep describing the last real frame.
+    void RunFrame(bool render = true, bool speculative = false);
+
+    // The PPU renders straight into frames' back buffer
+    void AttachFrameExchange(TripleBuffer<PPU::Frame>* frames);
+
+    // Runs the CPU up to dot, then the PPU catches up to it.  NMIs and IRQs
+    // are taken on the first instruction boundary after they're raised.
+    void RunUntil(uint64_t dot);
+
+    CPUCore6502& Cpu() { return m_CPU; }
+    PPU& Ppu() { return m_PPU; }
+    APU& Apu() { return m_APU; }
+    Controllers& Pads() { return m_Controllers; }
+    MemoryMap& Memory() { return m_Memory; }
+
+    // Published at the end of every RunFrame()
+    PerfCounters& Perf() { return m_Perf; }
+
+    // Skipping idle loops, on by default.  The results are the same either
+    // way, only the time taken differs.
+    void SetIdleSkip(bool skip) { m_IdleSkip = skip; m_IdleLoop.Valid = false; }
+    bool IdleSkip() const { return m_IdleSkip; }
+
+    // Running hot code translated, off by default.  The results are the same
+    // either way.  False if there's no recompiler on this host.
+    bool SetRecompile(bool recompile);
+    bool Recompiling() const { return m_Recompiler != nullptr; }
+
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+    const uint8_t* FrameBuffer() const { return m_PPU.FrameBuffer(); }
+    uint64_t FrameCount() const { return m_PPU.FrameCount(); }
+
+public:
+    NESDriver(const NESDriver&) = delete;
+    NESDriver& operator=(const NESDriver&) = delete;
+
+private:
+    // The machine as it was the last time a short jump backwards landed on
+    // PC, the top of a loop that might be idle
+    struct IdleLoop {
+        bool Valid;
+        CPUCore6502::CPUCore6502State Registers;
+        uint64_t Cycle;
+        uint64_t Instructions;
+        MemoryMap::AccessCounts Accesses;
+        uint32_t StatusChanges;
+    };
+
+    void SkipIdleLoop(uint64_t target);
+
+private:
+    MemoryMap m_Memory;
+    CPUCore6502 m_CPU;
+    PPU m_PPU;
+    APU m_APU;
+    Controllers m_Controllers;
+    TripleBuffer<PPU::Frame>* m_Frames;
+    PerfCounters m_Perf;
+    uint64_t m_Instructions;    // this frame
+    uint64_t m_IdleCycles;      // this frame
+    uint64_t m_Translated;      // instructions this frame run as translated code
+
+    bool m_IdleSkip;
+    IdleLoop m_IdleLoop;
+
+    std::unique_ptr<Recompiler> m_Recompiler;
+
+    uint64_t m_CPUCycleBase;    // CPU cycle count at power on, PPU dot 0
+};
+
+}
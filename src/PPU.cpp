@@ -1,239 +1,1062 @@
 #include "PPU.h"
 
+#include "6502Core.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+
 #include <cassert>
+#include <cstring>
 
 namespace raunnes {
 
 PPU::PPU(MemoryMap& memory) :
     m_Map(memory),
-    m_Cycle(0),
+    m_TileCache(memory),
+    m_CompositeKernel(BestCompositeKernel()),
+    m_Composite(GetCompositeFunction(m_CompositeKernel)),
+    m_Clock(nullptr),
+    m_ClockBase(0),
+    m_Dot(0),
+    m_Scanline(0),
+    m_FrameCount(0),
+    m_NMIPending(false),
+    m_CatchUps(0),
+    m_CatchUpNs(0),
+    m_StatusChanges(0),
     m_Control(0x0),
     m_Mask(0x0),
     m_Status(0x0),
     m_OAMAddr(0x0),
     m_OAMData(0x0),
-    m_Scroll(0x0),
-    m_Addr(0x0),
-    m_AddrHighEnable(true),
+    m_V(0x0),
+    m_T(0x0),
+    m_FineX(0x0),
+    m_WriteToggle(false),
     m_Data(0x0),
-    m_OMADMA(0x0) {
+    m_OMADMA(0x0),
+    m_Latch(0x0),
+    m_SpriteLinesDirty(true),
+    m_SkipRender(false),
+    m_Accuracy(Cartridge::PPUAccuracyScanline),
+    m_Cycle(0),
+    m_OddFrame(false),
+    m_NextTile(0),
+    m_NextAttribute(0),
+    m_NextPatternLow(0),
+    m_NextPatternHigh(0),
+    m_PatternShiftLow(0),
+    m_PatternShiftHigh(0),
+    m_AttributeShiftLow(0),
+    m_AttributeShiftHigh(0),
+    m_EvalSprite(0),
+    m_EvalCount(0),
+    m_EvalDelay(0),
+    m_EvalSprite0(false),
+    m_SpriteCount(0),
+    m_Sprite0Loaded(false) {
+
+    memset(m_Pallette, 0, sizeof(m_Pallette));
+    memset(m_OAMRAM, 0, sizeof(m_OAMRAM));
+    memset(m_SecondaryOAMRAM, 0xff, sizeof(m_SecondaryOAMRAM));
+    memset(&m_OwnFrame, 0, sizeof(m_OwnFrame));
+    m_Frame = &m_OwnFrame;
+    memset(m_SpritePatternLow, 0, sizeof(m_SpritePatternLow));
+    memset(m_SpritePatternHigh, 0, sizeof(m_SpritePatternHigh));
+    memset(m_SpriteAttributes, 0, sizeof(m_SpriteAttributes));
+    memset(m_SpriteX, 0, sizeof(m_SpriteX));
+
+    m_Map.AttachTileCache(&m_TileCache);
 }
 
 PPU::~PPU() {
 }
 
+void PPU::SaveState(State& state) const {
+    state.ClockBase = m_ClockBase;
+    state.Dot = m_Dot;
+    state.Scanline = m_Scanline;
+    state.FrameCount = m_FrameCount;
+    state.NMIPending = m_NMIPending;
+
+    state.Control = m_Control;
+    state.Mask = m_Mask;
+    state.Status = m_Status;
+    state.OAMAddr = m_OAMAddr;
+    state.OAMData = m_OAMData;
+    state.V = m_V;
+    state.T = m_T;
+    state.FineX = m_FineX;
+    state.WriteToggle = m_WriteToggle;
+    state.Data = m_Data;
+    state.OMADMA = m_OMADMA;
+    state.Latch = m_Latch;
+
+    memcpy(state.Pallette, m_Pallette, sizeof(m_Pallette));
+    memcpy(state.OAMRAM, m_OAMRAM, sizeof(m_OAMRAM));
+    memcpy(state.SecondaryOAMRAM, m_SecondaryOAMRAM, sizeof(m_SecondaryOAMRAM));
+
+    state.Cycle = m_Cycle;
+    state.OddFrame = m_OddFrame;
+    state.NextTile = m_NextTile;
+    state.NextAttribute = m_NextAttribute;
+    state.NextPatternLow = m_NextPatternLow;
+    state.NextPatternHigh = m_NextPatternHigh;
+    state.PatternShiftLow = m_PatternShiftLow;
+    state.PatternShiftHigh = m_PatternShiftHigh;
+    state.AttributeShiftLow = m_AttributeShiftLow;
+    state.AttributeShiftHigh = m_AttributeShiftHigh;
+
+    state.EvalSprite = m_EvalSprite;
+    state.EvalCount = m_EvalCount;
+    state.EvalDelay = m_EvalDelay;
+    state.EvalSprite0 = m_EvalSprite0;
+
+    state.SpriteCount = m_SpriteCount;
+    state.Sprite0Loaded = m_Sprite0Loaded;
+    memcpy(state.SpritePatternLow, m_SpritePatternLow, sizeof(m_SpritePatternLow));
+    memcpy(state.SpritePatternHigh, m_SpritePatternHigh, sizeof(m_SpritePatternHigh));
+    memcpy(state.SpriteAttributes, m_SpriteAttributes, sizeof(m_SpriteAttributes));
+    memcpy(state.SpriteX, m_SpriteX, sizeof(m_SpriteX));
+}
+
+void PPU::LoadState(const State& state) {
+    m_ClockBase = state.ClockBase;
+    m_Dot = state.Dot;
+    m_Scanline = state.Scanline;
+    m_FrameCount = state.FrameCount;
+    m_NMIPending = state.NMIPending;
+
+    m_Control = state.Control;
+    m_Mask = state.Mask;
+    m_Status = state.Status;
+    m_OAMAddr = state.OAMAddr;
+    m_OAMData = state.OAMData;
+    m_V = state.V;
+    m_T = state.T;
+    m_FineX = state.FineX;
+    m_WriteToggle = state.WriteToggle;
+    m_Data = state.Data;
+    m_OMADMA = state.OMADMA;
+    m_Latch = state.Latch;
+
+    memcpy(m_Pallette, state.Pallette, sizeof(m_Pallette));
+    memcpy(m_OAMRAM, state.OAMRAM, sizeof(m_OAMRAM));
+    memcpy(m_SecondaryOAMRAM, state.SecondaryOAMRAM, sizeof(m_SecondaryOAMRAM));
+
+    // Derived from OAM and the sprite height, so rebuilt rather than saved
+    m_SpriteLinesDirty = true;
+
+    m_Cycle = state.Cycle;
+    m_OddFrame = state.OddFrame;
+    m_NextTile = state.NextTile;
+    m_NextAttribute = state.NextAttribute;
+    m_NextPatternLow = state.NextPatternLow;
+    m_NextPatternHigh = state.NextPatternHigh;
+    m_PatternShiftLow = state.PatternShiftLow;
+    m_PatternShiftHigh = state.PatternShiftHigh;
+    m_AttributeShiftLow = state.AttributeShiftLow;
+    m_AttributeShiftHigh = state.AttributeShiftHigh;
+
+    m_EvalSprite = state.EvalSprite;
+    m_EvalCount = state.EvalCount;
+    m_EvalDelay = state.EvalDelay;
+    m_EvalSprite0 = state.EvalSprite0;
+
+    m_SpriteCount = state.SpriteCount;
+    m_Sprite0Loaded = state.Sprite0Loaded;
+    memcpy(m_SpritePatternLow, state.SpritePatternLow, sizeof(m_SpritePatternLow));
+    memcpy(m_SpritePatternHigh, state.SpritePatternHigh, sizeof(m_SpritePatternHigh));
+    memcpy(m_SpriteAttributes, state.SpriteAttributes, sizeof(m_SpriteAttributes));
+    memcpy(m_SpriteX, state.SpriteX, sizeof(m_SpriteX));
+}
+
+bool PPU::SetCompositeKernel(CompositeKernel kernel) {
+    CompositeFunction composite = GetCompositeFunction(kernel);
+    if (composite == nullptr) {
+        return false;
+    }
+
+    m_CompositeKernel = kernel;
+    m_Composite = composite;
+    return true;
+}
+
 uint8_t PPU::I() const {
     return (m_Control << 5) >> 7;
 }
 
 void PPU::WriteRegister(uint16_t address, uint8_t value) {
+    Sync();
+
+    m_Latch = value;
+
     switch (address) {
     case 0x2000:
+        // Turning NMI on during vblank fires one straight away
+        if (!(m_Control & 0x80) && (value & 0x80) && (m_Status & 0x80)) {
+            m_NMIPending = true;
+        }
+        if ((m_Control ^ value) & 0x20) {
+            m_SpriteLinesDirty = true;
+        }
         m_Control = value;
+        m_T = (m_T & 0xf3ff) | ((value & 0x03) << 10);
         break;
     case 0x2001:
         m_Mask = value;
         break;
     case 0x2003:
-        if (m_OAMAddrHighEnable) {
-            m_OAMAddr = 0;
-            m_OAMAddr = value;
-            m_OAMAddr <<= 8;
-        }
-        else {
-            m_OAMAddr |= value;
+        m_OAMAddr = value;
+        break;
+    case 0x2004:
+        // Only the Y byte decides which lines a sprite lands on
+        if ((m_OAMAddr & 0x03) == 0 && m_OAMRAM[m_OAMAddr] != value) {
+            m_SpriteLinesDirty = true;
         }
-        m_OAMAddrHighEnable = !m_OAMAddrHighEnable;
+        m_OAMRAM[m_OAMAddr] = value;
+        m_OAMAddr += 1;
         break;
     case 0x2005:
-        m_Scroll = value;
+        if (!m_WriteToggle) {
+            m_T = (m_T & 0xffe0) | (value >> 3);
+            m_FineX = value & 0x07;
+        }
+        else {
+            m_T = (m_T & 0x8c1f) | ((value & 0x07) << 12) | ((value & 0xf8) << 2);
+        }
+        m_WriteToggle = !m_WriteToggle;
         break;
     case 0x2006:
-        if (m_AddrHighEnable) {
-            m_Addr = 0;
-            m_Addr = value;
-            m_Addr <<= 8;
+        if (!m_WriteToggle) {
+            m_T = (m_T & 0x00ff) | ((value & 0x3f) << 8);
         }
         else {
-            m_Addr |= value;
+            m_T = (m_T & 0xff00) | value;
+            m_V = m_T;
         }
-        m_AddrHighEnable = !m_AddrHighEnable;
+        m_WriteToggle = !m_WriteToggle;
+        break;
+    case 0x2007:
+        Write(m_V, value);
+        m_V += (I() == 0) ? 1 : 32;
         break;
     }
 }
 
 uint8_t PPU::ReadRegister(uint16_t address) {
+    Sync();
+
     switch (address) {
-    case 0x2000:
-        return m_Control;
-        break;
     case 0x2002:
-        return m_Status;
-        break;
+    {
+        uint8_t ret = (m_Status & 0xe0) | (m_Latch & 0x1f);
+        if (m_Status & 0x80) {
+            m_StatusChanges++;
+        }
+        m_Status &= ~0x80;
+        m_WriteToggle = false;
+        return ret;
+    }
+    case 0x2004:
+    {
+        uint8_t ret = m_OAMRAM[m_OAMAddr];
+        // Attribute bits 2-4 don't exist
+        if ((m_OAMAddr & 0x03) == 0x02) {
+            ret &= 0xe3;
+        }
+        return ret;
+    }
     case 0x2007:
     {
+        // Reads below the palette come out of a one byte buffer.  Palette reads
+        // are immediate but still refill the buffer with the nametable byte
+        // "underneath" the palette.
+        uint16_t addr = m_V & 0x3fff;
         uint8_t ret = m_Data;
-        m_Data = Read(m_Addr);
 
-        if (I() == 0) {
-            m_Addr += 1;
+        if (addr >= 0x3f00) {
+            ret = Read(addr);
+            m_Data = Read(addr - 0x1000);
         }
         else {
-            m_Addr += 32;
+            m_Data = Read(addr);
         }
 
-        return m_Data;
+        m_V += (I() == 0) ? 1 : 32;
 
-        break;
+        return ret;
     }
     default:
-        assert(0 && "Unimplemented PPU Register Read");
+        // Write only registers read back whatever was last on the bus
+        return m_Latch;
     }
-    return 0;
 }
 
 uint8_t PPU::Read(uint16_t address) {
-    if (address <= 0x1fff) {
-        //if (address < m_ChrRom.size()) {
-        {
-            uint8_t buffered = m_Data;
-            m_Data = m_Map.ReadPPU(address);
-            return  buffered;
+    address &= 0x3fff;
+
+    // Pattern tables and nametables are one page table lookup
+    if (address < 0x3f00) {
+        return m_Map.ReadPPU(address);
+    }
+    else {
+        uint16_t index = address & 0x1f;
+        // $3F10/$3F14/$3F18/$3F1C mirror $3F00/$3F04/$3F08/$3F0C
+        if ((index & 0x13) == 0x10) {
+            index &= 0x0f;
         }
-        assert(0 && "bad chr rom address");
+        return m_Pallette[index];
     }
-    else if (address <= 0x2fff) {
-        uint8_t buffered = m_Data;
-        m_Data = m_VRAM[address - 0x2000];
-        return  buffered;
+}
+
+void PPU::Write(uint16_t address, uint8_t value) {
+    address &= 0x3fff;
+
+    if (address < 0x3f00) {
+        m_Map.WritePPU(address, value);
     }
-    else if (address <= 0x3eff) {
-        assert(0 && "todo");
+    else {
+        uint16_t index = address & 0x1f;
+        if ((index & 0x13) == 0x10) {
+            index &= 0x0f;
+        }
+        m_Pallette[index] = value & 0x3f;
     }
-    else if (address <= 0x3fff) {
-        return m_Pallette[address - 0x3f00];
+}
+
+void PPU::SetAccuracy(Cartridge::PPUAccuracy accuracy) {
+    m_Accuracy = accuracy;
+}
 
+void PPU::AttachClock(const CPUCore6502* cpu) {
+    m_Clock = cpu;
+    m_ClockBase = cpu ? cpu->Cycles() : 0;
+}
+
+void PPU::Sync() {
+    // 3 dots per CPU cycle
+    if (m_Clock != nullptr) {
+        CatchUp((m_Clock->Cycles() - m_ClockBase) * 3);
+    }
+}
+
+void PPU::CatchUp(uint64_t dot) {
+    if (m_Dot > dot) {
+        return;
+    }
+
+    uint64_t start = PerfCounters::Now();
+    uint64_t from = m_Dot;
+    uint8_t status = m_Status;
+
+    if (m_Accuracy == Cartridge::PPUAccuracyDot) {
+        while (m_Dot <= dot) {
+            Step();
+        }
+    }
+    else {
+        while (m_Dot <= dot) {
+            Execute();
+        }
+    }
+
+    // A flag setting and the pre-render line clearing it are at least 20
+    // lines apart, far more than the catch-ups between reads in a polling
+    // loop, so comparing the ends is enough to tell whether a loop saw
+    // $2002 change
+    if (m_Status != status) {
+        m_StatusChanges++;
     }
 
-    assert(0 && "bad PPU address");
-    return 0;
+    uint64_t end = PerfCounters::Now();
+    m_CatchUps++;
+    m_CatchUpNs += end - start;
+    if (Trace::Enabled()) {
+        Trace::Record("PPU catch-up", start, end, (uint32_t)(m_Dot - from));
+    }
+}
+
+uint64_t PPU::NextVBlankDot() const {
+    // Scanline mode sets vblank at the start of the line, dot mode on dot 1
+    uint32_t vblankCycle = (m_Accuracy == Cartridge::PPUAccuracyDot) ? 1 : 0;
+
+    uint32_t lines;
+    if (m_Scanline < kVBlankScanline || (m_Scanline == kVBlankScanline && m_Cycle <= vblankCycle)) {
+        lines = kVBlankScanline - m_Scanline;
+    }
+    else {
+        lines = kScanlinesPerFrame - m_Scanline + kVBlankScanline;
+    }
+    return m_Dot + (uint64_t)lines * kDotsPerScanline + vblankCycle - m_Cycle;
+}
+
+uint64_t PPU::NextStatusChangeDot() const {
+    // Sprite 0 hit and overflow can set anywhere in the picture, until
+    // they're both set
+    bool spriteFlags = RenderingEnabled() && (m_Status & 0x60) != 0x60;
+    uint64_t lineStart = m_Dot - m_Cycle;
+
+    // Both modes change the flags on dot 0 or 1 of the line, so its start is
+    // never late
+    if (m_Scanline < kVBlankScanline) {
+        if (spriteFlags && m_Scanline < kScreenHeight) {
+            return m_Dot;
+        }
+        return lineStart + (uint64_t)(kVBlankScanline - m_Scanline) * kDotsPerScanline;
+    }
+    if (m_Scanline < kPreRenderScanline) {
+        return lineStart + (uint64_t)(kPreRenderScanline - m_Scanline) * kDotsPerScanline;
+    }
+
+    // On the pre-render line, which odd frames cut a dot short
+    if (spriteFlags) {
+        return m_Dot;
+    }
+    return lineStart + (uint64_t)(kScanlinesPerFrame - m_Scanline + kVBlankScanline) * kDotsPerScanline - 1;
+}
+
+bool PPU::RenderingEnabled() const {
+    return (m_Mask & 0x18) != 0;
+}
+
+void PPU::IncrementY() {
+    // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+    if ((m_V & 0x7000) != 0x7000) {
+        m_V += 0x1000;
+    }
+    else {
+        m_V &= ~0x7000;
+        uint16_t y = (m_V & 0x03e0) >> 5;
+        if (y == 29) {
+            y = 0;
+            m_V ^= 0x0800;
+        }
+        else if (y == 31) {
+            y = 0;
+        }
+        else {
+            y += 1;
+        }
+        m_V = (m_V & ~0x03e0) | (y << 5);
+    }
+}
+
+void PPU::CopyHorizontal() {
+    m_V = (m_V & ~0x041f) | (m_T & 0x041f);
+}
+
+void PPU::CopyVertical() {
+    m_V = (m_V & ~0x7be0) | (m_T & 0x7be0);
 }
 
 void PPU::Execute() {
-    struct ExecutionState {
-        uint32_t n;
-        uint32_t m;    
-        uint32_t secondaryOAMIndex;
-        uint32_t scanLine;
-        uint32_t nameTableAddress;
-        uint32_t atttibTableAddress;
-        uint32_t chrAddress;
-    };
-
-    static ExecutionState execState = { 0 };
-    execState.nameTableAddress = 0x2000;
-    execState.atttibTableAddress = 0x23c0;
-    execState.chrAddress = 0;
-
-    // Lets do 1 full scanline per call for now
+    // One full scanline per call
     // 262 scanlines per frame
     // 341 PPU clocks per scanline.  1 CPU clock == 3 PPU clocks
     //
     // https://www.nesdev.org/wiki/PPU_rendering
     //
 
+    // Dot mode, or switched out of it partway through a line
+    if (m_Accuracy == Cartridge::PPUAccuracyDot || m_Cycle != 0) {
+        uint32_t line = m_Scanline;
+        while (m_Scanline == line) {
+            Step();
+        }
+        return;
+    }
+
+    if (m_Scanline < kScreenHeight) {
+        if (m_SkipRender) {
+            SkipScanline(m_Scanline);
+        }
+        else {
+            TraceSpan span("Render scanline");
+            span.SetCount(m_Scanline);
+            RenderScanline(m_Scanline);
+        }
+
+        if (RenderingEnabled()) {
+            IncrementY();       // dot 256
+            CopyHorizontal();   // dot 257
+        }
+    }
+    else if (m_Scanline == kVBlankScanline) {
+        m_Status |= 0x80;
+        if (m_Control & 0x80) {
+            m_NMIPending = true;
+        }
+        m_FrameCount++;
+        m_Frame->Number = m_FrameCount;
+    }
+    else if (m_Scanline == kPreRenderScanline) {
+        // Clear vblank, sprite 0 hit and overflow
+        m_Status &= ~0xe0;
+
+        if (RenderingEnabled()) {
+            CopyHorizontal();
+            CopyVertical();     // dots 280-304
+        }
+    }
+
+    m_Dot += kDotsPerScanline;
+    m_Scanline++;
+    if (m_Scanline == kScanlinesPerFrame) {
+        m_Scanline = 0;
+    }
+}
+
+void PPU::RenderScanline(uint32_t y) {
+    uint8_t* out = &m_Frame->Pixels[y * kScreenWidth];
+    m_Frame->LineEmphasis[y] = m_Mask >> 5;
+
+    if (!RenderingEnabled()) {
+        memset(out, m_Pallette[0], kScreenWidth);
+        return;
+    }
+
+    // Background entries are palette addresses 0-15 with 0 == transparent.
+    // Sprite entries are palette addresses 16-31 in the low 5 bits, bit 6 set
+    // for behind background and bit 7 set for sprite 0.
+    uint8_t bg[kScreenWidth];
+    uint8_t sprites[kScreenWidth];
+
+    if (m_Mask & 0x08) {
+        RenderBackground(bg);
+        if (!(m_Mask & 0x02)) {
+            memset(bg, 0, 8);
+        }
+    }
+    else {
+        memset(bg, 0, sizeof(bg));
+    }
+
+    SpriteOverflow(y);
+
+    memset(sprites, 0, sizeof(sprites));
+    if (m_Mask & 0x10) {
+        RenderSprites(y, sprites);
+        if (!(m_Mask & 0x04)) {
+            memset(sprites, 0, 8);
+        }
+    }
+
+    // Sprite 0 hit never happens at x=255
+    // https://www.nesdev.org/wiki/PPU_OAM#Sprite_zero_hits
+    sprites[255] &= 0x7f;
+
+    uint8_t greyscale = (m_Mask & 0x01) ? 0x30 : 0x3f;
+    bool hit = m_Composite(bg, sprites, m_Pallette, greyscale, out, kScreenWidth);
+
+    if (hit) {
+        m_Status |= 0x40;
+    }
+}
+
+void PPU::RenderBackground(uint8_t* row) {
+    // Fetch 33 tiles starting at v and drop the first fine X pixels
+    uint8_t pixels[33 * 8];
+
+    uint16_t v = m_V;
+    uint32_t patternBase = (m_Control & 0x10) ? 256 : 0;
+    uint32_t fineY = (v >> 12) & 0x07;
+
+    for (uint32_t tile = 0; tile < 33; tile++) {
+        uint8_t nameTableIndex = m_Map.ReadPPU(0x2000 | (v & 0x0fff));
+        uint8_t attribute = m_Map.ReadPPU(0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+
+        uint8_t shift = ((v >> 4) & 0x04) | (v & 0x02);
+        uint8_t palette = ((attribute >> shift) & 0x03) << 2;
+
+        // Pixels are 0-3, or in the palette bits wherever they aren't 0
+        uint64_t pixels8;
+        memcpy(&pixels8, m_TileCache.Row(patternBase + nameTableIndex, fineY), 8);
+        uint64_t opaque = (pixels8 | (pixels8 >> 1)) & 0x0101010101010101ull;
+        pixels8 |= opaque * palette;
+        memcpy(&pixels[tile * 8], &pixels8, 8);
+
+        // Coarse X increment, wrapping into the next horizontal nametable
+        if ((v & 0x001f) == 31) {
+            v &= ~0x001f;
+            v ^= 0x0400;
+        }
+        else {
+            v += 1;
+        }
+    }
+
+    memcpy(row, &pixels[m_FineX], kScreenWidth);
+}
+
+void PPU::RenderSprites(uint32_t y, uint8_t* row) {
     // OAM == sprite
-    //  4 bytes == [x, y, color, tile] for each of the 64 sprites
+    //  4 bytes == [y, tile, attributes, x] for each of the 64 sprites
+    //  y is one less than the first line the sprite shows up on
     //
+    // https://www.nesdev.org/wiki/PPU_OAM
+    // https://www.nesdev.org/wiki/PPU_sprite_evaluation
 
-    // nametable == background == [tile, x, y]
-    //   8x8 pixels per file
-    //   256x240 pixels == 32x30 tiles
-    //
+    if (m_SpriteLinesDirty) {
+        BucketSprites();
+    }
+
+    const SpriteLine& sprites = m_SpriteLines[y];
+    uint32_t count = sprites.Count;
+    bool sprite0 = count != 0 && sprites.Sprites[0] == 0;
+
+    memset(m_SecondaryOAMRAM, 0xff, sizeof(m_SecondaryOAMRAM));
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(&m_SecondaryOAMRAM[i * 4], &m_OAMRAM[sprites.Sprites[i] * 4], 4);
+    }
 
-    // palette == 32 bytes
-    //  4 background palettes
-    //  4 sprite palettes
-    //  3 colors each + transparency, PPU can drawn 25 unique colors
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* sprite = &m_SecondaryOAMRAM[i * 4];
+        uint8_t attributes = sprite[2];
+        uint32_t x = sprite[3];
 
+        const uint8_t* pixels = SpriteRow(sprite, y);
 
-    uint8_t nameTableIndex = 0;
-    uint8_t attributeTableIndex = 0;
-    uint8_t bgLow = 0;
-    uint8_t bgHigh = 0;
+        uint8_t flags = 0x10 | ((attributes & 0x03) << 2);
+        if (attributes & 0x20) {
+            flags |= 0x40;
+        }
+        if (i == 0 && sprite0) {
+            flags |= 0x80;
+        }
 
-    for(m_Cycle=0; m_Cycle<341; m_Cycle++) {
-        // There are 3 cycles of the PPU for each CPU cycle
+        for (uint32_t b = 0; b < 8 && x + b < kScreenWidth; b++) {
+            uint8_t pixel = pixels[b];
 
-        if(m_Cycle % 1 == 0) {
-            uint32_t c = m_Cycle % 8;
+            // Lower OAM index wins, even when it's behind the background
+            if (pixel && !(row[x + b] & 0x03)) {
+                row[x + b] = flags | pixel;
+            }
+        }
+    }
+}
 
-            switch(c) {
-            case 0:
-                break;
-            case 1:
-                nameTableIndex = Read(execState.nameTableAddress);
-                execState.nameTableAddress += 1;
-                break;
-            case 2:
-                // 2nd cycle of nametable address read
-                break;
-            case 3:
-                attributeTableIndex = Read(execState.atttibTableAddress);
-                execState.atttibTableAddress += 1;
-                break;
-            case 4:
-                // 2nd cycle of attribute table fetch;
-                break;
-            case 5:
-                execState.chrAddress = nameTableIndex;
-                bgLow = m_Map.ReadPPU(execState.chrAddress);
-                execState.chrAddress += 1;
-                break;
-            case 6:
-                // 2nd cycle of bgLow read
-                break;
-            case 7:
-                bgHigh = m_Map.ReadPPU(execState.chrAddress);
-                execState.chrAddress += 1;
-                break;
-            case 8:
+const uint8_t* PPU::SpriteRow(const uint8_t* sprite, uint32_t y) {
+    // The 8 pixels of an in range OAM entry on line y, flips applied
+    uint32_t height = (m_Control & 0x20) ? 16 : 8;
+    uint8_t tile = sprite[1];
+    uint8_t attributes = sprite[2];
 
+    uint32_t line = y - 1 - sprite[0];
+    if (attributes & 0x80) {
+        line = height - 1 - line;
+    }
 
-                // TODO: inc horiv
-                break;
+    uint32_t tileIndex;
+    if (height == 16) {
+        tileIndex = ((tile & 0x01) << 8) | (tile & 0xfe);
+        if (line >= 8) {
+            tileIndex += 1;
+            line -= 8;
+        }
+    }
+    else {
+        tileIndex = ((m_Control & 0x08) ? 256 : 0) | tile;
+    }
+
+    return (attributes & 0x40) ?
+        m_TileCache.RowFlipped(tileIndex, line) :
+        m_TileCache.Row(tileIndex, line);
+}
+
+// Sprites are evaluated whenever rendering is on, shown or not, so
+// overflow can set with only the background enabled
+void PPU::SpriteOverflow(uint32_t y) {
+    if (m_SpriteLinesDirty) {
+        BucketSprites();
+    }
+
+    if (m_SpriteLines[y].Overflow) {
+        m_Status |= 0x20;
+    }
+}
+
+void PPU::SkipScanline(uint32_t y) {
+    // No pixels, only what the CPU can see: sprite overflow and sprite 0 hit,
+    // under the same conditions RenderScanline sets them.  Hit only looks at
+    // the 8 pixels under sprite 0, and only until it's found.
+    if (!RenderingEnabled()) {
+        return;
+    }
+
+    SpriteOverflow(y);
+
+    const SpriteLine& sprites = m_SpriteLines[y];
+    if ((m_Status & 0x40) || (m_Mask & 0x18) != 0x18 || sprites.Count == 0 || sprites.Sprites[0] != 0) {
+        return;
+    }
+
+    const uint8_t* pixels = SpriteRow(&m_OAMRAM[0], y);
+    uint32_t left = m_OAMRAM[3];
+    bool clipped = (m_Mask & 0x06) != 0x06;
+
+    for (uint32_t b = 0; b < 8; b++) {
+        uint32_t x = left + b;
+        // Never at x=255
+        if (x >= kScreenWidth - 1) {
+            break;
+        }
+        if (!pixels[b] || (x < 8 && clipped)) {
+            continue;
+        }
+        if (BackgroundPixel(x)) {
+            m_Status |= 0x40;
+            break;
+        }
+    }
+}
+
+uint8_t PPU::BackgroundPixel(uint32_t x) {
+    // Same walk as RenderBackground, for a single pixel
+    uint32_t offset = m_FineX + x;
+    uint16_t v = m_V;
+    uint32_t coarseX = (v & 0x001f) + (offset >> 3);
+    if (coarseX >= 32) {
+        coarseX -= 32;
+        v ^= 0x0400;
+    }
+    v = (v & ~0x001f) | coarseX;
+
+    uint8_t nameTableIndex = m_Map.ReadPPU(0x2000 | (v & 0x0fff));
+    uint32_t patternBase = (m_Control & 0x10) ? 256 : 0;
+    return m_TileCache.Row(patternBase + nameTableIndex, (v >> 12) & 0x07)[offset & 0x07];
+}
+
+void PPU::BucketSprites() {
+    // Same outcome as the per line evaluation: OAM order, the first 8 sprites
+    // in range are drawn and a 9th sets overflow.  The hardware's diagonal
+    // overflow scan bug isn't modelled.
+    uint32_t height = (m_Control & 0x20) ? 16 : 8;
+
+    for (uint32_t y = 0; y < kScreenHeight; y++) {
+        m_SpriteLines[y].Count = 0;
+        m_SpriteLines[y].Overflow = false;
+    }
+
+    for (uint32_t n = 0; n < 64; n++) {
+        uint32_t top = m_OAMRAM[n * 4] + 1;
+
+        for (uint32_t y = top; y < top + height && y < kScreenHeight; y++) {
+            SpriteLine& line = m_SpriteLines[y];
+            if (line.Count == 8) {
+                line.Overflow = true;
+                continue;
             }
+            line.Sprites[line.Count++] = (uint8_t)n;
         }
     }
 
-/*
-        } else if((m_Cycle >= 1) && (m_Cycle <= 64) {
-            // Initialize secondary OAM to 0xff - 32 bytes over 64 clocks
-            uint32_t index = ((m_Cycle-1) / 2);
-            m_SecondaryOAMRAM[index] = 0xff;
-        
-        } else if((m_Cycle >= 65) && (m_Cycle <= 300)) {
-            uint16_t nametableAddr = m_Cycle - 65;
+    m_SpriteLinesDirty = false;
+}
 
-            // Nametable
-            uint32_t entry = Read(0x2000 + nametableAddr);
+void PPU::Step() {
+    uint32_t line = m_Scanline;
+    uint32_t cycle = m_Cycle;
+    bool visible = line < kScreenHeight;
+    bool preRender = line == kPreRenderScanline;
 
+    if (visible || preRender) {
+        if (preRender && cycle == 1) {
+            // Clear vblank, sprite 0 hit and overflow
+            m_Status &= ~0xe0;
+        }
 
-            // On odd cycles data is read from OAM
-            // On even cycles data is secondary OAM
+        if (RenderingEnabled()) {
+            if ((cycle >= 2 && cycle <= 257) || (cycle >= 322 && cycle <= 337)) {
+                m_PatternShiftLow <<= 1;
+                m_PatternShiftHigh <<= 1;
+                m_AttributeShiftLow <<= 1;
+                m_AttributeShiftHigh <<= 1;
+            }
 
-            // Copy Y coordinate into secondary OAM
-            m_SecondaryOAMRAM[execState.secondaryOAMIndex] = m_OAMRAM[execState.n * 64 + 0];
+            if ((cycle >= 1 && cycle <= 256) || (cycle >= 321 && cycle <= 336)) {
+                FetchBackground(cycle);
+            }
 
-            if( true Y coordinate is in range...) {
-                // Copy remaining attributes
-                m_SecondaryOAMRAM[execState.secondaryOAMIndex] = m_OAMRAM[execState.n * 64 + 1];
+            if (cycle == 256) {
+                IncrementY();
+            }
+            else if (cycle == 257) {
+                CopyHorizontal();
+            }
+            else if (preRender && cycle >= 280 && cycle <= 304) {
+                CopyVertical();
             }
 
-            execState.n += 1;
+            if (visible && cycle >= 1 && cycle <= 256) {
+                EvaluateSprite(line, cycle);
+            }
+
+            if (cycle >= 257 && cycle <= 320) {
+                // OAMADDR is held at 0 through the sprite fetches
+                m_OAMAddr = 0;
+
+                if (((cycle - 257) & 0x07) == 7) {
+                    FetchSprite(line, (cycle - 257) >> 3);
+                }
+            }
+        }
+
+        if (visible && cycle >= 1 && cycle <= 256) {
+            OutputPixel(cycle - 1, line);
+        }
+    }
+    else if (line == kVBlankScanline && cycle == 1) {
+        m_Status |= 0x80;
+        if (m_Control & 0x80) {
+            m_NMIPending = true;
+        }
+        m_FrameCount++;
+        m_Frame->Number = m_FrameCount;
+    }
+
+    m_Dot++;
+    m_Cycle++;
+
+    // Odd frames drop the last dot of the pre-render line when rendering
+    // https://www.nesdev.org/wiki/PPU_frame_timing#Even/Odd_Frames
+    if (preRender && m_Cycle == kDotsPerScanline - 1 && m_OddFrame && RenderingEnabled()) {
+        m_Cycle = kDotsPerScanline;
+    }
+
+    if (m_Cycle == kDotsPerScanline) {
+        m_Cycle = 0;
+        m_Scanline++;
+        if (m_Scanline == kScanlinesPerFrame) {
+            m_Scanline = 0;
+            m_OddFrame = !m_OddFrame;
         }
     }
-*/
 }
 
-}
\ No newline at end of file
+void PPU::FetchBackground(uint32_t cycle) {
+    // Each tile takes 8 dots: nametable, attribute, pattern low, pattern high,
+    // two dots per access.  The fetched tile is loaded into the low byte of the
+    // shift registers 8 dots later.
+    switch ((cycle - 1) & 0x07) {
+    case 0:
+        m_PatternShiftLow = (m_PatternShiftLow & 0xff00) | m_NextPatternLow;
+        m_PatternShiftHigh = (m_PatternShiftHigh & 0xff00) | m_NextPatternHigh;
+        m_AttributeShiftLow = (m_AttributeShiftLow & 0xff00) | ((m_NextAttribute & 0x01) ? 0xff : 0x00);
+        m_AttributeShiftHigh = (m_AttributeShiftHigh & 0xff00) | ((m_NextAttribute & 0x02) ? 0xff : 0x00);
+
+        m_NextTile = m_Map.ReadPPU(0x2000 | (m_V & 0x0fff));
+        break;
+    case 2:
+    {
+        // https://www.nesdev.org/wiki/PPU_scrolling#Tile_and_attribute_fetching
+        uint8_t attribute = m_Map.ReadPPU(0x23c0 | (m_V & 0x0c00) | ((m_V >> 4) & 0x38) | ((m_V >> 2) & 0x07));
+        if (m_V & 0x0040) {
+            attribute >>= 4;
+        }
+        if (m_V & 0x0002) {
+            attribute >>= 2;
+        }
+        m_NextAttribute = attribute & 0x03;
+        break;
+    }
+    case 4:
+    {
+        uint16_t address = ((m_Control & 0x10) ? 0x1000 : 0) | (m_NextTile << 4) | ((m_V >> 12) & 0x07);
+        m_NextPatternLow = m_Map.ReadPPU(address);
+        break;
+    }
+    case 6:
+    {
+        uint16_t address = ((m_Control & 0x10) ? 0x1000 : 0) | (m_NextTile << 4) | ((m_V >> 12) & 0x07);
+        m_NextPatternHigh = m_Map.ReadPPU(address + 8);
+        break;
+    }
+    case 7:
+        IncrementX();
+        break;
+    }
+}
+
+void PPU::IncrementX() {
+    // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+    if ((m_V & 0x001f) == 31) {
+        m_V &= ~0x001f;
+        m_V ^= 0x0400;
+    }
+    else {
+        m_V += 1;
+    }
+}
+
+void PPU::EvaluateSprite(uint32_t line, uint32_t cycle) {
+    // Dots 1-64 clear secondary OAM, 65-256 look for the sprites on the next
+    // line.  Checking a sprite takes 2 dots and copying one that's in range
+    // another 6.  The hardware's buggy overflow scan after the 8th sprite
+    // isn't modelled; the 9th sprite in range just sets the flag.
+    // https://www.nesdev.org/wiki/PPU_sprite_evaluation
+    if (cycle <= 64) {
+        if (!(cycle & 0x01)) {
+            m_SecondaryOAMRAM[(cycle >> 1) - 1] = 0xff;
+        }
+        return;
+    }
+
+    if (cycle == 65) {
+        m_EvalSprite = 0;
+        m_EvalCount = 0;
+        m_EvalDelay = 0;
+        m_EvalSprite0 = false;
+    }
+
+    if (m_EvalDelay != 0) {
+        m_EvalDelay--;
+        return;
+    }
+
+    if (!(cycle & 0x01) || m_EvalSprite >= 64) {
+        return;
+    }
+
+    uint32_t height = (m_Control & 0x20) ? 16 : 8;
+    uint32_t n = m_EvalSprite++;
+    const uint8_t* sprite = &m_OAMRAM[n * 4];
+
+    if (line - sprite[0] >= height) {
+        return;
+    }
+
+    if (m_EvalCount == 8) {
+        m_Status |= 0x20;
+        m_EvalSprite = 64;
+        return;
+    }
+
+    memcpy(&m_SecondaryOAMRAM[m_EvalCount * 4], sprite, 4);
+    if (n == 0) {
+        m_EvalSprite0 = true;
+    }
+    m_EvalCount++;
+    m_EvalDelay = 6;
+}
+
+void PPU::FetchSprite(uint32_t line, uint32_t slot) {
+    // Dots 257-320, 8 per slot, load the sprites for the next line
+    if (slot == 0) {
+        m_SpriteCount = (line < kScreenHeight) ? m_EvalCount : 0;
+        m_Sprite0Loaded = (line < kScreenHeight) && m_EvalSprite0;
+    }
+
+    const uint8_t* sprite = &m_SecondaryOAMRAM[slot * 4];
+    uint8_t tile = sprite[1];
+    uint8_t attributes = sprite[2];
+    uint32_t height = (m_Control & 0x20) ? 16 : 8;
+
+    // Empty slots fetch tile $FF, which still shows up on the bus
+    uint32_t row = (slot < m_SpriteCount) ? line - sprite[0] : 0;
+    if (attributes & 0x80) {
+        row = height - 1 - row;
+    }
+
+    uint16_t address;
+    if (height == 16) {
+        address = ((tile & 0x01) << 12) | ((tile & 0xfe) << 4);
+        if (row >= 8) {
+            address += 16;
+            row -= 8;
+        }
+    }
+    else {
+        address = ((m_Control & 0x08) ? 0x1000 : 0) | (tile << 4);
+    }
+    address |= row & 0x07;
+
+    uint8_t low = m_Map.ReadPPU(address);
+    uint8_t high = m_Map.ReadPPU(address + 8);
+
+    if (slot >= m_SpriteCount) {
+        return;
+    }
+
+    if (attributes & 0x40) {
+        // Reverse the bits so bit 7 is always the leftmost pixel
+        low = (uint8_t)(((low * 0x0802u & 0x22110u) | (low * 0x8020u & 0x88440u)) * 0x10101u >> 16);
+        high = (uint8_t)(((high * 0x0802u & 0x22110u) | (high * 0x8020u & 0x88440u)) * 0x10101u >> 16);
+    }
+
+    m_SpritePatternLow[slot] = low;
+    m_SpritePatternHigh[slot] = high;
+    m_SpriteAttributes[slot] = attributes;
+    m_SpriteX[slot] = sprite[3];
+}
+
+void PPU::OutputPixel(uint32_t x, uint32_t y) {
+    // Skipping, only sprite 0 hit is left to look for
+    if (m_SkipRender && (!m_Sprite0Loaded || (m_Status & 0x40))) {
+        return;
+    }
+
+    uint8_t* out = &m_Frame->Pixels[y * kScreenWidth + x];
+    if (x == 0) {
+        m_Frame->LineEmphasis[y] = m_Mask >> 5;
+    }
+
+    if (!RenderingEnabled()) {
+        if (!m_SkipRender) {
+            *out = m_Pallette[0];
+        }
+        return;
+    }
+
+    uint8_t bgPixel = 0;
+    uint8_t bgPalette = 0;
+
+    if ((m_Mask & 0x08) && (x >= 8 || (m_Mask & 0x02))) {
+        uint16_t bit = 0x8000 >> m_FineX;
+        bgPixel = ((m_PatternShiftLow & bit) ? 1 : 0) | ((m_PatternShiftHigh & bit) ? 2 : 0);
+        bgPalette = ((m_AttributeShiftLow & bit) ? 1 : 0) | ((m_AttributeShiftHigh & bit) ? 2 : 0);
+    }
+
+    uint8_t spritePixel = 0;
+    uint8_t spriteAttributes = 0;
+    bool sprite0 = false;
+
+    if ((m_Mask & 0x10) && (x >= 8 || (m_Mask & 0x04))) {
+        // Lowest slot with an opaque pixel wins, even behind the background
+        for (uint32_t i = 0; i < m_SpriteCount; i++) {
+            uint32_t offset = x - m_SpriteX[i];
+            if (offset >= 8) {
+                continue;
+            }
+
+            uint8_t shift = 7 - offset;
+            uint8_t pixel = ((m_SpritePatternLow[i] >> shift) & 0x01) | (((m_SpritePatternHigh[i] >> shift) & 0x01) << 1);
+            if (pixel != 0) {
+                spritePixel = pixel;
+                spriteAttributes = m_SpriteAttributes[i];
+                sprite0 = (i == 0) && m_Sprite0Loaded;
+                break;
+            }
+        }
+    }
+
+    if (sprite0 && bgPixel && x != 255) {
+        m_Status |= 0x40;
+    }
+
+    uint8_t addr = 0;
+    if (spritePixel && (!bgPixel || !(spriteAttributes & 0x20))) {
+        addr = 0x10 | ((spriteAttributes & 0x03) << 2) | spritePixel;
+    }
+    else if (bgPixel) {
+        addr = (bgPalette << 2) | bgPixel;
+    }
+
+    if (m_SkipRender) {
+        return;
+    }
+
+    uint8_t greyscale = (m_Mask & 0x01) ? 0x30 : 0x3f;
+    *out = m_Pallette[addr] & greyscale;
+}
+
+}
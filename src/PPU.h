@@ -1,51 +1,289 @@
+#pragma once
+
+#include "Cartridge.h"
+#include "Compositor.h"
 #include "MemoryMap.h"
+#include "TileCache.h"
 
 #include <vector>
 
 namespace raunnes {
+class CPUCore6502;
+
+// Runs lazily: nothing happens until a register access or the driver asks for
+// a point in time, then every scanline up to there runs in one batch.
 class PPU {
+public:
+    static const uint32_t kScreenWidth = 256;
+    static const uint32_t kScreenHeight = 240;
+
+    static const uint32_t kDotsPerScanline = 341;
+    static const uint32_t kScanlinesPerFrame = 262;
+    static const uint32_t kVBlankScanline = 241;
+    static const uint32_t kPreRenderScanline = 261;
+
+    // One rendered picture: color indices plus the $2001 emphasis bits (5-7,
+    // shifted down) each line was drawn with
+    struct Frame {
+        uint8_t Pixels[kScreenWidth * kScreenHeight];
+        uint8_t LineEmphasis[kScreenHeight];
+        uint64_t Number;        // FrameCount() when it was completed
+    };
+
+    // Registers, memory and pipeline, for snapshots.  Defined below.
+    struct State;
+
 public:
     PPU(MemoryMap& memory);
     ~PPU();
-    
+
     uint8_t I() const;
 
     void WriteRegister(uint16_t address, uint8_t value);
     uint8_t ReadRegister(uint16_t address);
 
     uint8_t Read(uint16_t address);
+    void Write(uint16_t address, uint8_t value);
+
+    // Scanline mode (the default) renders a whole line at its start; dot mode
+    // runs the fetch pipeline a dot at a time.  Best switched between frames.
+    void SetAccuracy(Cartridge::PPUAccuracy accuracy);
+    Cartridge::PPUAccuracy Accuracy() const { return m_Accuracy; }
 
+    // Runs one full scanline
     void Execute();
 
+    // Register accesses catch up to cpu's current cycle first.  The CPU's
+    // cycle count when attached is PPU dot 0.
+    void AttachClock(const CPUCore6502* cpu);
+
+    // Runs every scanline starting at or before dot
+    void CatchUp(uint64_t dot);
+
+    // Next dot to run, in dots since power on.  In scanline mode always the
+    // start of a scanline.
+    uint64_t Dot() const { return m_Dot; }
+
+    // Dot the next vblank (and its NMI) starts on
+    uint64_t NextVBlankDot() const;
+
+    // Earliest dot $2002 could read differently without a register write:
+    // vblank starting, the pre-render line clearing the flags, or sprite 0
+    // hit / overflow setting while the picture is drawn.  Conservative, the
+    // current dot when it can't tell.
+    uint64_t NextStatusChangeDot() const;
+
+    // Bumped whenever a catch-up or a read changes what $2002 returns
+    uint32_t StatusChanges() const { return m_StatusChanges; }
+
+    // Catch-ups that had work to do since the last call, and the host time
+    // they took, for the performance counters
+    void TakeCatchUps(uint32_t& count, uint64_t& ns) {
+        count = m_CatchUps;
+        ns = m_CatchUpNs;
+        m_CatchUps = 0;
+        m_CatchUpNs = 0;
+    }
+
+    // Set when vblank starts with NMI enabled, cleared by reading it
+    bool TakeNMI() {
+        bool nmi = m_NMIPending;
+        m_NMIPending = false;
+        return nmi;
+    }
+
+    uint32_t Scanline() const { return m_Scanline; }
+    uint64_t FrameCount() const { return m_FrameCount; }
+
+    // 256x240 NES color indices (0-63), complete once FrameCount() ticks
+    const uint8_t* FrameBuffer() const { return m_Frame->Pixels; }
+    const uint8_t* LineEmphasis() const { return m_Frame->LineEmphasis; }
+
+    // Renders into frame instead of the PPU's own, nullptr goes back to it.
+    // Swapped at vblank to hand frames off without copying them.
+    void SetFrame(Frame* frame) { m_Frame = frame ? frame : &m_OwnFrame; }
+    Frame& CurrentFrame() { return *m_Frame; }
+
+    // Skips pixel output and compositing, e.g. for fast forward.  vblank /
+    // NMI timing, sprite 0 hit and sprite overflow still happen when they
+    // would have; the frame buffer is left as it was.  Takes effect from the
+    // next scanline, so it can change every frame.
+    void SetSkipRender(bool skip) { m_SkipRender = skip; }
+    bool SkipRender() const { return m_SkipRender; }
+
+    // The frame being drawn into and the settings (accuracy, skip render,
+    // composite kernel) aren't part of the state
+    void SaveState(State& state) const;
+    void LoadState(const State& state);
+
+    // For the debugger
+    TileCache& Tiles() { return m_TileCache; }
+    const uint8_t* OAM() const { return m_OAMRAM; }
+    uint8_t Control() const { return m_Control; }
+
+    // Defaults to the widest kernel the host supports, false if kernel isn't
+    // available here
+    bool SetCompositeKernel(CompositeKernel kernel);
+    CompositeKernel GetCompositeKernel() const { return m_CompositeKernel; }
+
 public:
     PPU(const PPU&) = delete;
     PPU& operator=(const PPU&) = delete;
 
+private:
+    bool RenderingEnabled() const;
+
+    void RenderScanline(uint32_t y);
+    void RenderBackground(uint8_t* row);
+    void RenderSprites(uint32_t y, uint8_t* row);
+    void SpriteOverflow(uint32_t y);
+    void BucketSprites();
+    const uint8_t* SpriteRow(const uint8_t* sprite, uint32_t y);
+
+    void SkipScanline(uint32_t y);
+    uint8_t BackgroundPixel(uint32_t x);
+
+    // Dot mode
+    // https://www.nesdev.org/wiki/PPU_rendering
+    void Step();
+    void FetchBackground(uint32_t cycle);
+    void EvaluateSprite(uint32_t line, uint32_t cycle);
+    void FetchSprite(uint32_t line, uint32_t slot);
+    void OutputPixel(uint32_t x, uint32_t y);
+    void IncrementX();
+
+    void Sync();
+
+    void IncrementY();
+    void CopyHorizontal();
+    void CopyVertical();
+
 private:
     MemoryMap& m_Map;
-    uint32_t m_Cycle;
+    TileCache m_TileCache;
+    CompositeKernel m_CompositeKernel;
+    CompositeFunction m_Composite;
+    const CPUCore6502* m_Clock;
+    uint64_t m_ClockBase;
+    uint64_t m_Dot;
+    uint32_t m_Scanline;
+    uint64_t m_FrameCount;
+    bool m_NMIPending;
+    uint32_t m_CatchUps;
+    uint64_t m_CatchUpNs;
+    uint32_t m_StatusChanges;
 
     uint8_t m_Control;      // 	$2000 	VPHB SINN 	NMI enable(V), PPU master / slave(P), sprite height(H), background tile select(B), sprite tile select(S), increment mode(I), nametable select(NN)
     uint8_t m_Mask;         // 	$2001 	BGRs bMmG 	color emphasis(BGR), sprite enable(s), background enable(b), sprite left column enable(M), background left column enable(m), greyscale(G)
     uint8_t m_Status;       // 	$2002 	VSO - ----vblank(V), sprite 0 hit(S), sprite overflow(O); read resets write pair for $2005 / $2006
-    
+
     uint8_t m_OAMAddr;      // 	$2003 	aaaa aaaa 	OAM read / write address
-    bool    m_OAMAddrHighEnable;
     uint8_t m_OAMData;      // 	$2004 	dddd dddd 	OAM data read / write
-    
-    uint8_t m_Scroll;       // 	$2005 	xxxx xxxx 	fine scroll position(two writes : X scroll, Y scroll)
-    
-    uint16_t m_Addr;         // 	$2006 	aaaa aaaa 	PPU read / write address(two writes : most significant byte, least significant byte)
-    bool     m_AddrHighEnable;
+
+    // $2005 / $2006 share the internal scroll registers
+    // https://www.nesdev.org/wiki/PPU_scrolling
+    uint16_t m_V;           // current VRAM address  yyy NN YYYYY XXXXX
+    uint16_t m_T;           // temporary VRAM address, top left onscreen tile
+    uint8_t  m_FineX;       // fine X scroll
+    bool     m_WriteToggle; // first / second write of $2005 / $2006
 
     uint8_t m_Data;         // 	$2007 	dddd dddd 	PPU data read / write
     uint8_t m_OMADMA;       // 	$4014 	aaaa aaaa 	OAM DMA high address
+    uint8_t m_Latch;        // last value written to any register, returned for write only ones
 
     uint8_t m_Pallette[32];
-    uint8_t m_VRAM[2048];
     uint8_t m_OAMRAM[256];
 
     uint8_t m_SecondaryOAMRAM[32];
+
+    // Sprites in range of each visible scanline, rebuilt from OAM when it or
+    // the sprite height changes instead of evaluating all 64 per line
+    struct SpriteLine {
+        uint8_t Count;
+        bool Overflow;          // a 9th sprite was in range
+        uint8_t Sprites[8];     // OAM indices, lowest first
+    };
+    SpriteLine m_SpriteLines[kScreenHeight];
+    bool m_SpriteLinesDirty;
+
+    bool m_SkipRender;
+
+    // Dot mode pipeline state
+    Cartridge::PPUAccuracy m_Accuracy;
+    uint32_t m_Cycle;               // dot within the scanline, 0-340
+    bool m_OddFrame;                // odd frames skip a dot when rendering
+
+    uint8_t m_NextTile;             // background latches, loaded every 8 dots
+    uint8_t m_NextAttribute;
+    uint8_t m_NextPatternLow;
+    uint8_t m_NextPatternHigh;
+    uint16_t m_PatternShiftLow;     // background shift registers, bit 15 is
+    uint16_t m_PatternShiftHigh;    // the pixel at fine X 0
+    uint16_t m_AttributeShiftLow;
+    uint16_t m_AttributeShiftHigh;
+
+    uint32_t m_EvalSprite;          // next OAM entry sprite evaluation looks at
+    uint32_t m_EvalCount;           // sprites found in range
+    uint32_t m_EvalDelay;           // dots left copying the last one found
+    bool m_EvalSprite0;             // sprite 0 is in secondary OAM slot 0
+
+    uint32_t m_SpriteCount;         // sprites loaded for this scanline
+    bool m_Sprite0Loaded;
+    uint8_t m_SpritePatternLow[8];  // already flipped horizontally, bit 7 first
+    uint8_t m_SpritePatternHigh[8];
+    uint8_t m_SpriteAttributes[8];
+    uint8_t m_SpriteX[8];
+
+    Frame m_OwnFrame;
+    Frame* m_Frame;
+};
+
+struct PPU::State {
+    uint64_t ClockBase;
+    uint64_t Dot;
+    uint32_t Scanline;
+    uint64_t FrameCount;
+    bool NMIPending;
+
+    uint8_t Control;
+    uint8_t Mask;
+    uint8_t Status;
+    uint8_t OAMAddr;
+    uint8_t OAMData;
+    uint16_t V;
+    uint16_t T;
+    uint8_t FineX;
+    bool WriteToggle;
+    uint8_t Data;
+    uint8_t OMADMA;
+    uint8_t Latch;
+
+    uint8_t Pallette[32];
+    uint8_t OAMRAM[256];
+    uint8_t SecondaryOAMRAM[32];
+
+    uint32_t Cycle;
+    bool OddFrame;
+    uint8_t NextTile;
+    uint8_t NextAttribute;
+    uint8_t NextPatternLow;
+    uint8_t NextPatternHigh;
+    uint16_t PatternShiftLow;
+    uint16_t PatternShiftHigh;
+    uint16_t AttributeShiftLow;
+    uint16_t AttributeShiftHigh;
+
+    uint32_t EvalSprite;
+    uint32_t EvalCount;
+    uint32_t EvalDelay;
+    bool EvalSprite0;
+
+    uint32_t SpriteCount;
+    bool Sprite0Loaded;
+    uint8_t SpritePatternLow[8];
+    uint8_t SpritePatternHigh[8];
+    uint8_t SpriteAttributes[8];
+    uint8_t SpriteX[8];
 };
 
-}
\ No newline at end of file
+}
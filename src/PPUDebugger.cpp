@@ -0,0 +1,133 @@
+#include "PPUDebugger.h"
+
+#include "PPU.h"
+
+#include <cstring>
+
+namespace raunnes {
+
+PPUDebugger::PPUDebugger() :
+    m_Requested(false),
+    m_PatternPalette(0) {
+}
+
+PPUDebugger::~PPUDebugger() {
+}
+
+void PPUDebugger::Update(PPU& ppu, uint64_t frame) {
+    if (!m_Requested.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    Snapshot& snapshot = m_Snapshots.Back();
+
+    for (uint32_t i = 0; i < 32; i++) {
+        snapshot.Palette[i] = ppu.Read(0x3f00 + i);
+    }
+
+    CaptureNameTables(ppu, snapshot.NameTables);
+    CapturePatternTables(ppu, &snapshot.Palette[m_PatternPalette.load(std::memory_order_relaxed) * 4], snapshot.PatternTables);
+    CaptureSprites(ppu, &snapshot.Palette[16], snapshot.Sprites);
+    snapshot.Frame = frame;
+
+    m_Snapshots.Publish();
+}
+
+void PPUDebugger::CaptureNameTables(PPU& ppu, uint8_t* out) {
+    // $2000 $2400
+    // $2800 $2C00
+    // laid out as they're addressed, so mirroring shows as repeated tables
+    TileCache& tiles = ppu.Tiles();
+    uint32_t base = (ppu.Control() & 0x10) ? 256 : 0;
+    uint8_t backdrop = ppu.Read(0x3f00);
+
+    for (uint32_t table = 0; table < 4; table++) {
+        uint16_t address = 0x2000 + table * 0x400;
+        uint32_t left = (table & 0x01) * 256;
+        uint32_t top = (table >> 1) * 240;
+
+        for (uint32_t ty = 0; ty < 30; ty++) {
+            for (uint32_t tx = 0; tx < 32; tx++) {
+                uint8_t tile = ppu.Read(address + ty * 32 + tx);
+                uint8_t attribute = ppu.Read(address + 0x3c0 + (ty / 4) * 8 + tx / 4);
+                uint8_t palette = (attribute >> (((ty & 0x02) << 1) | (tx & 0x02))) & 0x03;
+
+                uint8_t colors[4] = { backdrop };
+                for (uint32_t c = 1; c < 4; c++) {
+                    colors[c] = ppu.Read(0x3f00 + palette * 4 + c);
+                }
+
+                for (uint32_t row = 0; row < 8; row++) {
+                    const uint8_t* pixels = tiles.Row(base + tile, row);
+                    uint8_t* line = &out[(top + ty * 8 + row) * kNameTablesWidth + left + tx * 8];
+                    for (uint32_t x = 0; x < 8; x++) {
+                        line[x] = colors[pixels[x]];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void PPUDebugger::CapturePatternTables(PPU& ppu, const uint8_t* palette, uint8_t* out) {
+    // $0000 on the left, $1000 on the right, 16x16 tiles each
+    TileCache& tiles = ppu.Tiles();
+
+    for (uint32_t tile = 0; tile < TileCache::kTileCount; tile++) {
+        uint32_t left = (tile >> 8) * 128 + (tile & 0x0f) * 8;
+        uint32_t top = ((tile >> 4) & 0x0f) * 8;
+
+        for (uint32_t row = 0; row < 8; row++) {
+            const uint8_t* pixels = tiles.Row(tile, row);
+            uint8_t* line = &out[(top + row) * kPatternTablesWidth + left];
+            for (uint32_t x = 0; x < 8; x++) {
+                line[x] = palette[pixels[x]];
+            }
+        }
+    }
+}
+
+void PPUDebugger::CaptureSprites(PPU& ppu, const uint8_t* palette, uint8_t* out) {
+    // Each sprite in an 8x16 cell; 8x8 sprites leave the bottom half as
+    // backdrop.  Flips are applied, priority isn't.
+    TileCache& tiles = ppu.Tiles();
+    const uint8_t* oam = ppu.OAM();
+    bool tall = (ppu.Control() & 0x20) != 0;
+    uint32_t base = (ppu.Control() & 0x08) ? 256 : 0;
+    uint8_t backdrop = ppu.Read(0x3f00);
+
+    memset(out, backdrop, kSpritesWidth * kSpritesHeight);
+
+    for (uint32_t n = 0; n < 64; n++) {
+        uint8_t tile = oam[n * 4 + 1];
+        uint8_t attributes = oam[n * 4 + 2];
+        const uint8_t* colors = &palette[(attributes & 0x03) * 4];
+        uint32_t left = (n & 0x07) * 8;
+        uint32_t top = (n >> 3) * 16;
+        uint32_t height = tall ? 16 : 8;
+
+        for (uint32_t row = 0; row < height; row++) {
+            uint32_t line = (attributes & 0x80) ? height - 1 - row : row;
+            uint32_t index;
+            if (tall) {
+                index = ((tile & 0x01) << 8) | (tile & 0xfe);
+                index += line >> 3;
+            }
+            else {
+                index = base | tile;
+            }
+
+            const uint8_t* pixels = (attributes & 0x40) ?
+                tiles.RowFlipped(index, line & 0x07) :
+                tiles.Row(index, line & 0x07);
+            uint8_t* dest = &out[(top + row) * kSpritesWidth + left];
+            for (uint32_t x = 0; x < 8; x++) {
+                if (pixels[x]) {
+                    dest[x] = colors[pixels[x]];
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "TripleBuffer.h"
+
+namespace raunnes {
+
+class PPU;
+
+// Pictures of PPU memory for the debugger window: all four nametables, both
+// pattern tables, palette RAM and the 64 OAM sprites, as NES color indices
+// ready for Palette::Convert-style lookup.
+//
+// Captured on the emulation thread at vblank, straight out of the tile cache,
+// and only when the UI has asked for one, so an idle debugger costs nothing
+// and a busy one at most one capture per emulated frame.
+class PPUDebugger {
+public:
+    static const uint32_t kNameTablesWidth = 512;
+    static const uint32_t kNameTablesHeight = 480;
+    static const uint32_t kPatternTablesWidth = 256;
+    static const uint32_t kPatternTablesHeight = 128;
+    static const uint32_t kSpritesWidth = 64;      // 8 x 8 grid of 8x16 cells
+    static const uint32_t kSpritesHeight = 128;
+
+    struct Snapshot {
+        uint8_t NameTables[kNameTablesWidth * kNameTablesHeight];
+        uint8_t PatternTables[kPatternTablesWidth * kPatternTablesHeight];
+        uint8_t Sprites[kSpritesWidth * kSpritesHeight];
+        uint8_t Palette[32];
+        uint64_t Frame;
+    };
+
+public:
+    PPUDebugger();
+    ~PPUDebugger();
+
+    // UI thread: ask for a fresh capture, then pick it up with Acquire()
+    void Request() { m_Requested.store(true, std::memory_order_release); }
+    bool Acquire() { return m_Snapshots.Acquire(); }
+    const Snapshot& Front() const { return m_Snapshots.Front(); }
+
+    // Palette (0-7) the pattern tables are drawn with
+    void SetPatternPalette(uint32_t palette) { m_PatternPalette.store(palette & 0x07, std::memory_order_relaxed); }
+
+    // Emulation thread: captures if requested
+    void Update(PPU& ppu, uint64_t frame);
+
+public:
+    PPUDebugger(const PPUDebugger&) = delete;
+    PPUDebugger& operator=(const PPUDebugger&) = delete;
+
+private:
+    void CaptureNameTables(PPU& ppu, uint8_t* out);
+    void CapturePatternTables(PPU& ppu, const uint8_t* palette, uint8_t* out);
+    void CaptureSprites(PPU& ppu, const uint8_t* palette, uint8_t* out);
+
+private:
+    TripleBuffer<Snapshot> m_Snapshots;
+    std::atomic<bool> m_Requested;
+    std::atomic<uint32_t> m_PatternPalette;
+};
+
+}
@@ -0,0 +1,117 @@
+#include "Palette.h"
+
+#include "PPU.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace raunnes {
+
+const uint8_t g_DefaultPalette[64][3] = {
+    { 0x66, 0x66, 0x66 }, { 0x00, 0x2a, 0x88 }, { 0x14, 0x12, 0xa7 }, { 0x3b, 0x00, 0xa4 },
+    { 0x5c, 0x00, 0x7e }, { 0x6e, 0x00, 0x40 }, { 0x6c, 0x06, 0x00 }, { 0x56, 0x1d, 0x00 },
+    { 0x33, 0x35, 0x00 }, { 0x0b, 0x48, 0x00 }, { 0x00, 0x52, 0x00 }, { 0x00, 0x4f, 0x08 },
+    { 0x00, 0x40, 0x4d }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xad, 0xad, 0xad }, { 0x15, 0x5f, 0xd9 }, { 0x42, 0x40, 0xff }, { 0x75, 0x27, 0xfe },
+    { 0xa0, 0x1a, 0xcc }, { 0xb7, 0x1e, 0x7b }, { 0xb5, 0x31, 0x20 }, { 0x99, 0x4e, 0x00 },
+    { 0x6b, 0x6d, 0x00 }, { 0x38, 0x87, 0x00 }, { 0x0c, 0x93, 0x00 }, { 0x00, 0x8f, 0x32 },
+    { 0x00, 0x7c, 0x8d }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xff, 0xfe, 0xff }, { 0x64, 0xb0, 0xff }, { 0x92, 0x90, 0xff }, { 0xc6, 0x76, 0xff },
+    { 0xf3, 0x6a, 0xff }, { 0xfe, 0x6e, 0xcc }, { 0xfe, 0x81, 0x70 }, { 0xea, 0x9e, 0x22 },
+    { 0xbc, 0xbe, 0x00 }, { 0x88, 0xd8, 0x00 }, { 0x5c, 0xe4, 0x30 }, { 0x45, 0xe0, 0x82 },
+    { 0x48, 0xcd, 0xde }, { 0x4f, 0x4f, 0x4f }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+    { 0xff, 0xfe, 0xff }, { 0xc0, 0xdf, 0xff }, { 0xd3, 0xd2, 0xff }, { 0xe8, 0xc8, 0xff },
+    { 0xfb, 0xc2, 0xff }, { 0xfe, 0xc4, 0xea }, { 0xfe, 0xcc, 0xc5 }, { 0xf7, 0xd8, 0xa5 },
+    { 0xe4, 0xe5, 0x94 }, { 0xcf, 0xef, 0x96 }, { 0xbd, 0xf4, 0xab }, { 0xb3, 0xf3, 0xcc },
+    { 0xb5, 0xeb, 0xf2 }, { 0xb8, 0xb8, 0xb8 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+};
+
+Palette::Palette() {
+    SetColors(g_DefaultPalette);
+}
+
+Palette::~Palette() {
+}
+
+bool Palette::Load(const std::string& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.good()) {
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() >= 8 * 64 * 3) {
+        for (uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+            for (uint32_t i = 0; i < 64; i++) {
+                const uint8_t* rgb = &data[(emphasis * 64 + i) * 3];
+                m_Table[emphasis][i] = Pack(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+        return true;
+    }
+
+    if (data.size() >= 64 * 3) {
+        uint8_t colors[64][3];
+        memcpy(colors, data.data(), sizeof(colors));
+        SetColors(colors);
+        return true;
+    }
+
+    return false;
+}
+
+void Palette::SetColors(const uint8_t colors[64][3]) {
+    // Each emphasis bit darkens the other two channels by about 18%.  Bit 0
+    // is red, 1 green, 2 blue on the NTSC 2C02.
+    // https://www.nesdev.org/wiki/NTSC_video#Color_Tint_Bits
+    for (uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+        for (uint32_t i = 0; i < 64; i++) {
+            uint32_t rgb[3] = { colors[i][0], colors[i][1], colors[i][2] };
+
+            for (uint32_t bit = 0; bit < 3; bit++) {
+                if (!(emphasis & (1 << bit))) {
+                    continue;
+                }
+                for (uint32_t channel = 0; channel < 3; channel++) {
+                    if (channel != bit) {
+                        rgb[channel] = rgb[channel] * 209 / 256;
+                    }
+                }
+            }
+
+            m_Table[emphasis][i] = Pack((uint8_t)rgb[0], (uint8_t)rgb[1], (uint8_t)rgb[2]);
+        }
+    }
+}
+
+void Palette::Convert(const uint8_t* frame, const uint8_t* lineEmphasis, uint32_t* out) const {
+    for (uint32_t y = 0; y < PPU::kScreenHeight; y++) {
+        const uint32_t* colors = m_Table[lineEmphasis[y] & 0x07];
+        const uint8_t* in = &frame[y * PPU::kScreenWidth];
+        uint32_t* line = &out[y * PPU::kScreenWidth];
+
+        for (uint32_t x = 0; x < PPU::kScreenWidth; x++) {
+            line[x] = colors[in[x] & 0x3f];
+        }
+    }
+}
+
+void Palette::Convert(const uint8_t* indices, size_t count, uint32_t* out) const {
+    const uint32_t* colors = m_Table[0];
+    for (size_t i = 0; i < count; i++) {
+        out[i] = colors[indices[i] & 0x3f];
+    }
+}
+
+uint32_t Palette::Pack(uint8_t r, uint8_t g, uint8_t b) {
+    // Byte order in memory, whatever the host's endianness
+    uint8_t bytes[4] = { r, g, b, 0xff };
+    uint32_t pixel;
+    memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace raunnes {
+
+// RGB for each of the 64 NES color indices, 2C02 NTSC
+// https://www.nesdev.org/wiki/PPU_palettes
+extern const uint8_t g_DefaultPalette[64][3];
+
+// NES color index + emphasis -> host pixel, worked out ahead of time for all
+// 64 x 8 combinations so the output path is one table load per pixel.
+// Greyscale is already applied to the index by the PPU.
+//
+// Pixels are 32 bit with bytes R G B A in memory, the layout sf::Texture and
+// sf::Image take.
+class Palette {
+public:
+    Palette();
+    ~Palette();
+
+    // .pal files are 64 RGB triples, or 512 with the emphasis variants in
+    // emphasis order after them.  Without variants emphasis is derived.
+    bool Load(const std::string& path);
+    void SetColors(const uint8_t colors[64][3]);
+
+    // emphasis is $2001 bits 5-7 shifted down
+    const uint32_t* Colors(uint8_t emphasis) const { return m_Table[emphasis & 0x07]; }
+
+    // 256x240 indices, one emphasis value per line
+    void Convert(const uint8_t* frame, const uint8_t* lineEmphasis, uint32_t* out) const;
+
+    // Any run of indices with no emphasis, for debugger views
+    void Convert(const uint8_t* indices, size_t count, uint32_t* out) const;
+
+public:
+    Palette(const Palette&) = delete;
+    Palette& operator=(const Palette&) = delete;
+
+private:
+    static uint32_t Pack(uint8_t r, uint8_t g, uint8_t b);
+
+private:
+    uint32_t m_Table[8][64];
+};
+
+}
@@ -0,0 +1,68 @@
+#include "PerfCounters.h"
+
+#include <thread>
+
+namespace raunnes {
+
+// How often the frame rate is worked out
+static const uint64_t kRateWindowNs = 500000000;
+
+PerfCounters::PerfCounters() :
+    m_FramesPerSecond(0),
+    m_Sequence(0),
+    m_WindowStart(0),
+    m_WindowFrames(0) {
+    for (uint32_t i = 0; i < CounterCount; i++) {
+        m_Values[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+}
+
+void PerfCounters::BeginFrame() {
+    // Only this thread writes it, so a plain increment; the fence keeps the
+    // counters' stores after it
+    m_Sequence.store(m_Sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void PerfCounters::FrameDone(uint64_t now) {
+    uint64_t frames = m_Values[CounterFrames].load(std::memory_order_relaxed) + 1;
+    m_Values[CounterFrames].store(frames, std::memory_order_relaxed);
+
+    if (m_WindowStart == 0) {
+        m_WindowStart = now;
+        m_WindowFrames = frames;
+    } else if (now - m_WindowStart >= kRateWindowNs) {
+        m_FramesPerSecond.store((frames - m_WindowFrames) * 1e9 / (now - m_WindowStart), std::memory_order_relaxed);
+        m_WindowStart = now;
+        m_WindowFrames = frames;
+    }
+
+    m_Sequence.store(m_Sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+PerfCounters::Snapshot PerfCounters::Read() const {
+    Snapshot snapshot;
+    while (true) {
+        uint64_t sequence = m_Sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (uint32_t i = 0; i < CounterCount; i++) {
+            snapshot.Values[i] = m_Values[i].load(std::memory_order_relaxed);
+        }
+        snapshot.FramesPerSecond = m_FramesPerSecond.load(std::memory_order_relaxed);
+
+        // Nothing read above can be from after this
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_Sequence.load(std::memory_order_relaxed) == sequence) {
+            return snapshot;
+        }
+    }
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace raunnes {
+
+// Where the time goes, per frame.  Each counter has exactly one writer
+// thread, which keeps its running totals in plain fields of its own and
+// stores them here with relaxed atomics once a frame, so the hot paths pay
+// for an add.  Values are the last complete frame's, except the frame count.
+//
+// The emulation thread's counters go in between BeginFrame() and
+// FrameDone(), which bump a sequence number around them; Read() retries
+// until it gets them all from the same frame.  CounterPresentNs is the UI
+// thread's and can be from a frame either side of the rest.
+class PerfCounters {
+public:
+    enum Counter {
+        CounterFrames,          // frames completed since power on
+        CounterInstructions,    // CPU instructions
+        CounterTranslated,      //   of which run as translated code
+        CounterPPUCatchUps,     // times the PPU had to catch up to the CPU
+        CounterIdleCycles,      // CPU cycles skipped in idle loops
+        CounterFrameNs,         // host time to emulate the frame
+        CounterCPUNs,           //   of which the CPU, memory and everything not below
+        CounterPPUNs,           //   the PPU catching up
+        CounterAPUNs,           //   the APU running its batch
+        CounterPresentNs,       // UI thread: converting and drawing the last frame shown
+        CounterCount
+    };
+
+    struct Snapshot {
+        uint64_t Values[CounterCount];
+        double FramesPerSecond;     // emulated, over about the last half second
+    };
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // Nanoseconds on a monotonic clock, also the trace's timebase
+    static uint64_t Now() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Set(Counter counter, uint64_t value) { m_Values[counter].store(value, std::memory_order_relaxed); }
+    uint64_t Get(Counter counter) const { return m_Values[counter].load(std::memory_order_relaxed); }
+
+    // Emulation thread, before setting the frame's counters
+    void BeginFrame();
+
+    // Emulation thread, after setting the frame's counters.  Counts the frame
+    // and keeps the rate up to date.
+    void FrameDone(uint64_t now);
+
+    Snapshot Read() const;
+
+public:
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+private:
+    std::atomic<uint64_t> m_Values[CounterCount];
+    std::atomic<double> m_FramesPerSecond;
+
+    // Odd while a frame's counters are being stored
+    std::atomic<uint64_t> m_Sequence;
+
+    // Rate window, emulation thread only
+    uint64_t m_WindowStart;
+    uint64_t m_WindowFrames;
+};
+
+}
@@ -0,0 +1,1297 @@
+#include "Recompiler.h"
+
+#include "MemoryMap.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#if RAUNNES_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace raunnes {
+
+const Recompiler::Options Recompiler::kDefaultOptions = { 16, 64, false };
+
+#if RAUNNES_JIT
+
+// Room for every block, thrown away and started over when it fills
+static const uint32_t kCodeSize = 16 * 1024 * 1024;
+
+namespace {
+
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NoReg = -1,
+};
+
+// Where the 6502 lives while a block runs.  N and Z are kept as the value
+// they were last set from (N is its bit 7, Z is it being 0), so most
+// instructions set both with two moves; C and V are 0 or 1.  The rest of P
+// and SP stay in the context.  RAX, RCX, RDX and RSI are scratch, normally
+// the address, the value, the page and whether a page was crossed.
+static const Reg kA = RBX;
+static const Reg kX = RBP;
+static const Reg kY = R14;
+static const Reg kZ = R8;
+static const Reg kN = R9;
+static const Reg kC = R10;
+static const Reg kV = R11;
+static const Reg kReadPages = R12;
+static const Reg kCycles = R13;
+static const Reg kContext = R15;
+static const Reg kWritePages = RDI;
+
+enum Cond {
+    CondB = 0x2,
+    CondAE = 0x3,
+    CondE = 0x4,
+    CondNE = 0x5,
+    CondBE = 0x6,
+    CondA = 0x7,
+};
+
+enum AluOp {
+    AluAdd = 0,
+    AluOr = 1,
+    AluAnd = 4,
+    AluSub = 5,
+    AluXor = 6,
+    AluCmp = 7,
+};
+
+enum ShiftOp {
+    ShiftLeft = 4,
+    ShiftRight = 5,
+};
+
+struct Mem {
+    Reg Base;
+    Reg Index;
+    int32_t Disp;
+    uint8_t ScaleBits;
+};
+
+static Mem At(Reg base, int32_t disp) {
+    Mem mem = { base, NoReg, disp, 0 };
+    return mem;
+}
+
+// base + index * 2^scaleBits
+static Mem At(Reg base, Reg index, uint8_t scaleBits) {
+    Mem mem = { base, index, 0, scaleBits };
+    return mem;
+}
+
+static Mem Field(size_t offset) {
+    return At(kContext, (int32_t)offset);
+}
+
+// The byte a page lookup left in RDX + RAX
+static const Mem kOperand = { RDX, RAX, 0, 0 };
+
+struct Label {
+    int32_t Position = -1;
+    std::vector<uint32_t> Fixups;
+};
+
+// Just the x86-64 blocks need.  Memory operands always take a 32 bit
+// displacement, and byte registers always get a REX prefix so 4-7 are
+// SPL-DIL rather than AH-BH.
+class Emitter {
+public:
+    std::vector<uint8_t> Code;
+
+    uint32_t Size() const { return (uint32_t)Code.size(); }
+
+    void Byte(uint8_t value) { Code.push_back(value); }
+
+    void Dword(uint32_t value) {
+        for (uint32_t i = 0; i < 4; i++) {
+            Code.push_back((uint8_t)(value >> (i * 8)));
+        }
+    }
+
+    void MovRR(Reg dst, Reg src) { RR(0x89, src, dst); }
+    void MovRR64(Reg dst, Reg src) { RR(0x89, src, dst, true); }
+    void MovRI(Reg dst, uint32_t imm) {
+        Rex(false, 0, 0, dst, false);
+        Byte((uint8_t)(0xb8 + (dst & 7)));
+        Dword(imm);
+    }
+    void MovRM(Reg dst, const Mem& mem) { RM(0x8b, dst, mem); }
+    void MovRM64(Reg dst, const Mem& mem) { RM(0x8b, dst, mem, true); }
+    void MovMR(const Mem& mem, Reg src) { RM(0x89, src, mem); }
+    void MovMR64(const Mem& mem, Reg src) { RM(0x89, src, mem, true); }
+    void MovMI(const Mem& mem, uint32_t imm) { RM(0xc7, 0, mem); Dword(imm); }
+    void MovMR8(const Mem& mem, Reg src) { RM(0x88, src, mem, false, true); }
+    void MovMI8(const Mem& mem, uint8_t imm) { RM(0xc6, 0, mem); Byte(imm); }
+    void MovzxRM8(Reg dst, const Mem& mem) { RM(0x0fb6, dst, mem); }
+    void MovzxRR8(Reg dst, Reg src) { RR(0x0fb6, dst, src, false, true); }
+
+    void Alu(AluOp op, Reg dst, Reg src) { RR(0x01 + op * 8, src, dst); }
+    void AluI(AluOp op, Reg dst, uint32_t imm) { RR(0x81, op, dst); Dword(imm); }
+    void AluI64(AluOp op, Reg dst, uint32_t imm) { RR(0x81, op, dst, true); Dword(imm); }
+    void Add64(Reg dst, Reg src) { RR(0x01, src, dst, true); }
+    void IncM(const Mem& mem) { RM(0xff, 0, mem); }
+    void Shift(ShiftOp op, Reg dst, uint8_t count) { RR(0xc1, op, dst); Byte(count); }
+
+    void Test8(Reg a, Reg b) { RR(0x84, b, a, false, true); }
+    void TestI8(Reg r, uint8_t imm) { RR(0xf6, 0, r, false, true); Byte(imm); }
+    void Test64(Reg a, Reg b) { RR(0x85, b, a, true); }
+    void Setcc(Cond cond, Reg r) { RR(0x0f90 + cond, 0, r, false, true); }
+
+    void Push(Reg r) { Rex(false, 0, 0, r, false); Byte((uint8_t)(0x50 + (r & 7))); }
+    void Pop(Reg r) { Rex(false, 0, 0, r, false); Byte((uint8_t)(0x58 + (r & 7))); }
+    void Ret() { Byte(0xc3); }
+
+    void Jcc(Cond cond, Label& label) {
+        Byte(0x0f);
+        Byte((uint8_t)(0x80 + cond));
+        Rel32(label);
+    }
+
+    void Jmp(Label& label) {
+        Byte(0xe9);
+        Rel32(label);
+    }
+
+    void Bind(Label& label) {
+        label.Position = (int32_t)Size();
+        for (uint32_t fixup : label.Fixups) {
+            Patch(fixup, label.Position);
+        }
+        label.Fixups.clear();
+    }
+
+private:
+    void Rex(bool w, int reg, int index, int base, bool byteRegs) {
+        uint8_t rex = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1));
+        if (rex != 0x40 || byteRegs) {
+            Byte(rex);
+        }
+    }
+
+    void Opcode(uint32_t opcode) {
+        if (opcode > 0xff) {
+            Byte((uint8_t)(opcode >> 8));
+        }
+        Byte((uint8_t)opcode);
+    }
+
+    void RR(uint32_t opcode, int reg, int rm, bool w = false, bool byteRegs = false) {
+        Rex(w, reg, 0, rm, byteRegs);
+        Opcode(opcode);
+        Byte((uint8_t)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+    }
+
+    void RM(uint32_t opcode, int reg, const Mem& mem, bool w = false, bool byteRegs = false) {
+        Rex(w, reg, mem.Index == NoReg ? 0 : mem.Index, mem.Base, byteRegs);
+        Opcode(opcode);
+        if (mem.Index != NoReg || (mem.Base & 7) == 4) {
+            uint8_t index = mem.Index == NoReg ? 4 : (uint8_t)(mem.Index & 7);
+            Byte((uint8_t)(0x80 | (reg & 7) << 3 | 4));
+            Byte((uint8_t)(mem.ScaleBits << 6 | index << 3 | (mem.Base & 7)));
+        } else {
+            Byte((uint8_t)(0x80 | (reg & 7) << 3 | (mem.Base & 7)));
+        }
+        Dword((uint32_t)mem.Disp);
+    }
+
+    void Rel32(Label& label) {
+        uint32_t at = Size();
+        Dword(0);
+        if (label.Position >= 0) {
+            Patch(at, label.Position);
+        } else {
+            label.Fixups.push_back(at);
+        }
+    }
+
+    void Patch(uint32_t at, int32_t target) {
+        int32_t rel = target - (int32_t)(at + 4);
+        memcpy(&Code[at], &rel, 4);
+    }
+};
+
+enum Op {
+    OpNone,
+    OpADC, OpAND, OpASL, OpBCC, OpBCS, OpBEQ, OpBIT, OpBMI, OpBNE, OpBPL,
+    OpBVC, OpBVS, OpCLC, OpCLD, OpCLI, OpCLV, OpCMP, OpCPX, OpCPY, OpDCP,
+    OpDEC, OpDEX, OpDEY, OpEOR, OpINC, OpINX, OpINY, OpISB, OpJMP, OpJSR,
+    OpLAX, OpLDA, OpLDX, OpLDY, OpLSR, OpNOP, OpORA, OpPHA, OpPHP, OpPLA,
+    OpPLP, OpRLA, OpROL, OpROR, OpRRA, OpRTI, OpRTS, OpSAX, OpSBC, OpSEC,
+    OpSED, OpSEI, OpSLO, OpSRE, OpSTA, OpSTX, OpSTY, OpTAX, OpTAY, OpTSX,
+    OpTXA, OpTXS, OpTYA,
+};
+
+// BRK, KIL and the unemulated opcodes are left to the interpreter
+static Op OpFor(CPUCore6502::ExecutionDelegate delegate) {
+    static const struct {
+        CPUCore6502::ExecutionDelegate Delegate;
+        Op Translated;
+    } kOps[] = {
+        { &CPUCore6502::ADC, OpADC }, { &CPUCore6502::AND, OpAND }, { &CPUCore6502::ASL, OpASL },
+        { &CPUCore6502::BCC, OpBCC }, { &CPUCore6502::BCS, OpBCS }, { &CPUCore6502::BEQ, OpBEQ },
+        { &CPUCore6502::BIT, OpBIT }, { &CPUCore6502::BMI, OpBMI }, { &CPUCore6502::BNE, OpBNE },
+        { &CPUCore6502::BPL, OpBPL }, { &CPUCore6502::BVC, OpBVC }, { &CPUCore6502::BVS, OpBVS },
+        { &CPUCore6502::CLC, OpCLC }, { &CPUCore6502::CLD, OpCLD }, { &CPUCore6502::CLI, OpCLI },
+        { &CPUCore6502::CLV, OpCLV }, { &CPUCore6502::CMP, OpCMP }, { &CPUCore6502::CPX, OpCPX },
+        { &CPUCore6502::CPY, OpCPY }, { &CPUCore6502::DCP, OpDCP }, { &CPUCore6502::DEC, OpDEC },
+        { &CPUCore6502::DEX, OpDEX }, { &CPUCore6502::DEY, OpDEY }, { &CPUCore6502::EOR, OpEOR },
+        { &CPUCore6502::INC, OpINC }, { &CPUCore6502::INX, OpINX }, { &CPUCore6502::INY, OpINY },
+        { &CPUCore6502::ISB, OpISB }, { &CPUCore6502::JMP, OpJMP }, { &CPUCore6502::JSR, OpJSR },
+        { &CPUCore6502::LAX, OpLAX }, { &CPUCore6502::LDA, OpLDA }, { &CPUCore6502::LDX, OpLDX },
+        { &CPUCore6502::LDY, OpLDY }, { &CPUCore6502::LSR, OpLSR }, { &CPUCore6502::NOP, OpNOP },
+        { &CPUCore6502::ORA, OpORA }, { &CPUCore6502::PHA, OpPHA }, { &CPUCore6502::PHP, OpPHP },
+        { &CPUCore6502::PLA, OpPLA }, { &CPUCore6502::PLP, OpPLP }, { &CPUCore6502::RLA, OpRLA },
+        { &CPUCore6502::ROL, OpROL }, { &CPUCore6502::ROR, OpROR }, { &CPUCore6502::RRA, OpRRA },
+        { &CPUCore6502::RTI, OpRTI }, { &CPUCore6502::RTS, OpRTS }, { &CPUCore6502::SAX, OpSAX },
+        { &CPUCore6502::SBC, OpSBC }, { &CPUCore6502::SEC, OpSEC }, { &CPUCore6502::SED, OpSED },
+        { &CPUCore6502::SEI, OpSEI }, { &CPUCore6502::SLO, OpSLO }, { &CPUCore6502::SRE, OpSRE },
+        { &CPUCore6502::STA, OpSTA }, { &CPUCore6502::STX, OpSTX }, { &CPUCore6502::STY, OpSTY },
+        { &CPUCore6502::TAX, OpTAX }, { &CPUCore6502::TAY, OpTAY }, { &CPUCore6502::TSX, OpTSX },
+        { &CPUCore6502::TXA, OpTXA }, { &CPUCore6502::TXS, OpTXS }, { &CPUCore6502::TYA, OpTYA },
+    };
+
+    for (const auto& op : kOps) {
+        if (op.Delegate == delegate) {
+            return op.Translated;
+        }
+    }
+    return OpNone;
+}
+
+static bool IsStore(Op op) {
+    return op == OpSTA || op == OpSTX || op == OpSTY || op == OpSAX;
+}
+
+static bool IsReadModifyWrite(Op op) {
+    return op == OpASL || op == OpLSR || op == OpROL || op == OpROR || op == OpINC || op == OpDEC ||
+        op == OpSLO || op == OpRLA || op == OpSRE || op == OpRRA || op == OpDCP || op == OpISB;
+}
+
+static bool IsBranch(Op op) {
+    return op == OpBCC || op == OpBCS || op == OpBEQ || op == OpBNE ||
+        op == OpBMI || op == OpBPL || op == OpBVC || op == OpBVS;
+}
+
+// Turns straight line 6502 code into one x86-64 function
+class BlockBuilder {
+public:
+    BlockBuilder(uint8_t* const* readPages, uint8_t* const* directWritePages) :
+        m_ReadPages(readPages),
+        m_DirectWritePages(directWritePages),
+        m_PC(0),
+        m_LastPC(0),
+        m_Index(0),
+        m_Cycles(0),
+        m_SideExit(-1) {
+    }
+
+    Emitter E;
+
+    // Translates from start, returning the instructions in the block (0 if
+    // the first can't be) with end and the most cycles it can take
+    uint32_t Build(uint16_t start, uint32_t maxInstructions, uint16_t& end, uint32_t& maxCycles) {
+        Prologue();
+
+        uint32_t at = start;
+        uint32_t count = 0;
+        bool ended = false;
+        maxCycles = 0;
+        m_LastPC = start;
+
+        while (count < maxInstructions && !ended) {
+            uint8_t bytes[3] = { 0, 0, 0 };
+            uint8_t opcode = Fetch(at);
+            const CPUCore6502::InstructionDetails& details = CPUCore6502::Details(opcode);
+            Op op = OpFor(details.Delegate);
+
+            uint32_t size = details.InstructionSize;
+            if (op == OpNone || size == 0 || at + size >= 0x10000 || !Fetchable(at, size)) {
+                break;
+            }
+            for (uint32_t i = 0; i < size; i++) {
+                bytes[i] = Fetch(at + i);
+            }
+            if (!StaticAccessOk(op, details.AddresingMode, bytes)) {
+                break;
+            }
+
+            m_PC = (uint16_t)at;
+            m_Index = count;
+            m_SideExit = -1;
+            ended = Translate(op, details, bytes, (uint16_t)(at + size));
+
+            count++;
+            m_Cycles += details.CycleCount;
+            maxCycles += details.CycleCount + details.PageCrossCycleCost + (IsBranch(op) ? 1 : 0);
+            m_LastPC = m_PC;
+            at += size;
+        }
+
+        end = (uint16_t)at;
+        if (count == 0) {
+            return 0;
+        }
+        if (!ended) {
+            Exit((uint16_t)at, m_Cycles, count, m_LastPC);
+        }
+
+        for (SideExit& exit : m_SideExits) {
+            E.Bind(exit.Target);
+            Exit(exit.PC, exit.Cycles, exit.Instructions, exit.LastPC);
+        }
+
+        E.Bind(m_Epilogue);
+        Epilogue();
+        return count;
+    }
+
+private:
+    struct SideExit {
+        Label Target;
+        uint16_t PC;
+        uint16_t LastPC;
+        uint32_t Instructions;
+        uint32_t Cycles;
+    };
+
+    uint8_t Fetch(uint32_t address) const {
+        const uint8_t* page = m_ReadPages[(address >> 8) & 0xff];
+        return page != nullptr ? page[address & 0xff] : 0;
+    }
+
+    bool Fetchable(uint32_t address, uint32_t size) const {
+        for (uint32_t i = 0; i < size; i++) {
+            if (m_ReadPages[((address + i) >> 8) & 0xff] == nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // An operand at a fixed address that's never plain memory ends the block
+    // before the instruction, rather than leaving through a side exit every
+    // time
+    bool StaticAccessOk(Op op, uint32_t mode, const uint8_t* bytes) const {
+        uint16_t address = (uint16_t)(bytes[1] | bytes[2] << 8);
+        if (op == OpJMP && mode == CPUCore6502::AddressingModeIndirect) {
+            return m_ReadPages[address >> 8] != nullptr;
+        }
+        if (mode != CPUCore6502::AddressingModeAbsolute || op == OpJMP || op == OpJSR || op == OpNOP) {
+            return true;
+        }
+        if (IsStore(op) || IsReadModifyWrite(op)) {
+            return m_DirectWritePages[address >> 8] != nullptr;
+        }
+        return m_ReadPages[address >> 8] != nullptr;
+    }
+
+    // Jumped to when the instruction being translated can't finish in the
+    // block, before it's changed anything
+    Label& SideExitLabel() {
+        if (m_SideExit < 0) {
+            SideExit exit;
+            exit.PC = m_PC;
+            exit.LastPC = m_LastPC;
+            exit.Instructions = m_Index;
+            exit.Cycles = m_Cycles;
+            m_SideExits.push_back(exit);
+            m_SideExit = (int32_t)m_SideExits.size() - 1;
+        }
+        return m_SideExits[m_SideExit].Target;
+    }
+
+    void Prologue() {
+        E.Push(RBX);
+        E.Push(RBP);
+        E.Push(R12);
+        E.Push(R13);
+        E.Push(R14);
+        E.Push(R15);
+        E.MovRR64(kContext, RDI);
+        E.MovRM64(kReadPages, Field(offsetof(Recompiler::Context, ReadPages)));
+        E.MovRM64(kWritePages, Field(offsetof(Recompiler::Context, WritePages)));
+        E.MovRM64(kCycles, Field(offsetof(Recompiler::Context, Cycles)));
+        E.MovRM(kA, Field(offsetof(Recompiler::Context, A)));
+        E.MovRM(kX, Field(offsetof(Recompiler::Context, X)));
+        E.MovRM(kY, Field(offsetof(Recompiler::Context, Y)));
+        E.MovRM(RCX, Field(offsetof(Recompiler::Context, P)));
+        UnpackP(RCX);
+    }
+
+    void Epilogue() {
+        E.MovMR64(Field(offsetof(Recompiler::Context, Cycles)), kCycles);
+        E.MovMR(Field(offsetof(Recompiler::Context, A)), kA);
+        E.MovMR(Field(offsetof(Recompiler::Context, X)), kX);
+        E.MovMR(Field(offsetof(Recompiler::Context, Y)), kY);
+        PackP();
+        E.MovMR(Field(offsetof(Recompiler::Context, P)), RCX);
+        E.Pop(R15);
+        E.Pop(R14);
+        E.Pop(R13);
+        E.Pop(R12);
+        E.Pop(RBP);
+        E.Pop(RBX);
+        E.Ret();
+    }
+
+    // P from the context and the flag registers into RCX, trashes RAX
+    void PackP() {
+        E.MovRM(RCX, Field(offsetof(Recompiler::Context, P)));
+        E.AluI(AluAnd, RCX, 0x3c);
+        E.Alu(AluOr, RCX, kC);
+        E.MovRR(RAX, kV);
+        E.Shift(ShiftLeft, RAX, 6);
+        E.Alu(AluOr, RCX, RAX);
+        E.MovRR(RAX, kN);
+        E.AluI(AluAnd, RAX, 0x80);
+        E.Alu(AluOr, RCX, RAX);
+        E.MovRI(RAX, 0);
+        E.Test8(kZ, kZ);
+        E.Setcc(CondE, RAX);
+        E.Shift(ShiftLeft, RAX, 1);
+        E.Alu(AluOr, RCX, RAX);
+    }
+
+    // P in reg into the context and the flag registers
+    void UnpackP(Reg reg) {
+        E.MovMR(Field(offsetof(Recompiler::Context, P)), reg);
+        E.MovRR(kC, reg);
+        E.AluI(AluAnd, kC, 0x01);
+        E.MovRR(kV, reg);
+        E.Shift(ShiftRight, kV, 6);
+        E.AluI(AluAnd, kV, 0x01);
+        E.MovRR(kN, reg);
+        E.AluI(AluAnd, kN, 0x80);
+        E.MovRR(kZ, reg);
+        E.AluI(AluAnd, kZ, 0x02);
+        E.AluI(AluXor, kZ, 0x02);
+    }
+
+    void SetP(AluOp op, uint32_t bits) {
+        E.MovRM(RAX, Field(offsetof(Recompiler::Context, P)));
+        E.AluI(op, RAX, bits);
+        E.MovMR(Field(offsetof(Recompiler::Context, P)), RAX);
+    }
+
+    void SetNZ(Reg reg) {
+        E.MovRR(kZ, reg);
+        E.MovRR(kN, reg);
+    }
+
+    void AddCycles(uint32_t cycles) {
+        if (cycles != 0) {
+            E.AluI64(AluAdd, kCycles, cycles);
+        }
+    }
+
+    void Exit(uint16_t pc, uint32_t cycles, uint32_t instructions, uint16_t lastPC) {
+        AddCycles(cycles);
+        E.MovMI(Field(offsetof(Recompiler::Context, PC)), pc);
+        ExitTail(instructions, lastPC);
+    }
+
+    // PC already in reg
+    void ExitTo(Reg reg, uint32_t cycles) {
+        AddCycles(cycles);
+        E.MovMR(Field(offsetof(Recompiler::Context, PC)), reg);
+        ExitTail(m_Index + 1, m_PC);
+    }
+
+    void ExitTail(uint32_t instructions, uint16_t lastPC) {
+        E.MovMI(Field(offsetof(Recompiler::Context, LastPC)), lastPC);
+        E.MovMI(Field(offsetof(Recompiler::Context, Instructions)), instructions);
+        E.Jmp(m_Epilogue);
+    }
+
+    void CountWrite() {
+        E.IncM(Field(offsetof(Recompiler::Context, Writes)));
+    }
+
+    // RDX to a page from table, leaving the operand at kOperand or taking the
+    // side exit if the page isn't plain memory
+
+    void StaticPage(Reg table, uint16_t address) {
+        E.MovRM64(RDX, At(table, (address >> 8) * 8));
+        E.Test64(RDX, RDX);
+        E.Jcc(CondE, SideExitLabel());
+        E.MovRI(RAX, address & 0xff);
+    }
+
+    // Address in RAX, within page 0
+    void ZeroPage(Reg table) {
+        E.MovRM64(RDX, At(table, 0));
+        E.Test64(RDX, RDX);
+        E.Jcc(CondE, SideExitLabel());
+    }
+
+    // Address in RAX
+    void DynamicPage(Reg table) {
+        E.MovRR(RCX, RAX);
+        E.Shift(ShiftRight, RCX, 8);
+        E.MovRM64(RDX, At(table, RCX, 3));
+        E.Test64(RDX, RDX);
+        E.Jcc(CondE, SideExitLabel());
+        E.MovzxRR8(RAX, RAX);
+    }
+
+    // RSI = 1 if index added to an address whose low byte is in base
+    // crossed a page, else 0
+    void PageCrossed(Reg base, Reg index) {
+        E.MovzxRR8(RSI, base);
+        E.Alu(AluAdd, RSI, index);
+        E.Shift(ShiftRight, RSI, 8);
+    }
+
+    // The operand's page in table, taking the side exit if it isn't plain
+    // memory.  RSI is whether indexing crossed a page, for the caller to
+    // add once nothing can side exit any more.
+    void Operand(uint32_t mode, const uint8_t* bytes, Reg table, bool crossing) {
+        uint16_t absolute = (uint16_t)(bytes[1] | bytes[2] << 8);
+
+        switch (mode) {
+        case CPUCore6502::AddressingModeAbsolute:
+            StaticPage(table, absolute);
+            break;
+        case CPUCore6502::AddressingModeZeroPage:
+            StaticPage(table, bytes[1]);
+            break;
+        case CPUCore6502::AddressingModeZeroPageX:
+        case CPUCore6502::AddressingModeZeroPageY:
+            E.MovRR(RAX, mode == CPUCore6502::AddressingModeZeroPageX ? kX : kY);
+            E.AluI(AluAdd, RAX, bytes[1]);
+            E.AluI(AluAnd, RAX, 0xff);
+            ZeroPage(table);
+            break;
+        case CPUCore6502::AddressingModeAbsoluteX:
+        case CPUCore6502::AddressingModeAbsoluteY: {
+            Reg index = mode == CPUCore6502::AddressingModeAbsoluteX ? kX : kY;
+            if (crossing) {
+                E.MovRI(RSI, bytes[1]);
+                E.Alu(AluAdd, RSI, index);
+                E.Shift(ShiftRight, RSI, 8);
+            }
+            E.MovRR(RAX, index);
+            E.AluI(AluAdd, RAX, absolute);
+            E.AluI(AluAnd, RAX, 0xffff);
+            DynamicPage(table);
+            break;
+        }
+        case CPUCore6502::AddressingModeIndexedIndirect:
+            // Pointer at (operand + X) & $FF, wrapping within page 0
+            E.MovRM64(RDX, At(kReadPages, 0));
+            E.Test64(RDX, RDX);
+            E.Jcc(CondE, SideExitLabel());
+            E.MovRR(RCX, kX);
+            E.AluI(AluAdd, RCX, bytes[1]);
+            E.AluI(AluAnd, RCX, 0xff);
+            E.MovzxRM8(RAX, At(RDX, RCX, 0));
+            E.AluI(AluAdd, RCX, 1);
+            E.AluI(AluAnd, RCX, 0xff);
+            E.MovzxRM8(RCX, At(RDX, RCX, 0));
+            E.Shift(ShiftLeft, RCX, 8);
+            E.Alu(AluOr, RAX, RCX);
+            DynamicPage(table);
+            break;
+        case CPUCore6502::AddressingModeIndirectIndexed:
+            // Pointer at the operand, wrapping within page 0, plus Y
+            E.MovRM64(RDX, At(kReadPages, 0));
+            E.Test64(RDX, RDX);
+            E.Jcc(CondE, SideExitLabel());
+            E.MovzxRM8(RAX, At(RDX, bytes[1]));
+            E.MovzxRM8(RCX, At(RDX, (bytes[1] + 1) & 0xff));
+            E.Shift(ShiftLeft, RCX, 8);
+            E.Alu(AluOr, RAX, RCX);
+            if (crossing) {
+                PageCrossed(RAX, kY);
+            }
+            E.Alu(AluAdd, RAX, kY);
+            E.AluI(AluAnd, RAX, 0xffff);
+            DynamicPage(table);
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+
+    bool CanCross(uint32_t mode) const {
+        return mode == CPUCore6502::AddressingModeAbsoluteX ||
+            mode == CPUCore6502::AddressingModeAbsoluteY ||
+            mode == CPUCore6502::AddressingModeIndirectIndexed;
+    }
+
+    void AddCrossing(uint32_t cost) {
+        for (uint32_t i = 0; i < cost; i++) {
+            E.Add64(kCycles, RSI);
+        }
+    }
+
+    // A + value in RCX + C, as ADC.  Trashes RAX, RDX, RSI.
+    void AddWithCarry() {
+        E.MovRR(RAX, kA);
+        E.Alu(AluAdd, RAX, RCX);
+        E.Alu(AluAdd, RAX, kC);
+        E.MovRR(kC, RAX);
+        E.Shift(ShiftRight, kC, 8);
+        E.AluI(AluAnd, RAX, 0xff);
+        Overflow(RCX, kA, RAX);
+        E.MovRR(kA, RAX);
+        SetNZ(kA);
+    }
+
+    // V = (b ^ result) & (a ^ result) & $80
+    void Overflow(Reg b, Reg a, Reg result) {
+        E.MovRR(RDX, b);
+        E.Alu(AluXor, RDX, result);
+        E.MovRR(RSI, a);
+        E.Alu(AluXor, RSI, result);
+        E.Alu(AluAnd, RDX, RSI);
+        E.Shift(ShiftRight, RDX, 7);
+        E.AluI(AluAnd, RDX, 0x01);
+        E.MovRR(kV, RDX);
+    }
+
+    // Z, N, C as reg compared with RCX
+    void Compare(Reg reg) {
+        E.Alu(AluCmp, reg, RCX);
+        E.Setcc(CondAE, kC);
+        E.MovRR(RAX, reg);
+        E.Alu(AluSub, RAX, RCX);
+        E.AluI(AluAnd, RAX, 0xff);
+        SetNZ(RAX);
+    }
+
+    // The shift or step part of a read-modify-write on RCX, leaving the new
+    // value in RCX.  RAX and RDX still locate the operand, so only RSI is
+    // free.
+    void Modify(Op op) {
+        switch (op) {
+        case OpASL:
+        case OpSLO:
+            E.MovRR(kC, RCX);
+            E.Shift(ShiftRight, kC, 7);
+            E.Shift(ShiftLeft, RCX, 1);
+            E.AluI(AluAnd, RCX, 0xff);
+            break;
+        case OpLSR:
+        case OpSRE:
+            E.MovRR(kC, RCX);
+            E.AluI(AluAnd, kC, 0x01);
+            E.Shift(ShiftRight, RCX, 1);
+            break;
+        case OpROL:
+        case OpRLA:
+            E.MovRR(RSI, RCX);
+            E.Shift(ShiftLeft, RCX, 1);
+            E.Alu(AluOr, RCX, kC);
+            E.AluI(AluAnd, RCX, 0xff);
+            E.Shift(ShiftRight, RSI, 7);
+            E.MovRR(kC, RSI);
+            break;
+        case OpROR:
+        case OpRRA:
+            E.MovRR(RSI, kC);
+            E.Shift(ShiftLeft, RSI, 7);
+            E.MovRR(kC, RCX);
+            E.AluI(AluAnd, kC, 0x01);
+            E.Shift(ShiftRight, RCX, 1);
+            E.Alu(AluOr, RCX, RSI);
+            break;
+        case OpINC:
+        case OpISB:
+            E.AluI(AluAdd, RCX, 1);
+            E.AluI(AluAnd, RCX, 0xff);
+            break;
+        case OpDEC:
+        case OpDCP:
+            E.AluI(AluSub, RCX, 1);
+            E.AluI(AluAnd, RCX, 0xff);
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+
+    // What the combined unofficial opcodes do to A with the new value in RCX
+    void Combine(Op op) {
+        switch (op) {
+        case OpSLO:
+            E.Alu(AluOr, kA, RCX);
+            SetNZ(kA);
+            break;
+        case OpRLA:
+            E.Alu(AluAnd, kA, RCX);
+            SetNZ(kA);
+            break;
+        case OpSRE:
+            E.Alu(AluXor, kA, RCX);
+            SetNZ(kA);
+            break;
+        case OpDCP:
+            Compare(kA);
+            break;
+        case OpRRA:
+        case OpISB:
+            // As CPUCore6502: the sum's carry is worked out from the 8 bit
+            // result, < for RRA and <= for ISB
+            if (op == OpISB) {
+                E.AluI(AluXor, RCX, 0xff);
+            }
+            E.MovRR(RAX, kA);
+            E.Alu(AluAdd, kA, RCX);
+            E.Alu(AluAdd, kA, kC);
+            E.AluI(AluAnd, kA, 0xff);
+            E.Alu(AluCmp, kA, RAX);
+            E.Setcc(op == OpISB ? CondBE : CondB, kC);
+            Overflow(RCX, RAX, kA);
+            SetNZ(kA);
+            break;
+        default:
+            SetNZ(RCX);
+            break;
+        }
+    }
+
+    // Pushes count bytes, from values or the registers in regs when the
+    // value is -1, after one check that the stack page is plain memory
+    void PushBytes(const int* values, const Reg* regs, uint32_t count) {
+        E.MovRM64(RDX, At(kWritePages, 8));
+        E.Test64(RDX, RDX);
+        E.Jcc(CondE, SideExitLabel());
+        E.MovRM(RAX, Field(offsetof(Recompiler::Context, SP)));
+        for (uint32_t i = 0; i < count; i++) {
+            if (values[i] >= 0) {
+                E.MovMI8(kOperand, (uint8_t)values[i]);
+            } else {
+                E.MovMR8(kOperand, regs[i]);
+            }
+            E.AluI(AluSub, RAX, 1);
+            E.AluI(AluAnd, RAX, 0xff);
+            CountWrite();
+        }
+        E.MovMR(Field(offsetof(Recompiler::Context, SP)), RAX);
+    }
+
+    void StackCheckPop() {
+        E.MovRM64(RDX, At(kReadPages, 8));
+        E.Test64(RDX, RDX);
+        E.Jcc(CondE, SideExitLabel());
+        E.MovRM(RAX, Field(offsetof(Recompiler::Context, SP)));
+    }
+
+    void PopByte(Reg reg) {
+        E.AluI(AluAdd, RAX, 1);
+        E.AluI(AluAnd, RAX, 0xff);
+        E.MovzxRM8(reg, kOperand);
+    }
+
+    void StorePoppedSP() {
+        E.MovMR(Field(offsetof(Recompiler::Context, SP)), RAX);
+    }
+
+    // Emits one instruction, returning true if it ends the block
+    bool Translate(Op op, const CPUCore6502::InstructionDetails& details, const uint8_t* bytes, uint16_t next) {
+        uint32_t mode = details.AddresingMode;
+        uint32_t cost = details.PageCrossCycleCost;
+        bool crossing = cost != 0 && CanCross(mode);
+        uint32_t cycles = m_Cycles + details.CycleCount;
+        uint16_t absolute = (uint16_t)(bytes[1] | bytes[2] << 8);
+
+        if (IsBranch(op)) {
+            uint16_t target = (uint16_t)(next + (int8_t)bytes[1]);
+            uint32_t taken = 1 + ((next & 0xff00) != (target & 0xff00) ? cost : 0);
+
+            Label notTaken;
+            switch (op) {
+            case OpBCC: E.Test8(kC, kC); E.Jcc(CondNE, notTaken); break;
+            case OpBCS: E.Test8(kC, kC); E.Jcc(CondE, notTaken); break;
+            case OpBNE: E.Test8(kZ, kZ); E.Jcc(CondE, notTaken); break;
+            case OpBEQ: E.Test8(kZ, kZ); E.Jcc(CondNE, notTaken); break;
+            case OpBPL: E.TestI8(kN, 0x80); E.Jcc(CondNE, notTaken); break;
+            case OpBMI: E.TestI8(kN, 0x80); E.Jcc(CondE, notTaken); break;
+            case OpBVC: E.Test8(kV, kV); E.Jcc(CondNE, notTaken); break;
+            case OpBVS: E.Test8(kV, kV); E.Jcc(CondE, notTaken); break;
+            default: break;
+            }
+            Exit(target, cycles + taken, m_Index + 1, m_PC);
+            E.Bind(notTaken);
+            return false;
+        }
+
+        if (IsStore(op)) {
+            Operand(mode, bytes, kWritePages, crossing);
+            AddCrossing(crossing ? cost : 0);
+            Reg value = op == OpSTA ? kA : op == OpSTX ? kX : op == OpSTY ? kY : RCX;
+            if (op == OpSAX) {
+                E.MovRR(RCX, kA);
+                E.Alu(AluAnd, RCX, kX);
+            }
+            E.MovMR8(kOperand, value);
+            CountWrite();
+            return false;
+        }
+
+        if (IsReadModifyWrite(op)) {
+            if (mode == CPUCore6502::AddressingModeAccumulator) {
+                E.MovRR(RCX, kA);
+                Modify(op);
+                E.MovRR(kA, RCX);
+                SetNZ(kA);
+                return false;
+            }
+
+            // Plain memory writes read back as the same bytes, so the write
+            // page does for both
+            Operand(mode, bytes, kWritePages, crossing);
+            AddCrossing(crossing ? cost : 0);
+            E.MovzxRM8(RCX, kOperand);
+            Modify(op);
+            E.MovMR8(kOperand, RCX);
+            CountWrite();
+            Combine(op);
+            return false;
+        }
+
+        switch (op) {
+        case OpLDA: case OpLDX: case OpLDY: case OpLAX:
+        case OpAND: case OpORA: case OpEOR:
+        case OpADC: case OpSBC:
+        case OpCMP: case OpCPX: case OpCPY:
+        case OpBIT:
+            if (mode == CPUCore6502::AddressingModeImmediate) {
+                E.MovRI(RCX, bytes[1]);
+            } else {
+                Operand(mode, bytes, kReadPages, crossing);
+                AddCrossing(crossing ? cost : 0);
+                E.MovzxRM8(RCX, kOperand);
+            }
+            break;
+        default:
+            break;
+        }
+
+        switch (op) {
+        case OpLDA: E.MovRR(kA, RCX); SetNZ(kA); break;
+        case OpLDX: E.MovRR(kX, RCX); SetNZ(kX); break;
+        case OpLDY: E.MovRR(kY, RCX); SetNZ(kY); break;
+        case OpLAX: E.MovRR(kA, RCX); E.MovRR(kX, RCX); SetNZ(kA); break;
+        case OpAND: E.Alu(AluAnd, kA, RCX); SetNZ(kA); break;
+        case OpORA: E.Alu(AluOr, kA, RCX); SetNZ(kA); break;
+        case OpEOR: E.Alu(AluXor, kA, RCX); SetNZ(kA); break;
+        case OpADC: AddWithCarry(); break;
+        case OpSBC: E.AluI(AluXor, RCX, 0xff); AddWithCarry(); break;
+        case OpCMP: Compare(kA); break;
+        case OpCPX: Compare(kX); break;
+        case OpCPY: Compare(kY); break;
+        case OpBIT:
+            E.MovRR(kN, RCX);
+            E.MovRR(kV, RCX);
+            E.Shift(ShiftRight, kV, 6);
+            E.AluI(AluAnd, kV, 0x01);
+            E.MovRR(kZ, kA);
+            E.Alu(AluAnd, kZ, RCX);
+            break;
+
+        case OpNOP:
+            if (crossing) {
+                E.MovRI(RSI, bytes[1]);
+                E.Alu(AluAdd, RSI, mode == CPUCore6502::AddressingModeAbsoluteY ? kY : kX);
+                E.Shift(ShiftRight, RSI, 8);
+                AddCrossing(cost);
+            }
+            break;
+
+        case OpINX: E.AluI(AluAdd, kX, 1); E.AluI(AluAnd, kX, 0xff); SetNZ(kX); break;
+        case OpINY: E.AluI(AluAdd, kY, 1); E.AluI(AluAnd, kY, 0xff); SetNZ(kY); break;
+        case OpDEX: E.AluI(AluSub, kX, 1); E.AluI(AluAnd, kX, 0xff); SetNZ(kX); break;
+        case OpDEY: E.AluI(AluSub, kY, 1); E.AluI(AluAnd, kY, 0xff); SetNZ(kY); break;
+        case OpTAX: E.MovRR(kX, kA); SetNZ(kX); break;
+        case OpTAY: E.MovRR(kY, kA); SetNZ(kY); break;
+        case OpTXA: E.MovRR(kA, kX); SetNZ(kA); break;
+        case OpTYA: E.MovRR(kA, kY); SetNZ(kA); break;
+        case OpTSX: E.MovRM(kX, Field(offsetof(Recompiler::Context, SP))); SetNZ(kX); break;
+        case OpTXS: E.MovMR(Field(offsetof(Recompiler::Context, SP)), kX); break;
+
+        case OpCLC: E.MovRI(kC, 0); break;
+        case OpSEC: E.MovRI(kC, 1); break;
+        case OpCLV: E.MovRI(kV, 0); break;
+        case OpCLD: SetP(AluAnd, ~0x08u); break;
+        case OpSED: SetP(AluOr, 0x08); break;
+
+        // Changing I changes when an IRQ can be taken, which the caller
+        // checks
+        case OpCLI:
+            SetP(AluAnd, ~0x04u);
+            Exit(next, cycles, m_Index + 1, m_PC);
+            return true;
+        case OpSEI:
+            SetP(AluOr, 0x04);
+            Exit(next, cycles, m_Index + 1, m_PC);
+            return true;
+
+        case OpPHA: {
+            static const int kValues[] = { -1 };
+            static const Reg kRegs[] = { kA };
+            PushBytes(kValues, kRegs, 1);
+            break;
+        }
+        case OpPHP: {
+            // B is pushed set
+            static const int kValues[] = { -1 };
+            static const Reg kRegs[] = { RSI };
+            PackP();
+            E.MovRR(RSI, RCX);
+            E.AluI(AluOr, RSI, 0x10);
+            PushBytes(kValues, kRegs, 1);
+            break;
+        }
+        case OpPLA:
+            StackCheckPop();
+            PopByte(kA);
+            StorePoppedSP();
+            SetNZ(kA);
+            break;
+        case OpPLP:
+            // B and the unused bit aren't really there
+            StackCheckPop();
+            PopByte(RCX);
+            StorePoppedSP();
+            E.AluI(AluAnd, RCX, 0xef);
+            E.AluI(AluOr, RCX, 0x20);
+            UnpackP(RCX);
+            Exit(next, cycles, m_Index + 1, m_PC);
+            return true;
+
+        case OpJMP:
+            if (mode == CPUCore6502::AddressingModeIndirect) {
+                // The high byte comes from the same page as the low
+                // https://everything2.com/title/6502+indirect+JMP+bug
+                uint16_t high = (uint16_t)((absolute & 0xff00) | ((absolute + 1) & 0x00ff));
+                StaticPage(kReadPages, absolute);
+                E.MovzxRM8(RCX, At(RDX, absolute & 0xff));
+                E.MovzxRM8(RSI, At(RDX, high & 0xff));
+                E.Shift(ShiftLeft, RSI, 8);
+                E.Alu(AluOr, RCX, RSI);
+                ExitTo(RCX, cycles);
+            } else {
+                Exit(absolute, cycles, m_Index + 1, m_PC);
+            }
+            return true;
+        case OpJSR: {
+            // Pushes the address of its own last byte
+            uint16_t ret = (uint16_t)(next - 1);
+            const int values[] = { ret >> 8, ret & 0xff };
+            static const Reg kRegs[] = { NoReg, NoReg };
+            PushBytes(values, kRegs, 2);
+            Exit(absolute, cycles, m_Index + 1, m_PC);
+            return true;
+        }
+        case OpRTS:
+            StackCheckPop();
+            PopByte(RCX);
+            PopByte(RSI);
+            StorePoppedSP();
+            E.Shift(ShiftLeft, RSI, 8);
+            E.Alu(AluOr, RCX, RSI);
+            E.AluI(AluAdd, RCX, 1);
+            E.AluI(AluAnd, RCX, 0xffff);
+            ExitTo(RCX, cycles);
+            return true;
+        case OpRTI:
+            StackCheckPop();
+            PopByte(RCX);
+            E.AluI(AluAnd, RCX, 0xef);
+            E.AluI(AluOr, RCX, 0x20);
+            UnpackP(RCX);
+            PopByte(RCX);
+            PopByte(RSI);
+            StorePoppedSP();
+            E.Shift(ShiftLeft, RSI, 8);
+            E.Alu(AluOr, RCX, RSI);
+            ExitTo(RCX, cycles);
+            return true;
+
+        default:
+            break;
+        }
+
+        return false;
+    }
+
+private:
+    uint8_t* const* m_ReadPages;
+    uint8_t* const* m_DirectWritePages;
+
+    uint16_t m_PC;          // of the instruction being translated
+    uint16_t m_LastPC;      // of the one before it
+    uint32_t m_Index;       // instructions before it
+    uint32_t m_Cycles;      // their cycles, less page crossings
+    int32_t m_SideExit;     // its side exit in m_SideExits, -1 == none yet
+
+    std::deque<SideExit> m_SideExits;
+    Label m_Epilogue;
+};
+
+}
+
+static std::mutex s_PerfMapLock;
+static FILE* s_PerfMap = nullptr;
+
+// Code memory is never writable and executable at once: the pages a block
+// goes into are made writable for the copy and executable again after it
+static bool Protect(uint8_t* code, uint32_t from, uint32_t to, int protection) {
+    static const uint32_t pageSize = (uint32_t)sysconf(_SC_PAGESIZE);
+    from &= ~(pageSize - 1);
+    to = (to + pageSize - 1) & ~(pageSize - 1);
+    return mprotect(code + from, to - from, protection) == 0;
+}
+
+bool Recompiler::Supported() {
+    static const bool supported = []() {
+        void* memory = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+        bool executable = mprotect(memory, 4096, PROT_READ | PROT_EXEC) == 0;
+        munmap(memory, 4096);
+        return executable;
+    }();
+    return supported;
+}
+
+bool Recompiler::Translates(uint8_t opcode) {
+    const CPUCore6502::InstructionDetails& details = CPUCore6502::Details(opcode);
+    return OpFor(details.Delegate) != OpNone && details.InstructionSize != 0;
+}
+
+Recompiler::Recompiler(MemoryMap& memory, const Options& options) :
+    m_Memory(memory),
+    m_Options(options),
+    m_Blocks(0x10000, nullptr),
+    m_Heat(0x10000, 0),
+    m_Code(nullptr),
+    m_CodeSize(0),
+    m_CodeUsed(0),
+    m_Translated(0) {
+
+    m_Options.HotCount = std::min(std::max(m_Options.HotCount, 1u), 255u);
+    m_Options.MaxInstructions = std::max(m_Options.MaxInstructions, 1u);
+
+    // Nothing's accessible until a block is copied in
+    void* code = mmap(nullptr, kCodeSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        m_Code = (uint8_t*)code;
+        m_CodeSize = kCodeSize;
+    }
+
+    memset(m_CodePages, 0, sizeof(m_CodePages));
+    MapPages();
+}
+
+Recompiler::~Recompiler() {
+    if (m_Code != nullptr) {
+        munmap(m_Code, m_CodeSize);
+    }
+}
+
+void Recompiler::MapPages() {
+    for (uint32_t page = 0; page < 256; page++) {
+        m_ReadPages[page] = m_Memory.DirectPage((uint8_t)page, false);
+        m_DirectWritePages[page] = m_Memory.DirectPage((uint8_t)page, true);
+        m_WritePages[page] = m_CodePages[page] ? nullptr : m_DirectWritePages[page];
+    }
+}
+
+uint32_t Recompiler::Run(CPUCore6502::CPUCore6502State& registers, uint64_t& cycles, uint64_t limit, uint16_t& lastPC) {
+    uint16_t pc = registers.PC;
+    Block* block = m_Blocks[pc];
+
+    if (block == nullptr) {
+        if (m_Heat[pc] + 1u < m_Options.HotCount) {
+            m_Heat[pc]++;
+            return 0;
+        }
+        block = Translate(pc);
+        if (block == nullptr) {
+            return 0;
+        }
+    }
+
+    // Only whole blocks run, so one that might reach limit is left to the
+    // interpreter
+    if (block->Instructions == 0 || cycles + block->MaxCycles >= limit) {
+        return 0;
+    }
+
+    Context context;
+    context.ReadPages = m_ReadPages;
+    context.WritePages = m_WritePages;
+    context.Cycles = cycles;
+    context.A = registers.A;
+    context.X = registers.X;
+    context.Y = registers.Y;
+    context.SP = registers.SP;
+    context.P = registers.P;
+    context.PC = pc;
+    context.LastPC = pc;
+    context.Instructions = 0;
+    context.Writes = 0;
+
+    block->Code(&context);
+
+    registers.A = (uint8_t)context.A;
+    registers.X = (uint8_t)context.X;
+    registers.Y = (uint8_t)context.Y;
+    registers.SP = (uint8_t)context.SP;
+    registers.P = (uint8_t)context.P;
+    registers.PC = (uint16_t)context.PC;
+    cycles = context.Cycles;
+
+    m_Memory.CountWrites(context.Writes);
+    m_Translated += context.Instructions;
+    lastPC = (uint16_t)context.LastPC;
+    return context.Instructions;
+}
+
+Recompiler::Block* Recompiler::Translate(uint16_t pc) {
+    if (m_Code == nullptr) {
+        return nullptr;
+    }
+
+    BlockBuilder builder(m_ReadPages, m_DirectWritePages);
+    Block block = { pc, pc, 0, 0, nullptr };
+    block.Instructions = builder.Build(pc, m_Options.MaxInstructions, block.End, block.MaxCycles);
+
+    if (block.Instructions > 0) {
+        uint32_t size = builder.E.Size();
+        if (m_CodeUsed + size > m_CodeSize) {
+            InvalidateAll();
+        }
+        if (m_CodeUsed + size > m_CodeSize) {
+            return nullptr;
+        }
+
+        if (!Protect(m_Code, m_CodeUsed, m_CodeUsed + size, PROT_READ | PROT_WRITE)) {
+            return nullptr;
+        }
+        memcpy(m_Code + m_CodeUsed, builder.E.Code.data(), size);
+        if (!Protect(m_Code, m_CodeUsed, m_CodeUsed + size, PROT_READ | PROT_EXEC)) {
+            return nullptr;
+        }
+        block.Code = (BlockCode)(m_Code + m_CodeUsed);
+        m_CodeUsed += size;
+
+        if (m_Options.PerfMap) {
+            WritePerfMap(block, size);
+        }
+    }
+
+    // An address with nothing translatable is remembered too, so it isn't
+    // looked at again every time.  It doesn't claim its page: if the code
+    // there changes it just stays interpreted until everything is flushed.
+    m_BlockStore.push_back(block);
+    Block* stored = &m_BlockStore.back();
+    m_Blocks[pc] = stored;
+
+    if (block.Instructions > 0) {
+        for (uint32_t page = block.Start >> 8; page <= ((block.End - 1u) >> 8); page++) {
+            m_PageBlocks[page].push_back(pc);
+            m_CodePages[page] = 1;
+            m_WritePages[page] = nullptr;
+        }
+    }
+
+    return stored;
+}
+
+void Recompiler::InvalidatePage(uint32_t page) {
+    for (uint16_t pc : m_PageBlocks[page]) {
+        Block* block = m_Blocks[pc];
+        if (block != nullptr) {
+            if ((uint32_t)(block->Start >> 8) <= page && page <= ((block->End - 1u) >> 8)) {
+                m_Blocks[pc] = nullptr;
+                m_Heat[pc] = 0;
+            }
+        }
+    }
+
+    m_PageBlocks[page].clear();
+    m_CodePages[page] = 0;
+    m_WritePages[page] = m_DirectWritePages[page];
+}
+
+void Recompiler::InvalidateAll() {
+    std::fill(m_Blocks.begin(), m_Blocks.end(), nullptr);
+    std::fill(m_Heat.begin(), m_Heat.end(), 0);
+    m_BlockStore.clear();
+    for (uint32_t page = 0; page < 256; page++) {
+        m_PageBlocks[page].clear();
+    }
+    memset(m_CodePages, 0, sizeof(m_CodePages));
+    m_CodeUsed = 0;
+    MapPages();
+}
+
+void Recompiler::WritePerfMap(const Block& block, uint32_t size) {
+    // http://git.kernel.org/cgit/linux/kernel/git/torvalds/linux.git/tree/tools/perf/Documentation/jit-interface.txt
+    std::lock_guard<std::mutex> lock(s_PerfMapLock);
+    if (s_PerfMap == nullptr) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        s_PerfMap = fopen(path, "w");
+        if (s_PerfMap == nullptr) {
+            m_Options.PerfMap = false;
+            return;
+        }
+    }
+    fprintf(s_PerfMap, "%llx %x 6502_%04X_%04X\n", (unsigned long long)(uintptr_t)block.Code, size, block.Start, block.End);
+    fflush(s_PerfMap);
+}
+
+#else
+
+bool Recompiler::Supported() {
+    return false;
+}
+
+bool Recompiler::Translates(uint8_t opcode) {
+    return false;
+}
+
+Recompiler::Recompiler(MemoryMap& memory, const Options& options) :
+    m_Memory(memory),
+    m_Options(options),
+    m_Code(nullptr),
+    m_CodeSize(0),
+    m_CodeUsed(0),
+    m_Translated(0) {
+    memset(m_CodePages, 0, sizeof(m_CodePages));
+}
+
+Recompiler::~Recompiler() {
+}
+
+uint32_t Recompiler::Run(CPUCore6502::CPUCore6502State& registers, uint64_t& cycles, uint64_t limit, uint16_t& lastPC) {
+    return 0;
+}
+
+void Recompiler::InvalidatePage(uint32_t page) {
+}
+
+void Recompiler::InvalidateAll() {
+}
+
+#endif
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "6502Core.h"
+
+// The recompiler is x86-64 machine code for the System V ABI.  Building with
+// RAUNNES_JIT=0 leaves it out on those hosts too; without it
+// Recompiler::Supported() is false and everything runs interpreted.
+#ifndef RAUNNES_JIT
+#if defined(__x86_64__) && defined(__linux__)
+#define RAUNNES_JIT 1
+#else
+#define RAUNNES_JIT 0
+#endif
+#endif
+
+namespace raunnes {
+
+class MemoryMap;
+
+// Translates hot 6502 code into x86-64 and runs it in place of the
+// interpreter, with exactly the same results.
+//
+// A block is straight line code from one address up to the first jump,
+// taken branch, or instruction it can't translate, with A, X, Y, the flags
+// and the cycle count held in host registers throughout.  Blocks only run
+// when they're sure to finish before the caller's limit (the end of the run
+// or a pending IRQ), so nothing that's checked between instructions can
+// come due inside one, and cycles are added up once at each exit.
+//
+// Translated code only touches memory MemoryMap::DirectPage() hands out:
+// RAM, PRG-RAM and ROM.  Anything else, a PPU or APU register say, leaves
+// the block just before the instruction so the interpreter runs it at the
+// right cycle.  So do writes to pages code was translated from; those go
+// through MemoryMap::Write(), which tells the recompiler to drop the
+// page's blocks.
+//
+// Blocks start once an address has been reached HotCount times.  With
+// PerfMap set, every block is listed in /tmp/perf-<pid>.map so perf can
+// put names to samples in translated code.
+class Recompiler {
+public:
+    struct Options {
+        uint32_t HotCount;          // times an address is reached before it's translated, 1 == at once
+        uint32_t MaxInstructions;   // per block
+        bool PerfMap;
+    };
+
+    static const Options kDefaultOptions;
+
+public:
+    // False when this build or host has no recompiler, or the OS won't let
+    // memory that was written be made executable
+    static bool Supported();
+
+    // Whether opcode can be part of a block.  The rest are always the
+    // interpreter's: BRK, KIL and the unofficial opcodes without a delegate.
+    static bool Translates(uint8_t opcode);
+
+    Recompiler(MemoryMap& memory, const Options& options);
+    ~Recompiler();
+
+    // Runs the block at registers.PC if there is one that ends before limit,
+    // translating it first once it's hot.  Returns the instructions it ran,
+    // 0 when the next one is the interpreter's; lastPC is where the last one
+    // was.
+    uint32_t Run(CPUCore6502::CPUCore6502State& registers, uint64_t& cycles, uint64_t limit, uint16_t& lastPC);
+
+    // Called by MemoryMap for every write through Write() that changes memory
+    void Written(uint16_t address) {
+        if (m_CodePages[address >> 8]) {
+            InvalidatePage(address >> 8);
+        }
+    }
+
+    bool HasCode(uint32_t page) const { return m_CodePages[page] != 0; }
+    void InvalidatePage(uint32_t page);
+
+    // Drops every block, and picks up changes to MemoryMap::DirectPage()
+    void InvalidateAll();
+
+    // Instructions run as translated code
+    uint64_t Translated() const { return m_Translated; }
+
+public:
+    Recompiler(const Recompiler&) = delete;
+    Recompiler& operator=(const Recompiler&) = delete;
+
+public:
+    // What a block reads its registers from and leaves them in
+    struct Context {
+        uint8_t* const* ReadPages;
+        uint8_t* const* WritePages;
+        uint64_t Cycles;
+        uint32_t A;
+        uint32_t X;
+        uint32_t Y;
+        uint32_t SP;
+        uint32_t P;
+        uint32_t PC;
+        uint32_t LastPC;
+        uint32_t Instructions;
+        uint32_t Writes;
+    };
+
+    typedef void (*BlockCode)(Context* context);
+
+    struct Block {
+        uint16_t Start;
+        uint16_t End;               // one past its last byte
+        uint32_t Instructions;      // 0 == nothing translatable here
+        uint32_t MaxCycles;
+        BlockCode Code;
+    };
+
+private:
+    Block* Translate(uint16_t pc);
+    void MapPages();
+    void WritePerfMap(const Block& block, uint32_t size);
+
+private:
+    MemoryMap& m_Memory;
+    Options m_Options;
+
+    std::vector<Block*> m_Blocks;               // by start address
+    std::vector<uint8_t> m_Heat;                // by address, until it's translated
+    std::deque<Block> m_BlockStore;
+    std::vector<uint16_t> m_PageBlocks[256];    // blocks covering each page
+    uint8_t m_CodePages[256];
+
+    // DirectPage() for reads and writes, with pages holding translated code
+    // taken out of the writes
+    uint8_t* m_ReadPages[256];
+    uint8_t* m_WritePages[256];
+    uint8_t* m_DirectWritePages[256];
+
+    uint8_t* m_Code;
+    uint32_t m_CodeSize;
+    uint32_t m_CodeUsed;
+
+    uint64_t m_Translated;
+};
+
+}
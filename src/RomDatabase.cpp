@@ -0,0 +1,145 @@
+#include "RomDatabase.h"
+
+#include "Cartridge.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Set by CMakeLists.txt; otherwise the database has to be found from where
+// the binary runs
+#ifndef RAUNNES_ROMDB_PATH
+#define RAUNNES_ROMDB_PATH "deps/romdb.txt"
+#endif
+
+namespace raunnes {
+
+RomDatabase::RomDatabase() {
+}
+
+RomDatabase::~RomDatabase() {
+}
+
+bool RomDatabase::Load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.good()) {
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+
+    return Parse(ss.str());
+}
+
+std::string RomDatabase::DefaultPath() {
+    return RAUNNES_ROMDB_PATH;
+}
+
+bool RomDatabase::Parse(const std::string& text) {
+    std::istringstream lines(text);
+    std::string line;
+    uint32_t lineNumber = 0;
+    bool ok = true;
+
+    while (std::getline(lines, line)) {
+        lineNumber++;
+
+        size_t comment = line.find_first_of("#;");
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field)) {
+            continue;
+        }
+
+        char* end = nullptr;
+        uint32_t crc = (uint32_t)strtoul(field.c_str(), &end, 16);
+        if (field.size() != 8 || *end != '\0') {
+            std::cerr << "romdb:" << lineNumber << ": bad crc32 '" << field << "'\n";
+            ok = false;
+            continue;
+        }
+
+        Entry entry = { "", -1, -1, -1, -1, -1 };
+        bool valid = true;
+
+        while (fields >> field) {
+            size_t eq = field.find('=');
+            std::string key = field.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+
+            if (key == "sha1") {
+                entry.Sha1 = value;
+            } else if (key == "mapper") {
+                entry.Mapper = atoi(value.c_str());
+            } else if (key == "mirroring") {
+                if (value == "horizontal") {
+                    entry.Mirroring = Cartridge::MirroringHorizontal;
+                } else if (value == "vertical") {
+                    entry.Mirroring = Cartridge::MirroringVertical;
+                } else if (value == "four") {
+                    entry.Mirroring = Cartridge::MirroringFourScreen;
+                } else {
+                    valid = false;
+                }
+            } else if (key == "region") {
+                if (value == "ntsc") {
+                    entry.Region = Cartridge::RegionNTSC;
+                } else if (value == "pal") {
+                    entry.Region = Cartridge::RegionPAL;
+                } else if (value == "dendy") {
+                    entry.Region = Cartridge::RegionDendy;
+                } else {
+                    valid = false;
+                }
+            } else if (key == "battery") {
+                entry.Battery = value == "1";
+            } else if (key == "ppu") {
+                if (value == "scanline") {
+                    entry.PPUAccuracy = Cartridge::PPUAccuracyScanline;
+                } else if (value == "dot") {
+                    entry.PPUAccuracy = Cartridge::PPUAccuracyDot;
+                } else {
+                    valid = false;
+                }
+            } else {
+                valid = false;
+            }
+
+            if (!valid) {
+                std::cerr << "romdb:" << lineNumber << ": bad field '" << field << "'\n";
+                break;
+            }
+        }
+
+        if (!valid) {
+            ok = false;
+            continue;
+        }
+
+        m_Entries.emplace(crc, entry);
+    }
+
+    return ok;
+}
+
+const RomDatabase::Entry* RomDatabase::Find(uint32_t crc32, const std::string& sha1) const {
+    auto range = m_Entries.equal_range(crc32);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.Sha1.empty() || it->second.Sha1 == sha1) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+size_t RomDatabase::Size() const {
+    return m_Entries.size();
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace raunnes {
+
+// Known-good header values keyed by ROM fingerprint.  Plenty of dumps in the
+// wild carry wrong iNES headers; an entry here overrides whatever the header
+// claims.  Fields that are not set in an entry are left as the header has them.
+//
+// File format, one ROM per line:
+//
+//   <crc32> [sha1=<hex>] [mapper=<n>] [mirroring=horizontal|vertical|four] [region=ntsc|pal|dendy] [battery=0|1] [ppu=scanline|dot] [; comment]
+//
+// crc32 is over PRG followed by CHR with the header stripped.  When sha1 is
+// given it has to match as well.  ppu isn't a header field; it picks the PPU
+// accuracy the ROM needs.
+class RomDatabase {
+public:
+    struct Entry {
+        std::string Sha1;
+        int Mapper;         // -1 == leave as is
+        int Mirroring;      // -1 == leave as is, otherwise Cartridge::Mirroring
+        int Region;         // -1 == leave as is, otherwise Cartridge::Region
+        int Battery;        // -1 == leave as is
+        int PPUAccuracy;    // -1 == default, otherwise Cartridge::PPUAccuracy
+    };
+
+public:
+    RomDatabase();
+    ~RomDatabase();
+
+    bool Load(const std::string& path);
+    bool Parse(const std::string& text);
+
+    // deps/romdb.txt in the source tree the binary was built from
+    static std::string DefaultPath();
+
+    const Entry* Find(uint32_t crc32, const std::string& sha1) const;
+
+    size_t Size() const;
+
+public:
+    RomDatabase(const RomDatabase&) = delete;
+    RomDatabase& operator=(const RomDatabase&) = delete;
+
+private:
+    std::unordered_multimap<uint32_t, Entry> m_Entries;
+};
+
+}
@@ -0,0 +1,481 @@
+#include "RomHash.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAUNNES_X86 1
+#endif
+
+namespace raunnes {
+
+namespace {
+
+// Reflected CRC32 polynomial
+const uint32_t kCrc32Poly = 0xedb88320;
+
+struct Crc32Table {
+    uint32_t Entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ kCrc32Poly : c >> 1;
+            }
+            Entries[i] = c;
+        }
+    }
+};
+
+const Crc32Table g_Crc32Table;
+
+uint32_t Crc32Scalar(const uint8_t* data, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; i++) {
+        crc = g_Crc32Table.Entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if RAUNNES_X86
+// Folding with carry-less multiplies, from Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction".  The constants are the
+// bit-reflected x^n mod P values for the CRC32 polynomial given in the paper.
+//
+// Takes and returns the raw (non-inverted) CRC register.  size must be a
+// multiple of 16 and at least 64.
+__attribute__((target("pclmul,sse4.1")))
+uint32_t Crc32Pclmul(const uint8_t* data, size_t size, uint32_t crc) {
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+
+    data += 64;
+    size -= 64;
+
+    // Fold four lanes of 128 bits in parallel
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        data += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Remaining 16 byte blocks
+    while (size >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*)data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+bool HasPclmul() {
+    static const bool has = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    return has;
+}
+#endif
+
+// a * b mod P, in the reflected domain.  Used to shift a CRC by n zero bytes.
+uint32_t MultModP(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ kCrc32Poly : b >> 1;
+    }
+    return p;
+}
+
+// x^(2^k) mod P for k = 0..31
+struct X2NTable {
+    uint32_t Entries[32];
+
+    X2NTable() {
+        uint32_t p = 1u << 30;     // x^1
+        Entries[0] = p;
+        for (int n = 1; n < 32; n++) {
+            Entries[n] = p = MultModP(p, p);
+        }
+    }
+};
+
+const X2NTable g_X2NTable;
+
+// x^(n * 2^k) mod P
+uint32_t X2NModP(size_t n, unsigned k) {
+    uint32_t p = 1u << 31;     // x^0
+    while (n) {
+        if (n & 1) {
+            p = MultModP(g_X2NTable.Entries[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+//
+// SHA-1
+//
+// https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf
+//
+
+typedef void (*Sha1BlockFunction)(uint32_t state[5], const uint8_t* data, size_t blocks);
+
+inline uint32_t Rol(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+void Sha1BlocksScalar(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    for (; blocks > 0; blocks--, data += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+
+        uint32_t t;
+        for (int i = 0; i < 20; i++) {
+            t = Rol(a, 5) + ((b & c) | (~b & d)) + e + 0x5a827999 + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = t;
+        }
+        for (int i = 20; i < 40; i++) {
+            t = Rol(a, 5) + (b ^ c ^ d) + e + 0x6ed9eba1 + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = t;
+        }
+        for (int i = 40; i < 60; i++) {
+            t = Rol(a, 5) + ((b & c) | (b & d) | (c & d)) + e + 0x8f1bbcdc + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = t;
+        }
+        for (int i = 60; i < 80; i++) {
+            t = Rol(a, 5) + (b ^ c ^ d) + e + 0xca62c1d6 + w[i];
+            e = d; d = c; c = Rol(b, 30); b = a; a = t;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#if RAUNNES_X86
+// SHA extensions version.  Each step does four rounds; the message schedule
+// runs three steps ahead of the rounds using sha1msg1 / xor / sha1msg2.
+#define RAUNNES_SHA1_STEP(g)                                                    \
+    {                                                                           \
+        __m128i& ecur = e[(g) & 1];                                             \
+        __m128i& enext = e[((g) + 1) & 1];                                      \
+        if ((g) == 0) {                                                         \
+            ecur = _mm_add_epi32(ecur, msg[0]);                                 \
+        } else {                                                                \
+            ecur = _mm_sha1nexte_epu32(ecur, msg[(g) & 3]);                     \
+        }                                                                       \
+        enext = abcd;                                                           \
+        if ((g) >= 3 && (g) <= 18) {                                            \
+            msg[((g) + 1) & 3] = _mm_sha1msg2_epu32(msg[((g) + 1) & 3], msg[(g) & 3]); \
+        }                                                                       \
+        abcd = _mm_sha1rnds4_epu32(abcd, ecur, (g) / 5);                        \
+        if ((g) >= 1 && (g) <= 16) {                                            \
+            msg[((g) + 3) & 3] = _mm_sha1msg1_epu32(msg[((g) + 3) & 3], msg[(g) & 3]); \
+        }                                                                       \
+        if ((g) >= 2 && (g) <= 17) {                                            \
+            msg[((g) + 2) & 3] = _mm_xor_si128(msg[((g) + 2) & 3], msg[(g) & 3]); \
+        }                                                                       \
+    }
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void Sha1BlocksShaNi(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_loadu_si128((const __m128i*)state);
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abcdSave = abcd;
+        __m128i e0Save = e0;
+
+        __m128i msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), byteSwap);
+        }
+
+        __m128i e[2] = { e0, e0 };
+
+        RAUNNES_SHA1_STEP(0)  RAUNNES_SHA1_STEP(1)  RAUNNES_SHA1_STEP(2)  RAUNNES_SHA1_STEP(3)
+        RAUNNES_SHA1_STEP(4)  RAUNNES_SHA1_STEP(5)  RAUNNES_SHA1_STEP(6)  RAUNNES_SHA1_STEP(7)
+        RAUNNES_SHA1_STEP(8)  RAUNNES_SHA1_STEP(9)  RAUNNES_SHA1_STEP(10) RAUNNES_SHA1_STEP(11)
+        RAUNNES_SHA1_STEP(12) RAUNNES_SHA1_STEP(13) RAUNNES_SHA1_STEP(14) RAUNNES_SHA1_STEP(15)
+        RAUNNES_SHA1_STEP(16) RAUNNES_SHA1_STEP(17) RAUNNES_SHA1_STEP(18) RAUNNES_SHA1_STEP(19)
+
+        // Step 19 left the pre-round abcd in e[0]
+        e0 = _mm_sha1nexte_epu32(e[0], e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    _mm_storeu_si128((__m128i*)state, abcd);
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#undef RAUNNES_SHA1_STEP
+#endif
+
+Sha1BlockFunction SelectSha1Blocks() {
+#if RAUNNES_X86
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        return Sha1BlocksShaNi;
+    }
+#endif
+    return Sha1BlocksScalar;
+}
+
+class Sha1Context {
+public:
+    explicit Sha1Context(Sha1BlockFunction blocks = SelectSha1Blocks()) :
+        m_Blocks(blocks),
+        m_Size(0),
+        m_Pending(0) {
+        m_State[0] = 0x67452301;
+        m_State[1] = 0xefcdab89;
+        m_State[2] = 0x98badcfe;
+        m_State[3] = 0x10325476;
+        m_State[4] = 0xc3d2e1f0;
+    }
+
+    void Update(const uint8_t* data, size_t size) {
+        m_Size += size;
+
+        if (m_Pending > 0) {
+            size_t n = 64 - m_Pending < size ? 64 - m_Pending : size;
+            memcpy(m_Buffer + m_Pending, data, n);
+            m_Pending += n;
+            data += n;
+            size -= n;
+
+            if (m_Pending < 64) {
+                return;
+            }
+            m_Blocks(m_State, m_Buffer, 1);
+            m_Pending = 0;
+        }
+
+        if (size >= 64) {
+            m_Blocks(m_State, data, size / 64);
+            data += size & ~(size_t)63;
+            size &= 63;
+        }
+
+        memcpy(m_Buffer, data, size);
+        m_Pending = size;
+    }
+
+    void Final(uint8_t digest[20]) {
+        uint64_t bits = m_Size * 8;
+
+        uint8_t pad[72] = { 0x80 };
+        size_t padSize = (m_Pending < 56 ? 56 : 120) - m_Pending;
+        for (int i = 0; i < 8; i++) {
+            pad[padSize + i] = (uint8_t)(bits >> (56 - i * 8));
+        }
+        Update(pad, padSize + 8);
+
+        for (int i = 0; i < 5; i++) {
+            digest[i * 4 + 0] = (uint8_t)(m_State[i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(m_State[i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(m_State[i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)(m_State[i]);
+        }
+    }
+
+private:
+    Sha1BlockFunction m_Blocks;
+    uint32_t m_State[5];
+    uint64_t m_Size;
+    uint8_t  m_Buffer[64];
+    size_t   m_Pending;
+};
+
+std::string Hex(const uint8_t* bytes, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+
+    std::string s(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        s[i * 2] = digits[bytes[i] >> 4];
+        s[i * 2 + 1] = digits[bytes[i] & 0xf];
+    }
+    return s;
+}
+
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+
+#if RAUNNES_X86
+    if (size >= 64 && HasPclmul()) {
+        size_t chunk = size & ~(size_t)15;
+        crc = Crc32Pclmul(data, chunk, crc);
+        data += chunk;
+        size -= chunk;
+    }
+#endif
+
+    crc = Crc32Scalar(data, size, crc);
+
+    return ~crc;
+}
+
+uint32_t Crc32Combine(uint32_t crcA, uint32_t crcB, size_t sizeB) {
+    return MultModP(X2NModP(sizeB, 3), crcA) ^ crcB;
+}
+
+void Sha1(const uint8_t* data, size_t size, uint8_t digest[20]) {
+    Sha1Context ctx;
+    ctx.Update(data, size);
+    ctx.Final(digest);
+}
+
+uint32_t Crc32Portable(const uint8_t* data, size_t size, uint32_t crc) {
+    return ~Crc32Scalar(data, size, ~crc);
+}
+
+void Sha1Portable(const uint8_t* data, size_t size, uint8_t digest[20]) {
+    Sha1Context ctx(Sha1BlocksScalar);
+    ctx.Update(data, size);
+    ctx.Final(digest);
+}
+
+bool Crc32Accelerated() {
+#if RAUNNES_X86
+    return HasPclmul();
+#else
+    return false;
+#endif
+}
+
+bool Sha1Accelerated() {
+    return SelectSha1Blocks() != Sha1BlocksScalar;
+}
+
+RomFingerprint RomFingerprint::Compute(const uint8_t* prg, size_t prgSize, const uint8_t* chr, size_t chrSize) {
+    RomFingerprint f;
+
+    f.PRGCrc32 = raunnes::Crc32(prg, prgSize);
+    f.CHRCrc32 = raunnes::Crc32(chr, chrSize);
+    f.Crc32 = Crc32Combine(f.PRGCrc32, f.CHRCrc32, chrSize);
+
+    Sha1Context ctx;
+    ctx.Update(prg, prgSize);
+    ctx.Update(chr, chrSize);
+    ctx.Final(f.Sha1);
+
+    return f;
+}
+
+std::string RomFingerprint::Crc32String() const {
+    char buf[9];
+    snprintf(buf, sizeof(buf), "%08x", Crc32);
+    return buf;
+}
+
+std::string RomFingerprint::Sha1String() const {
+    return Hex(Sha1, sizeof(Sha1));
+}
+
+std::string RomFingerprint::CacheKey() const {
+    return Crc32String() + "-" + Sha1String();
+}
+
+}
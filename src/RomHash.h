@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace raunnes {
+
+// CRC32 (IEEE 802.3, reflected, the same value zlib and the No-Intro / NES 2.0
+// databases use).  Pass the previous result as crc to continue a running hash.
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// CRC32 of A followed by B, given only crc(A), crc(B) and the length of B.
+uint32_t Crc32Combine(uint32_t crcA, uint32_t crcB, size_t sizeB);
+
+void Sha1(const uint8_t* data, size_t size, uint8_t digest[20]);
+
+// The same hashes without the PCLMULQDQ and SHA-NI paths, which is what the
+// accelerated ones are checked against (tests/hash/RomHash.cpp)
+uint32_t Crc32Portable(const uint8_t* data, size_t size, uint32_t crc = 0);
+void Sha1Portable(const uint8_t* data, size_t size, uint8_t digest[20]);
+
+// Whether Crc32() and Sha1() take the accelerated paths on this host
+bool Crc32Accelerated();
+bool Sha1Accelerated();
+
+struct RomFingerprint {
+    uint32_t PRGCrc32;
+    uint32_t CHRCrc32;
+    uint32_t Crc32;         // PRG followed by CHR, header excluded
+    uint8_t  Sha1[20];      // PRG followed by CHR, header excluded
+
+    static RomFingerprint Compute(const uint8_t* prg, size_t prgSize, const uint8_t* chr, size_t chrSize);
+
+    std::string Crc32String() const;
+    std::string Sha1String() const;
+
+    // Stable identity for anything derived from a ROM image and kept around,
+    // such as its save file.  Independent of the header bytes and the file
+    // name, so a fixed-up header or a renamed file still finds the same
+    // artifacts.
+    std::string CacheKey() const;
+};
+
+}
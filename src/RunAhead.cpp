@@ -0,0 +1,184 @@
+#include "RunAhead.h"
+
+#include "Cartridge.h"
+#include "Trace.h"
+
+#include <chrono>
+
+namespace raunnes {
+
+static uint64_t Elapsed(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+RunAhead::RunAhead(NESDriver& driver, const Cartridge* secondInstance) :
+    m_Driver(driver),
+    m_State(new NESDriver::State()),
+    m_Frames(0),
+    m_Exchange(nullptr),
+    m_SecondDraws(false),
+    m_Pending(false),
+    m_Quit(false),
+    m_PendingFrames(0),
+    m_FramesRun(0),
+    m_RealNs(0),
+    m_AddedNs(0),
+    m_SecondNs(0),
+    m_SecondRuns(0) {
+
+    // One save up front sizes everything in the state, so the per frame ones
+    // don't allocate
+    m_Driver.SaveState(*m_State);
+
+    if (secondInstance != nullptr) {
+        m_Second.reset(new NESDriver(*secondInstance));
+        m_Thread = std::thread(&RunAhead::RunSecondInstance, this);
+    }
+}
+
+RunAhead::~RunAhead() {
+    if (m_Thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Quit = true;
+        }
+        m_Wake.notify_one();
+        m_Thread.join();
+    }
+}
+
+void RunAhead::AttachFrameExchange(TripleBuffer<PPU::Frame>* frames) {
+    Wait();
+    m_Exchange = frames;
+    if (m_SecondDraws) {
+        m_Second->AttachFrameExchange(frames);
+    } else {
+        m_Driver.AttachFrameExchange(frames);
+    }
+}
+
+void RunAhead::UseSecondInstance(bool use) {
+    if (use == m_SecondDraws) {
+        return;
+    }
+
+    // Only one of them may be publishing at a time
+    Wait();
+    if (use) {
+        m_Driver.AttachFrameExchange(nullptr);
+        m_Second->AttachFrameExchange(m_Exchange);
+    } else {
+        m_Second->AttachFrameExchange(nullptr);
+        m_Driver.AttachFrameExchange(m_Exchange);
+    }
+    m_SecondDraws = use;
+}
+
+void RunAhead::RunFrame(bool render) {
+    uint32_t ahead = m_Frames.load(std::memory_order_relaxed);
+    if (m_Second != nullptr) {
+        UseSecondInstance(ahead > 0);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    m_Driver.RunFrame(render && ahead == 0);
+    auto real = std::chrono::steady_clock::now();
+
+    if (render && ahead > 0) {
+        if (m_Second != nullptr) {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Idle.wait(lock, [this] { return !m_Pending; });
+
+            m_Driver.SaveState(*m_State);
+            m_Second->Pads().AttachInput(m_Driver.Pads().Input());
+            if (m_Second->Ppu().Accuracy() != m_Driver.Ppu().Accuracy()) {
+                m_Second->Ppu().SetAccuracy(m_Driver.Ppu().Accuracy());
+            }
+            if (m_Second->Ppu().GetCompositeKernel() != m_Driver.Ppu().GetCompositeKernel()) {
+                m_Second->Ppu().SetCompositeKernel(m_Driver.Ppu().GetCompositeKernel());
+            }
+            if (m_Second->Recompiling() != m_Driver.Recompiling()) {
+                m_Second->SetRecompile(m_Driver.Recompiling());
+            }
+
+            m_PendingFrames = ahead;
+            m_Pending = true;
+            lock.unlock();
+            m_Wake.notify_one();
+        } else {
+            m_Driver.SaveState(*m_State);
+            for (uint32_t i = 1; i <= ahead; i++) {
+                m_Driver.RunFrame(i == ahead, true);
+            }
+            m_Driver.LoadState(*m_State);
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    m_RealNs.fetch_add(Elapsed(start, real), std::memory_order_relaxed);
+    m_AddedNs.fetch_add(Elapsed(real, end), std::memory_order_relaxed);
+    m_FramesRun.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RunAhead::Wait() {
+    if (m_Second == nullptr) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_Lock);
+    m_Idle.wait(lock, [this] { return !m_Pending; });
+}
+
+const PPU::Frame& RunAhead::Picture() {
+    Wait();
+    return m_SecondDraws ? m_Second->Ppu().CurrentFrame() : m_Driver.Ppu().CurrentFrame();
+}
+
+void RunAhead::RunSecondInstance() {
+    Trace::SetThreadName("Run-ahead");
+    std::unique_lock<std::mutex> lock(m_Lock);
+
+    while (true) {
+        m_Wake.wait(lock, [this] { return m_Pending || m_Quit; });
+        if (m_Quit) {
+            break;
+        }
+
+        uint32_t ahead = m_PendingFrames;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            TraceSpan span("Second instance");
+            span.SetCount(ahead);
+
+            m_Second->LoadState(*m_State);
+            for (uint32_t i = 1; i <= ahead; i++) {
+                m_Second->RunFrame(i == ahead, true);
+            }
+        }
+        m_SecondNs.fetch_add(Elapsed(start, std::chrono::steady_clock::now()), std::memory_order_relaxed);
+        m_SecondRuns.fetch_add(1, std::memory_order_relaxed);
+
+        lock.lock();
+        m_Pending = false;
+        m_Idle.notify_all();
+    }
+}
+
+RunAhead::Stats RunAhead::GetStats() const {
+    Stats stats;
+    stats.Frames = m_Frames.load(std::memory_order_relaxed);
+    stats.SecondInstance = m_Second != nullptr;
+    stats.FramesRun = m_FramesRun.load(std::memory_order_relaxed);
+
+    uint64_t frames = stats.FramesRun ? stats.FramesRun : 1;
+    stats.RealUs = m_RealNs.load(std::memory_order_relaxed) / 1000.0 / frames;
+    stats.AddedUs = m_AddedNs.load(std::memory_order_relaxed) / 1000.0 / frames;
+
+    uint64_t runs = m_SecondRuns.load(std::memory_order_relaxed);
+    stats.SecondInstanceUs = runs ? m_SecondNs.load(std::memory_order_relaxed) / 1000.0 / runs : 0.0;
+    return stats;
+}
+
+}
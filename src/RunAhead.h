@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "NESDriver.h"
+#include "PPU.h"
+#include "TripleBuffer.h"
+
+namespace raunnes {
+
+class Cartridge;
+
+// Takes a game's own input lag back out by showing the future.  Most games
+// act on the controllers a frame or two after reading them; running that
+// many frames past the real one with the same input and showing the last of
+// them makes a press visible as soon as the host could have drawn it.
+// https://docs.libretro.com/guides/runahead/
+//
+// Every frame the real one runs without drawing, the machine is saved,
+// Frames() more run and the last is drawn, then the save is loaded back.
+// Only the real frames ever reach the audio or the frame callback, so the
+// timeline the game sees is the same as without run-ahead.
+//
+// Frames ahead cost as much as real ones.  A second instance can run them
+// on another core from a copy of the state instead, leaving the emulation
+// thread just the save; it's handed the next frame once it's finished the
+// last, so at most one frame's worth of work is in flight.
+class RunAhead {
+public:
+    struct Stats {
+        uint32_t Frames;            // currently ahead, each one a frame less lag
+        bool SecondInstance;
+        uint64_t FramesRun;         // real frames since start
+        double RealUs;              // average real frame
+        double AddedUs;             // average on top of that on the emulation thread
+        double SecondInstanceUs;    // average the second instance spent per frame
+    };
+
+public:
+    // secondInstance, when given, is the cartridge driver was made from and
+    // builds the second instance
+    RunAhead(NESDriver& driver, const Cartridge* secondInstance = nullptr);
+    ~RunAhead();
+
+    // 0 is off.  Any thread, takes effect from the next frame.
+    void SetFrames(uint32_t frames) { m_Frames.store(frames, std::memory_order_relaxed); }
+    uint32_t Frames() const { return m_Frames.load(std::memory_order_relaxed); }
+
+    // Drawn frames are published here, from the second instance's thread
+    // while it's drawing them
+    void AttachFrameExchange(TripleBuffer<PPU::Frame>* frames);
+
+    // Replaces NESDriver::RunFrame().  render false skips the frames ahead
+    // altogether, there'd be nothing to show for them.
+    void RunFrame(bool render = true);
+
+    // Until the second instance has finished the frames it was handed
+    void Wait();
+
+    // The last frame drawn, after Wait() with a second instance
+    const PPU::Frame& Picture();
+
+    // Any thread
+    Stats GetStats() const;
+
+public:
+    RunAhead(const RunAhead&) = delete;
+    RunAhead& operator=(const RunAhead&) = delete;
+
+private:
+    void UseSecondInstance(bool use);
+    void RunSecondInstance();
+
+private:
+    NESDriver& m_Driver;
+    std::unique_ptr<NESDriver::State> m_State;
+    std::atomic<uint32_t> m_Frames;
+    TripleBuffer<PPU::Frame>* m_Exchange;
+
+    std::unique_ptr<NESDriver> m_Second;
+    bool m_SecondDraws;         // has the frame exchange rather than m_Driver
+
+    // Handoff to the second instance, under m_Lock.  The emulation thread
+    // only saves into m_State while nothing's pending.
+    std::thread m_Thread;
+    std::mutex m_Lock;
+    std::condition_variable m_Wake;
+    std::condition_variable m_Idle;
+    bool m_Pending;
+    bool m_Quit;
+    uint32_t m_PendingFrames;
+
+    std::atomic<uint64_t> m_FramesRun;
+    std::atomic<uint64_t> m_RealNs;
+    std::atomic<uint64_t> m_AddedNs;
+    std::atomic<uint64_t> m_SecondNs;
+    std::atomic<uint64_t> m_SecondRuns;
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace raunnes {
+
+// Audio samples from one producer thread to one consumer thread without
+// locks.  The producer only moves the write index and the consumer only the
+// read index, each published with release and read with acquire, so either
+// side sees whole samples.  Capacity is a power of two so indices can run
+// freely and wrap with a mask.
+class SampleRing {
+public:
+    SampleRing(uint32_t capacityPow2) :
+        m_Samples(capacityPow2),
+        m_Mask(capacityPow2 - 1),
+        m_Read(0),
+        m_Write(0) {
+    }
+
+    uint32_t Capacity() const { return (uint32_t)m_Samples.size(); }
+
+    // Either side, may be stale by the time it's used
+    uint32_t Fill() const {
+        return m_Write.load(std::memory_order_acquire) - m_Read.load(std::memory_order_acquire);
+    }
+
+    // Producer side.  Returns how many fit.
+    uint32_t Write(const int16_t* samples, uint32_t count) {
+        uint32_t write = m_Write.load(std::memory_order_relaxed);
+        uint32_t read = m_Read.load(std::memory_order_acquire);
+        count = std::min(count, Capacity() - (write - read));
+
+        for (uint32_t i = 0; i < count; i++) {
+            m_Samples[(write + i) & m_Mask] = samples[i];
+        }
+        m_Write.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side.  Returns how many there were.
+    uint32_t Read(int16_t* out, uint32_t count) {
+        uint32_t read = m_Read.load(std::memory_order_relaxed);
+        uint32_t write = m_Write.load(std::memory_order_acquire);
+        count = std::min(count, write - read);
+
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] = m_Samples[(read + i) & m_Mask];
+        }
+        m_Read.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+public:
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+private:
+    std::vector<int16_t> m_Samples;
+    uint32_t m_Mask;
+
+    // On their own cache lines so the two threads don't fight over one
+    alignas(64) std::atomic<uint32_t> m_Read;
+    alignas(64) std::atomic<uint32_t> m_Write;
+};
+
+}
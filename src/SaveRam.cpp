@@ -0,0 +1,145 @@
+#include "SaveRam.h"
+
+#include "RomHash.h"
+
+#include <cassert>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raunnes {
+
+SaveRam::SaveRam() :
+    m_Data(nullptr),
+    m_Size(0),
+    m_File(-1),
+    m_PageShift(12),
+    m_DirtyPages(0),
+    m_FlushInterval(1000),
+    m_LastFlush(std::chrono::steady_clock::now()) {
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    while ((1l << m_PageShift) < pageSize) {
+        m_PageShift++;
+    }
+}
+
+SaveRam::~SaveRam() {
+    Close();
+}
+
+bool SaveRam::Open(const std::string& path, size_t size) {
+    Close();
+
+    // The dirty mask has 64 bits
+    assert((size >> m_PageShift) <= 64);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != size && ftruncate(fd, size) != 0)) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    m_Data = (uint8_t*)data;
+    m_Size = size;
+    m_File = fd;
+    m_DirtyPages = 0;
+    m_LastFlush = std::chrono::steady_clock::now();
+
+    return true;
+}
+
+void SaveRam::Close() {
+    if (m_Data == nullptr) {
+        return;
+    }
+
+    Flush();
+
+    munmap(m_Data, m_Size);
+    close(m_File);
+
+    m_Data = nullptr;
+    m_Size = 0;
+    m_File = -1;
+}
+
+void SaveRam::Flush() {
+    m_LastFlush = std::chrono::steady_clock::now();
+
+    if (m_Data == nullptr || m_DirtyPages == 0) {
+        return;
+    }
+
+    // One msync per run of consecutive dirty pages
+    uint64_t pages = m_DirtyPages;
+    m_DirtyPages = 0;
+
+    size_t pageSize = (size_t)1 << m_PageShift;
+
+    while (pages != 0) {
+        uint32_t first = __builtin_ctzll(pages);
+        uint32_t last = first;
+        while (last + 1 < 64 && (pages & (1ull << (last + 1)))) {
+            last++;
+        }
+
+        size_t begin = first * pageSize;
+        size_t end = (last + 1) * pageSize;
+        if (end > m_Size) {
+            end = m_Size;
+        }
+        msync(m_Data + begin, end - begin, MS_SYNC);
+
+        uint64_t run = (last == 63) ? ~0ull : ((1ull << (last + 1)) - 1);
+        pages &= ~run;
+    }
+}
+
+void SaveRam::FlushIfDue() {
+    if (m_DirtyPages == 0) {
+        return;
+    }
+
+    if (std::chrono::steady_clock::now() - m_LastFlush >= m_FlushInterval) {
+        Flush();
+    }
+}
+
+std::string SaveRam::PathForRom(const std::string& romPath, const RomFingerprint& fingerprint) {
+    size_t slash = romPath.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : romPath.substr(0, slash + 1);
+    return directory + fingerprint.CacheKey() + ".sav";
+}
+
+std::string SaveRam::LegacyPathForRom(const std::string& romPath) {
+    size_t slash = romPath.find_last_of("/\\");
+    size_t dot = romPath.find_last_of('.');
+
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return romPath + ".sav";
+    }
+    return romPath.substr(0, dot) + ".sav";
+}
+
+void SaveRam::Migrate(const std::string& legacyPath, const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 && stat(legacyPath.c_str(), &info) == 0) {
+        rename(legacyPath.c_str(), path.c_str());
+    }
+}
+
+}
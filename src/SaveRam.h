@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace raunnes {
+
+struct RomFingerprint;
+
+// Battery-backed PRG-RAM kept in a memory-mapped .sav file.
+//
+// The emulated CPU writes straight into the mapping; MarkDirty only flips a
+// bit so stores cost no syscalls.  Flush() msyncs the pages that changed since
+// the last flush, FlushIfDue() rate limits that for calling once per frame,
+// and the destructor flushes whatever is left.
+class SaveRam {
+public:
+    SaveRam();
+    ~SaveRam();
+
+    // Maps path, creating or resizing it to size bytes.  Existing contents are
+    // kept, so a previous session's save is picked up.
+    bool Open(const std::string& path, size_t size);
+    void Close();
+
+    bool IsOpen() const { return m_Data != nullptr; }
+
+    uint8_t* Data() { return m_Data; }
+    size_t Size() const { return m_Size; }
+
+    void MarkDirty(uint32_t offset) {
+        m_DirtyPages |= 1ull << (offset >> m_PageShift);
+    }
+    bool Dirty() const { return m_DirtyPages != 0; }
+
+    void Flush();
+    void FlushIfDue();
+    void SetFlushInterval(std::chrono::milliseconds interval) { m_FlushInterval = interval; }
+
+    // foo/bar.nes -> foo/<RomFingerprint::CacheKey()>.sav, named for what's
+    // in the ROM rather than the file
+    static std::string PathForRom(const std::string& romPath, const RomFingerprint& fingerprint);
+
+    // foo/bar.nes -> foo/bar.sav, where saves used to go
+    static std::string LegacyPathForRom(const std::string& romPath);
+
+    // Renames a save left at the legacy path to path, unless there's one
+    // there already
+    static void Migrate(const std::string& legacyPath, const std::string& path);
+
+public:
+    SaveRam(const SaveRam&) = delete;
+    SaveRam& operator=(const SaveRam&) = delete;
+
+private:
+    uint8_t* m_Data;
+    size_t m_Size;
+    int m_File;
+
+    uint32_t m_PageShift;
+    uint64_t m_DirtyPages;       // one bit per host page
+
+    std::chrono::milliseconds m_FlushInterval;
+    std::chrono::steady_clock::time_point m_LastFlush;
+};
+
+}
@@ -0,0 +1,51 @@
+#include "TileCache.h"
+
+#include "MemoryMap.h"
+
+namespace raunnes {
+
+TileCache::TileCache(const MemoryMap& memory) :
+    m_Map(memory) {
+    InvalidateAll();
+}
+
+TileCache::~TileCache() {
+}
+
+void TileCache::InvalidateRange(uint16_t address, uint32_t size) {
+    uint32_t first = address >> 4;
+    uint32_t last = (address + size + 15) >> 4;
+    if (last > kTileCount) {
+        last = kTileCount;
+    }
+
+    for (uint32_t tile = first; tile < last; tile++) {
+        m_Valid[tile] = 0;
+    }
+}
+
+void TileCache::InvalidateAll() {
+    memset(m_Valid, 0, sizeof(m_Valid));
+}
+
+void TileCache::Decode(uint32_t tile) {
+    // https://www.nesdev.org/wiki/PPU_pattern_tables
+    // 16 bytes per tile, 8 bytes of bit 0 followed by 8 bytes of bit 1
+    Tile& t = m_Tiles[tile];
+    uint16_t address = tile * 16;
+
+    for (uint32_t row = 0; row < 8; row++) {
+        uint8_t low = m_Map.ReadPPU(address + row);
+        uint8_t high = m_Map.ReadPPU(address + row + 8);
+
+        for (uint32_t b = 0; b < 8; b++) {
+            uint8_t pixel = ((low >> (7 - b)) & 0x01) | (((high >> (7 - b)) & 0x01) << 1);
+            t.Pixels[row][b] = pixel;
+            t.Flipped[row][7 - b] = pixel;
+        }
+    }
+
+    m_Valid[tile] = 1;
+}
+
+}
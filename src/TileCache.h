@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace raunnes {
+
+class MemoryMap;
+
+// CHR pattern tiles decoded to one byte per pixel (0-3), with a horizontally
+// flipped copy for sprites.  Covers the 512 tiles visible in $0000-$1FFF.
+//
+// Tiles are decoded lazily on first use and thrown away when the bytes behind
+// them change: MemoryMap invalidates a tile on every CHR RAM write, and the
+// whole range a bank covers when a mapper swaps CHR banks.
+class TileCache {
+public:
+    static const uint32_t kTileCount = 512;
+
+public:
+    TileCache(const MemoryMap& memory);
+    ~TileCache();
+
+    // 8 pixels of row (0-7) of tile, tile being the CHR address / 16
+    const uint8_t* Row(uint32_t tile, uint32_t row) {
+        if (!m_Valid[tile]) {
+            Decode(tile);
+        }
+        return m_Tiles[tile].Pixels[row];
+    }
+
+    const uint8_t* RowFlipped(uint32_t tile, uint32_t row) {
+        if (!m_Valid[tile]) {
+            Decode(tile);
+        }
+        return m_Tiles[tile].Flipped[row];
+    }
+
+    void Invalidate(uint32_t tile) {
+        m_Valid[tile] = 0;
+    }
+
+    // address / size in PPU address space, for CHR bank switches
+    void InvalidateRange(uint16_t address, uint32_t size);
+    void InvalidateAll();
+
+public:
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+private:
+    void Decode(uint32_t tile);
+
+private:
+    struct Tile {
+        uint8_t Pixels[8][8];
+        uint8_t Flipped[8][8];
+    };
+
+    const MemoryMap& m_Map;
+    Tile m_Tiles[kTileCount];
+    uint8_t m_Valid[kTileCount];
+};
+
+}
@@ -0,0 +1,191 @@
+#include "Trace.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace raunnes {
+
+// About 100 KB each, a couple of frames of the busiest thread
+static const uint32_t kChunkEvents = 4096;
+
+namespace {
+
+struct Event {
+    const char* Name;
+    uint64_t Start;
+    uint32_t DurationNs;
+    uint32_t Count;
+};
+
+struct Chunk {
+    Event Events[kChunkEvents];
+    std::atomic<uint32_t> Count;    // events written, stored after them
+    std::atomic<Chunk*> Next;
+
+    Chunk() : Count(0), Next(nullptr) {
+    }
+};
+
+// One per thread that's ever recorded.  Only the owning thread writes; the
+// chunks stay put until the program exits so Write() can read them any time.
+struct ThreadBuffer {
+    uint32_t Id;
+    std::atomic<const char*> Name;
+    Chunk* Head;
+    std::atomic<uint64_t> Events;
+    std::atomic<uint64_t> Dropped;
+
+    // Owner only
+    Chunk* Tail;
+
+    ThreadBuffer(uint32_t id) : Id(id), Name(nullptr), Head(new Chunk()), Events(0), Dropped(0), Tail(Head) {
+    }
+
+    ~ThreadBuffer() {
+        while (Head != nullptr) {
+            Chunk* next = Head->Next.load(std::memory_order_relaxed);
+            delete Head;
+            Head = next;
+        }
+    }
+};
+
+struct Registry {
+    std::mutex Lock;
+    std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+    std::atomic<uint64_t> Epoch;    // first time tracing was turned on
+
+    Registry() : Epoch(0) {
+    }
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+ThreadBuffer& LocalBuffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.Lock);
+        registry.Buffers.emplace_back(new ThreadBuffer((uint32_t)registry.Buffers.size() + 1));
+        buffer = registry.Buffers.back().get();
+    }
+    return *buffer;
+}
+
+}
+
+std::atomic<bool> Trace::s_Enabled(false);
+
+void Trace::SetEnabled(bool enabled) {
+    uint64_t none = 0;
+    if (enabled) {
+        GetRegistry().Epoch.compare_exchange_strong(none, PerfCounters::Now());
+    }
+    s_Enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Trace::SetThreadName(const char* name) {
+    LocalBuffer().Name.store(name, std::memory_order_relaxed);
+}
+
+void Trace::Record(const char* name, uint64_t start, uint64_t end, uint32_t count) {
+    ThreadBuffer& buffer = LocalBuffer();
+
+    uint64_t events = buffer.Events.load(std::memory_order_relaxed);
+    if (events >= kMaxEvents) {
+        buffer.Dropped.store(buffer.Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    Chunk* chunk = buffer.Tail;
+    uint32_t index = chunk->Count.load(std::memory_order_relaxed);
+    if (index == kChunkEvents) {
+        Chunk* next = new Chunk();
+        chunk->Next.store(next, std::memory_order_release);
+        buffer.Tail = next;
+        chunk = next;
+        index = 0;
+    }
+
+    Event& event = chunk->Events[index];
+    event.Name = name;
+    event.Start = start;
+    event.DurationNs = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t)(end - start);
+    event.Count = count;
+    chunk->Count.store(index + 1, std::memory_order_release);
+    buffer.Events.store(events + 1, std::memory_order_relaxed);
+}
+
+bool Trace::Write(const char* path) {
+    Registry& registry = GetRegistry();
+
+    // Buffers are only ever added, so a copy of the list is safe to walk
+    // without holding the lock
+    std::vector<ThreadBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry.Lock);
+        for (auto& buffer : registry.Buffers) {
+            buffers.push_back(buffer.get());
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    uint64_t epoch = registry.Epoch.load();
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (ThreadBuffer* buffer : buffers) {
+        const char* name = buffer->Name.load(std::memory_order_relaxed);
+        if (name != nullptr) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->Id, name);
+            first = false;
+        }
+
+        for (Chunk* chunk = buffer->Head; chunk != nullptr; chunk = chunk->Next.load(std::memory_order_acquire)) {
+            uint32_t count = chunk->Count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; i++) {
+                const Event& event = chunk->Events[i];
+                // Spans from before the epoch can't happen, but don't wrap
+                uint64_t start = event.Start > epoch ? event.Start - epoch : 0;
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"count\":%u}}",
+                    first ? "" : ",\n", event.Name, buffer->Id, start / 1000.0, event.DurationNs / 1000.0, event.Count);
+                first = false;
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+uint64_t Trace::Events() {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Lock);
+    uint64_t events = 0;
+    for (auto& buffer : registry.Buffers) {
+        events += buffer->Events.load(std::memory_order_relaxed);
+    }
+    return events;
+}
+
+uint64_t Trace::Dropped() {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Lock);
+    uint64_t dropped = 0;
+    for (auto& buffer : registry.Buffers) {
+        dropped += buffer->Dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+}
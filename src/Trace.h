@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "PerfCounters.h"
+
+// Building with RAUNNES_TRACE=0 turns Trace::Enabled() into a constant false,
+// so every span and everything guarded by it compiles away
+#ifndef RAUNNES_TRACE
+#define RAUNNES_TRACE 1
+#endif
+
+namespace raunnes {
+
+// Timeline of what each thread spent its time on, written out as Chrome
+// trace-event JSON for chrome://tracing or https://ui.perfetto.dev
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+//
+// Every thread records into a buffer of its own, found through a
+// thread_local, so recording a span is two clock reads and a store with no
+// locks or shared cache lines.  Buffers grow a chunk at a time and are never
+// trimmed, which lets Write() read them while their threads carry on: each
+// chunk's count is published after the events below it.  Once a thread has
+// recorded kMaxEvents the rest of its spans are dropped and counted.
+class Trace {
+public:
+    // Per thread, 96 MB of events
+    static const uint32_t kMaxEvents = 4 * 1024 * 1024;
+
+public:
+    // The runtime switch.  Spans already open when it's turned off still
+    // finish.
+    static void SetEnabled(bool enabled);
+    static bool Enabled() { return RAUNNES_TRACE && s_Enabled.load(std::memory_order_relaxed); }
+
+    // Shown as the calling thread's name on the timeline
+    static void SetThreadName(const char* name);
+
+    // name has to outlive the trace, normally a literal.  start and end are
+    // PerfCounters::Now() times; count is whatever the span did the most of
+    // (instructions, dots, samples), 0 for nothing.
+    static void Record(const char* name, uint64_t start, uint64_t end, uint32_t count);
+
+    // Everything recorded so far, from every thread
+    static bool Write(const char* path);
+
+    static uint64_t Events();
+    static uint64_t Dropped();
+
+private:
+    static std::atomic<bool> s_Enabled;
+};
+
+// Times its own scope onto the calling thread's timeline if tracing was on
+// when it started
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) :
+        m_Name(Trace::Enabled() ? name : nullptr),
+        m_Start(m_Name != nullptr ? PerfCounters::Now() : 0),
+        m_Count(0) {
+    }
+
+    ~TraceSpan() {
+        if (m_Name != nullptr) {
+            Trace::Record(m_Name, m_Start, PerfCounters::Now(), m_Count);
+        }
+    }
+
+    void SetCount(uint32_t count) { m_Count = count; }
+
+public:
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* m_Name;
+    uint64_t m_Start;
+    uint32_t m_Count;
+};
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace raunnes {
+
+// Hands whole buffers from one producer thread to one consumer thread without
+// locks or copies.
+//
+// Of the three buffers the producer owns one (Back), the consumer owns one
+// (Front) and the third sits in the middle.  Publish() swaps Back with the
+// middle, Acquire() swaps the middle with Front if something new was
+// published.  The swaps are a single atomic exchange on the middle index, so
+// the producer always has a buffer to write, the consumer always has the
+// newest complete one, and neither ever waits.  Frames the consumer didn't
+// get to in time are overwritten.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() :
+        m_Back(0),
+        m_Middle(1),
+        m_Front(2) {
+    }
+
+    // Producer side
+    T& Back() { return m_Buffers[m_Back]; }
+
+    void Publish() {
+        uint8_t middle = m_Middle.exchange(m_Back | kFresh, std::memory_order_acq_rel);
+        m_Back = middle & kIndexMask;
+    }
+
+    // Consumer side.  True if Front() changed to a newly published buffer.
+    bool Acquire() {
+        if (!(m_Middle.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+
+        uint8_t middle = m_Middle.exchange(m_Front, std::memory_order_acq_rel);
+        m_Front = middle & kIndexMask;
+        return true;
+    }
+
+    const T& Front() const { return m_Buffers[m_Front]; }
+
+public:
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+private:
+    static const uint8_t kIndexMask = 0x03;
+    static const uint8_t kFresh = 0x04;
+
+    T m_Buffers[3];
+
+    // Each index on its own cache line so the two sides don't fight over them
+    alignas(64) uint8_t m_Back;
+    alignas(64) std::atomic<uint8_t> m_Middle;
+    alignas(64) uint8_t m_Front;
+};
+
+}
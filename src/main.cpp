@@ -1,15 +1,42 @@
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 #include <cstring>
+#include <memory>
 
+#include <SFML/Audio.hpp>
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 
 #include "6502Core.h"
+#include "AudioOutput.h"
+#include "Cartridge.h"
+#include "Controllers.h"
+#include "EmulationThread.h"
+#include "Headless.h"
+#include "Input.h"
 #include "MemoryMap.h"
+#include "NESDriver.h"
 #include "PPU.h"
+#include "PPUDebugger.h"
+#include "Palette.h"
+#include "PerfCounters.h"
+#include "RomDatabase.h"
+#include "RunAhead.h"
+#include "SaveRam.h"
+#include "Trace.h"
+#include "TripleBuffer.h"
+
+// Set by CMakeLists.txt to the source tree's deps; otherwise they're looked
+// for next to the build directory
+#ifndef RAUNNES_DEPS_DIR
+#define RAUNNES_DEPS_DIR "../deps"
+#endif
+
+static const char* const kOverlayFont = RAUNNES_DEPS_DIR "/SpaceMono-Regular.ttf";
 
 void log(const raunnes::CPUCore6502::InstructionDetails& info,
     const raunnes::CPUCore6502::DynamicExecutionInfo& details,
@@ -43,20 +70,20 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
         else {
             s << "$" << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << details.Address();
             s << " = ";
-            s << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(details.Address());
+            s << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(details.Address());
             s << std::setw(28 - 10) << std::setfill(' ');
         }
         break;
     case raunnes::CPUCore6502::AddressingModeAbsoluteX:
         s << "$" << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << details.AddressAbsolute() << ",X";
         s << " @ " << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << details.Address();
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(details.Address());
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(details.Address());
         s << std::setw(28 -19) << std::setfill(' ');
         break;
     case raunnes::CPUCore6502::AddressingModeAbsoluteY:
         s << "$" << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << details.AddressAbsolute() << ",Y";
         s << " @ " << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << details.Address();
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << (uint32_t)map.Read(details.Address());
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << (uint32_t)map.Peek(details.Address());
         s << std::setw(28 - 19) << std::setfill(' ');
         break;
     case raunnes::CPUCore6502::AddressingModeAccumulator:
@@ -70,7 +97,7 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
     case raunnes::CPUCore6502::AddressingModeZeroPage:
         s << "$" << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << details.Address();
         s << " = ";
-        s << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(details.Address());
+        s << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(details.Address());
         s << std::setw(28 - 8) << std::setfill(' ');
         break;
     case raunnes::CPUCore6502::AddressingModeImplied:
@@ -80,14 +107,14 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
     {
         uint16_t addr1 = (state.X + details.Immediate()) & 0xFF;
 
-        uint16_t addr2_low = map.Read(addr1);
-        uint16_t addr2_high = map.Read((addr1 + 1) & 0xFF);
+        uint16_t addr2_low = map.Peek(addr1);
+        uint16_t addr2_high = map.Peek((addr1 + 1) & 0xFF);
         uint16_t addr2 = (addr2_high << 8) | addr2_low;
 
         s << "($" << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)details.Immediate() << ",X)";
         s << " @ " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << addr1;
         s << " = " << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << addr2;
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(addr2);
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(addr2);
         s << std::setw(28 - 24) << std::setfill(' ');
     }
         break;
@@ -97,8 +124,8 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
         
         uint16_t addr_low = addr1;
         uint16_t addr_high = (addr_low & 0xFF00) | ((addr_low + 1) & 0x00FF);
-        uint16_t low = map.Read(addr_low);
-        uint16_t high = map.Read(addr_high);
+        uint16_t low = map.Peek(addr_low);
+        uint16_t high = map.Peek(addr_high);
 
         uint16_t addr2 = (high << 8) | low;
 
@@ -111,8 +138,8 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
     {
         uint16_t addr1 = details.Immediate();
 
-        uint16_t addr2_low = map.Read(addr1);
-        uint16_t addr2_high = map.Read((addr1 + 1) & 0xFF);
+        uint16_t addr2_low = map.Peek(addr1);
+        uint16_t addr2_high = map.Peek((addr1 + 1) & 0xFF);
         uint16_t addr2 = ((addr2_high << 8) | addr2_low);
 
         uint16_t addr3 = addr2 + state.Y;
@@ -120,7 +147,7 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
         s << "($" << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)details.Immediate() << "),Y";
         s << " = " << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << addr2;
         s << " @ " << std::uppercase << std::setw(4) << std::setfill('0') << std::hex << addr3;
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(addr3);
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(addr3);
         s << std::setw(28 - 26) << std::setfill(' ');
     }
         break;
@@ -135,7 +162,7 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
 
         s << "$" << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)addr1 << ",X";
         s << " @ " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)addr2;
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(addr2);
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(addr2);
         s << std::setw(28 - 15) << std::setfill(' ');
     }
         break;
@@ -146,7 +173,7 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
 
         s << "$" << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)addr1 << ",Y";
         s << " @ " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)addr2;
-        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Read(addr2);
+        s << " = " << std::uppercase << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)map.Peek(addr2);
         s << std::setw(28 - 15) << std::setfill(' ');
     }
     break;
@@ -180,94 +207,465 @@ void log(const raunnes::CPUCore6502::InstructionDetails& info,
     }
 }
 
+// Runs on the emulation thread
+void UpdateDebugger(raunnes::NESDriver& driver, void* context) {
+    ((raunnes::PPUDebugger*)context)->Update(driver.Ppu(), driver.FrameCount());
+}
+
+// Textures for each PPUDebugger picture, converted through the same palette
+// as the screen
+struct DebuggerView {
+    sf::Texture NameTables;
+    sf::Texture PatternTables;
+    sf::Texture Sprites;
+    sf::Texture Palette;
+    std::vector<uint32_t> Pixels;
+
+    DebuggerView() : Pixels(raunnes::PPUDebugger::kNameTablesWidth * raunnes::PPUDebugger::kNameTablesHeight) {
+        NameTables.create(raunnes::PPUDebugger::kNameTablesWidth, raunnes::PPUDebugger::kNameTablesHeight);
+        PatternTables.create(raunnes::PPUDebugger::kPatternTablesWidth, raunnes::PPUDebugger::kPatternTablesHeight);
+        Sprites.create(raunnes::PPUDebugger::kSpritesWidth, raunnes::PPUDebugger::kSpritesHeight);
+        Palette.create(16, 2);
+    }
+
+    void Upload(sf::Texture& texture, const uint8_t* indices, size_t count, const raunnes::Palette& palette) {
+        palette.Convert(indices, count, Pixels.data());
+        texture.update((const sf::Uint8*)Pixels.data());
+    }
+
+    void Update(const raunnes::PPUDebugger::Snapshot& snapshot, const raunnes::Palette& palette) {
+        Upload(NameTables, snapshot.NameTables, sizeof(snapshot.NameTables), palette);
+        Upload(PatternTables, snapshot.PatternTables, sizeof(snapshot.PatternTables), palette);
+        Upload(Sprites, snapshot.Sprites, sizeof(snapshot.Sprites), palette);
+        Upload(Palette, snapshot.Palette, sizeof(snapshot.Palette), palette);
+    }
+
+    void Draw(sf::RenderWindow& target) {
+        // Nametables 1:1 on the left, everything else at 2x on the right
+        sf::Sprite nameTables(NameTables);
+        target.draw(nameTables);
+
+        sf::Sprite patternTables(PatternTables);
+        patternTables.setPosition(520, 0);
+        patternTables.setScale(2, 2);
+        target.draw(patternTables);
+
+        sf::Sprite palette(Palette);
+        palette.setPosition(520, 264);
+        palette.setScale(32, 32);
+        target.draw(palette);
+
+        sf::Sprite sprites(Sprites);
+        sprites.setPosition(520, 336);
+        sprites.setScale(2, 2);
+        target.draw(sprites);
+    }
+};
+
+// Performance counters drawn over the top left of the screen, F1 toggles.
+// The text is rebuilt a few times a second, often enough to read and rarely
+// enough not to show up in the present time it reports.
+struct StatsOverlay {
+    sf::Font Font;
+    sf::Text Text;
+    sf::RectangleShape Background;
+    bool Loaded;
+    bool Visible;
+
+    StatsOverlay() : Loaded(false), Visible(false) {
+        Loaded = Font.loadFromFile(kOverlayFont);
+        Text.setFont(Font);
+        Text.setCharacterSize(14);
+        Text.setFillColor(sf::Color::White);
+        Text.setPosition(8, 4);
+        Background.setFillColor(sf::Color(0, 0, 0, 160));
+        Background.setSize(sf::Vector2f(300, 124));
+    }
+
+    void Update(const raunnes::PerfCounters::Snapshot& perf, const raunnes::AudioOutput::Stats& audio, const raunnes::Controllers::Stats& pads) {
+        const uint64_t* v = perf.Values;
+        char text[512];
+        snprintf(text, sizeof(text),
+            "%.1f fps\n"
+            "%llu instructions (%llu translated), %llu catch-ups, %llu idle cycles\n"
+            "frame %.2f ms: cpu %.2f ppu %.2f apu %.2f\n"
+            "present %.2f ms\n"
+            "audio %.1f ms queued, rate %.4f\n"
+            "input %.1f ms old, %u polls",
+            perf.FramesPerSecond,
+            (unsigned long long)v[raunnes::PerfCounters::CounterInstructions],
+            (unsigned long long)v[raunnes::PerfCounters::CounterTranslated],
+            (unsigned long long)v[raunnes::PerfCounters::CounterPPUCatchUps],
+            (unsigned long long)v[raunnes::PerfCounters::CounterIdleCycles],
+            v[raunnes::PerfCounters::CounterFrameNs] / 1e6,
+            v[raunnes::PerfCounters::CounterCPUNs] / 1e6,
+            v[raunnes::PerfCounters::CounterPPUNs] / 1e6,
+            v[raunnes::PerfCounters::CounterAPUNs] / 1e6,
+            v[raunnes::PerfCounters::CounterPresentNs] / 1e6,
+            audio.LatencyMs, audio.Ratio,
+            pads.AgeUs / 1000, pads.PollsLastFrame);
+        Text.setString(text);
+    }
+
+    void Draw(sf::RenderWindow& target) {
+        target.draw(Background);
+        target.draw(Text);
+    }
+};
+
+// Keyboard -> controller 1
+static const struct {
+    sf::Keyboard::Key Key;
+    uint8_t Button;
+} kKeyMap[] = {
+    { sf::Keyboard::X, raunnes::ButtonA },
+    { sf::Keyboard::Z, raunnes::ButtonB },
+    { sf::Keyboard::RShift, raunnes::ButtonSelect },
+    { sf::Keyboard::Enter, raunnes::ButtonStart },
+    { sf::Keyboard::Up, raunnes::ButtonUp },
+    { sf::Keyboard::Down, raunnes::ButtonDown },
+    { sf::Keyboard::Left, raunnes::ButtonLeft },
+    { sf::Keyboard::Right, raunnes::ButtonRight },
+};
+
+uint8_t ButtonForKey(sf::Keyboard::Key key) {
+    for (const auto& mapping : kKeyMap) {
+        if (mapping.Key == key) {
+            return mapping.Button;
+        }
+    }
+    return 0;
+}
+
+// Feeds the sound card from an AudioOutput.  SFML asks for each chunk from
+// its own thread; small chunks keep its share of the latency down.
+class AudioStream : public sf::SoundStream {
+public:
+    AudioStream(raunnes::AudioOutput& output) : m_Output(output), m_Buffer(256) {
+        initialize(1, output.SampleRate());
+    }
+
+    ~AudioStream() {
+        stop();
+    }
+
+protected:
+    bool onGetData(Chunk& data) override {
+        raunnes::Trace::SetThreadName("Audio");
+        m_Output.Pull(m_Buffer.data(), (uint32_t)m_Buffer.size());
+        data.samples = m_Buffer.data();
+        data.sampleCount = m_Buffer.size();
+        return true;
+    }
+
+    void onSeek(sf::Time) override {
+    }
+
+private:
+    raunnes::AudioOutput& m_Output;
+    std::vector<sf::Int16> m_Buffer;
+};
+
+// Anything recorded goes out at exit
+static void WriteTrace(const char* path) {
+    uint64_t events = raunnes::Trace::Events();
+    if (events == 0) {
+        return;
+    }
+
+    if (raunnes::Trace::Write(path)) {
+        std::cout << "Wrote " << events << " trace events to " << path;
+        if (raunnes::Trace::Dropped() > 0) {
+            std::cout << " (" << raunnes::Trace::Dropped() << " dropped)";
+        }
+        std::cout << "\n";
+    } else {
+        std::cout << "Unable to write " << path << "\n";
+    }
+}
+
 int main(int argc, char** argv) {
 
-    sf::RenderWindow window(sf::VideoMode(800, 600), "My window");
-    sf::RenderWindow ppuDebugger(sf::VideoMode(800, 600), "PPU Debugger");
+    // Headless runs take their own options
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--headless") {
+            return raunnes::HeadlessMain(argc, argv);
+        }
+    }
+
+    const char* romPath = "../tests/nestest/nestest.nes";
+    bool trace = false;
+    bool overlay = false;
+    int ppuAccuracy = -1;
+    const char* palettePath = nullptr;
+    const char* tracePath = "trace.json";
+    bool traceAtStart = false;
+    std::string audioDevice = "sfml";
+    uint32_t runAheadFrames = 0;
+    bool runAheadThread = false;
+    bool recompile = false;
+    std::string romDatabasePath = raunnes::RomDatabase::DefaultPath();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--log") {
+            trace = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+            traceAtStart = true;
+        } else if (arg == "--overlay") {
+            overlay = true;
+        } else if (arg == "--palette" && i + 1 < argc) {
+            palettePath = argv[++i];
+        } else if (arg == "--run-ahead" && i + 1 < argc) {
+            runAheadFrames = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--run-ahead-thread") {
+            runAheadThread = true;
+        } else if (arg == "--jit") {
+            recompile = true;
+        } else if (arg == "--romdb" && i + 1 < argc) {
+            romDatabasePath = argv[++i];
+        } else if (arg == "--audio" && i + 1 < argc) {
+            audioDevice = argv[++i];
+            if (audioDevice != "sfml" && audioDevice != "null" && audioDevice != "off") {
+                std::cout << "Unknown audio device " << audioDevice << "\n";
+                return 1;
+            }
+        } else if (arg == "--ppu" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "dot") {
+                ppuAccuracy = raunnes::Cartridge::PPUAccuracyDot;
+            } else if (mode == "scanline") {
+                ppuAccuracy = raunnes::Cartridge::PPUAccuracyScanline;
+            } else {
+                std::cout << "Unknown PPU mode " << mode << "\n";
+                return 1;
+            }
+        } else {
+            romPath = argv[i];
+        }
+    }
+
+    raunnes::RomDatabase romDatabase;
+    if (!romDatabase.Load(romDatabasePath)) {
+        std::cout << "Unable to load ROM database " << romDatabasePath << ", headers are taken as is\n";
+    }
+
+    raunnes::Cartridge cartridge;
 
-    sf::Font monoFont;
-    if(monoFont.loadFromFile("/home/raun/Code/raunnes/deps/SpaceMono-Regular.ttf") == false) {
-        exit(0);
+    if (!cartridge.Load(romPath, &romDatabase)) {
+        std::cout << "Unable to load " << romPath << ": " << cartridge.Error() << "\n";
+        return 1;
     }
 
-    std::fstream romFile("../tests/nestest/nestest.nes", std::ios::in | std::ios::binary);
+    raunnes::Trace::SetThreadName("UI");
+    raunnes::Trace::SetEnabled(traceAtStart);
 
-    struct _NESHeader{
-        uint32_t magic;
-        uint8_t  sizePRG;
-        uint8_t  sizeCHR;
-        uint8_t  F1;
-        uint8_t  F2;
-        uint8_t  F3;
-        uint8_t  F4;
-        uint8_t  F5;
-        uint32_t unused;
-    };
+    std::cout << romPath << " crc32:" << cartridge.Fingerprint().Crc32String()
+        << " sha1:" << cartridge.Fingerprint().Sha1String()
+        << " mapper:" << cartridge.Mapper()
+        << (cartridge.HeaderFixed() ? " (header fixed from database)" : "") << "\n";
 
-    if (romFile.good()) {
-        std::cout << "WOO\n";
+    sf::RenderWindow window(sf::VideoMode(raunnes::PPU::kScreenWidth * 3, raunnes::PPU::kScreenHeight * 3), "raunnes");
+    sf::RenderWindow ppuDebugger(sf::VideoMode(1040, 720), "PPU Debugger");
 
-        _NESHeader header;
+    raunnes::SaveRam saveRam;
+    raunnes::NESDriver driver(cartridge);
+    if (ppuAccuracy >= 0) {
+        driver.Ppu().SetAccuracy((raunnes::Cartridge::PPUAccuracy)ppuAccuracy);
+    }
+    if (recompile && !driver.SetRecompile(true)) {
+        std::cout << "No recompiler on this host, interpreting\n";
+    }
 
-        romFile.read((char*)&header, sizeof(header));
+    if (cartridge.HasBattery()) {
+        std::string savePath = raunnes::SaveRam::PathForRom(romPath, cartridge.Fingerprint());
+        raunnes::SaveRam::Migrate(raunnes::SaveRam::LegacyPathForRom(romPath), savePath);
+        if (saveRam.Open(savePath, 0x2000)) {
+            driver.Memory().AttachSaveRam(&saveRam);
+        } else {
+            std::cout << "Unable to open " << savePath << ", saves will not persist\n";
+        }
+    }
 
-        uint8_t buffer[16384 * 2] = { 0 };
-        uint32_t prgSize = header.sizePRG * 16384;
-        romFile.read((char*)buffer, prgSize);
+    if (trace) {
+        driver.Cpu().InstallPreExecutionCallBack(log);
+    }
 
-        uint8_t chrRom[8192] = { 0 };
-        uint32_t chrSize = header.sizeCHR * 8192;
-        romFile.read((char*)chrRom, chrSize);
+    sf::Texture screen;
+    screen.create(raunnes::PPU::kScreenWidth, raunnes::PPU::kScreenHeight);
+    std::vector<uint32_t> pixels(raunnes::PPU::kScreenWidth * raunnes::PPU::kScreenHeight);
 
-        raunnes::MemoryMap mem(buffer, prgSize, chrRom, chrSize);
-        raunnes::CPUCore6502 cpu(mem);
-        raunnes::PPU ppu(mem);
+    raunnes::Palette palette;
+    if (palettePath != nullptr && !palette.Load(palettePath)) {
+        std::cout << "Unable to load palette " << palettePath << ", using the default\n";
+    }
 
-        cpu.InstallPreExecutionCallBack(log);
+    // Frames and debugger snapshots come from the emulation thread through here
+    std::unique_ptr<raunnes::TripleBuffer<raunnes::PPU::Frame>> frames(new raunnes::TripleBuffer<raunnes::PPU::Frame>());
+    std::unique_ptr<raunnes::PPUDebugger> debugger(new raunnes::PPUDebugger());
 
-        bool quit = false;
+    raunnes::RunAhead runAhead(driver, runAheadThread ? &cartridge : nullptr);
+    runAhead.SetFrames(runAheadFrames);
 
-        while(window.isOpen()) {
+    raunnes::EmulationThread emulation(driver, *frames, &saveRam);
+    emulation.InstallFrameCallBack(UpdateDebugger, debugger.get());
+    if (runAheadFrames > 0) {
+        emulation.AttachRunAhead(&runAhead);
+    }
 
-            sf::Event event;
+    // "null" plays in real time to nowhere, for machines without a sound card
+    raunnes::AudioOutput audio(48000);
+    std::unique_ptr<AudioStream> audioStream;
+    std::unique_ptr<raunnes::NullAudioDevice> nullAudio;
+    if (audioDevice != "off") {
+        emulation.AttachAudio(&audio);
+    }
 
-            while(window.pollEvent(event)) {
-                if (event.type == sf::Event::Closed) {
-                    window.close();
-                }
+    emulation.Start();
+
+    if (audioDevice == "sfml") {
+        audioStream.reset(new AudioStream(audio));
+        audioStream->play();
+    } else if (audioDevice == "null") {
+        nullAudio.reset(new raunnes::NullAudioDevice(audio));
+        nullAudio->Start();
+    }
+
+    DebuggerView debugView;
+    debugger->Request();
+
+    StatsOverlay stats;
+    stats.Visible = overlay;
+    if (!stats.Loaded) {
+        std::cout << "Unable to load the overlay font " << kOverlayFont << "\n";
+    }
+
+    // Held buttons are tracked from key events rather than polling the
+    // keyboard, which is a round trip to the window system per key.  The loop
+    // wakes every millisecond to hand them over, so the game's next latch
+    // sees input at most that old, and draws each frame as soon as it's
+    // published rather than on a timer of its own.
+    uint8_t held = 0;
+    bool redraw = true;
+    auto titleDue = std::chrono::steady_clock::now();
+    auto statsDue = titleDue;
+
+    while(window.isOpen()) {
+
+        sf::Event event;
+        uint64_t pollStart = raunnes::PerfCounters::Now();
+        uint32_t polled = 0;
+
+        while(window.pollEvent(event)) {
+            polled++;
+            if (event.type == sf::Event::Closed) {
+                window.close();
+            } else if (event.type == sf::Event::KeyPressed && ButtonForKey(event.key.code) != 0) {
+                held |= ButtonForKey(event.key.code);
+            } else if (event.type == sf::Event::KeyReleased) {
+                held &= ~ButtonForKey(event.key.code);
+            } else if (event.type == sf::Event::LostFocus) {
+                held = 0;
+            } else if (event.type == sf::Event::GainedFocus || event.type == sf::Event::Resized) {
+                redraw = true;
+            } else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Tab) {
+                // Fast forward only draws every 4th frame
+                emulation.SetUncapped(!emulation.Uncapped());
+                emulation.SetRenderInterval(emulation.Uncapped() ? 4 : 1);
+            } else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::P) {
+                emulation.SetPaused(!emulation.Paused());
+            } else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F1) {
+                stats.Visible = !stats.Visible;
+                redraw = true;
+            } else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F2) {
+                raunnes::Trace::SetEnabled(!raunnes::Trace::Enabled());
+                std::cout << "Tracing " << (raunnes::Trace::Enabled() ? "on" : "off") << "\n";
             }
+        }
+
+        while(ppuDebugger.pollEvent(event)) {
+            polled++;
+            if (event.type == sf::Event::Closed) {
+                ppuDebugger.close();
+            } else if (event.type == sf::Event::KeyPressed && event.key.code >= sf::Keyboard::Num0 && event.key.code <= sf::Keyboard::Num7) {
+                debugger->SetPatternPalette(event.key.code - sf::Keyboard::Num0);
+            }
+        }
 
-            // NTSC CPU == 1.79MHz
-            cpu.Execute();
-            ppu.Execute();
+        emulation.Input().Set(0, held);
+
+        // Present time covers converting a new frame and drawing it
+        uint64_t presentStart = raunnes::PerfCounters::Now();
+
+        if (raunnes::Trace::Enabled()) {
+            raunnes::Trace::Record("Poll events", pollStart, presentStart, polled);
+        }
+
+        if (frames->Acquire()) {
+            const raunnes::PPU::Frame& frame = frames->Front();
+            palette.Convert(frame.Pixels, frame.LineEmphasis, pixels.data());
+            screen.update((const sf::Uint8*)pixels.data());
+            redraw = true;
+        }
+
+        if (redraw) {
+            sf::Sprite sprite(screen);
+            sprite.setScale(3, 3);
 
             window.clear(sf::Color::Red);
+            window.draw(sprite);
+            if (stats.Visible && stats.Loaded) {
+                stats.Draw(window);
+            }
+
+            uint64_t displayStart = raunnes::PerfCounters::Now();
             window.display();
+            redraw = false;
 
-            ppuDebugger.clear(sf::Color::Cyan);
-            std::stringstream ss;
-            for(int x=0; x<32; x++) {
-                ss << std::setw(2) << std::setfill('0') << std::hex << x << " ";
-            }
-            ss << "\n";
-
-            for(int x=0; x<32*30; x++) {
-                if(x % 32 == 0) {
-                    ss << "\n";
-                }
-                ss << std::setw(2) << std::setfill('0') << std::hex << (uint32_t)mem.ReadPPU(0x2000+x);
-                ss << ' ';
+            uint64_t end = raunnes::PerfCounters::Now();
+            driver.Perf().Set(raunnes::PerfCounters::CounterPresentNs, end - presentStart);
+            if (raunnes::Trace::Enabled()) {
+                raunnes::Trace::Record("Render", presentStart, displayStart, 0);
+                raunnes::Trace::Record("Present", displayStart, end, 0);
             }
+        }
 
-            sf::Text text;
-            text.setFont(monoFont);
-            text.setString(ss.str());
-            text.setCharacterSize(12);
-            text.setFillColor(sf::Color::Black);
-            ppuDebugger.draw(text);
+        // Only capture while someone's looking, at most once per frame
+        if (ppuDebugger.isOpen() && debugger->Acquire()) {
+            debugView.Update(debugger->Front(), palette);
+            debugger->Request();
+
+            ppuDebugger.clear(sf::Color(40, 40, 40));
+            debugView.Draw(ppuDebugger);
             ppuDebugger.display();
         }
+
+        auto now = std::chrono::steady_clock::now();
+        if (stats.Visible && now >= statsDue) {
+            stats.Update(driver.Perf().Read(), audio.GetStats(), driver.Pads().GetStats());
+            statsDue = now + std::chrono::milliseconds(250);
+        }
+
+        if (now >= titleDue) {
+            raunnes::Controllers::Stats pads = driver.Pads().GetStats();
+            char title[192];
+            int length = snprintf(title, sizeof(title), "raunnes - %u polls/frame, input %.1f ms old (worst %.1f)",
+                pads.PollsLastFrame, pads.AgeUs / 1000, pads.MaxAgeUs / 1000);
+            if (runAhead.Frames() > 0) {
+                raunnes::RunAhead::Stats ahead = runAhead.GetStats();
+                snprintf(title + length, sizeof(title) - length, ", run-ahead %u (+%.0f us/frame)",
+                    ahead.Frames, ahead.AddedUs + ahead.SecondInstanceUs);
+            }
+            window.setTitle(title);
+            titleDue = now + std::chrono::seconds(1);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    
+
+    emulation.Stop();
+    WriteTrace(tracePath);
+
     return 0;
 }
@@ -0,0 +1,121 @@
+// AudioOutput's rate control against sound cards whose clocks run slow, true
+// and fast: nestest runs headless, its samples pushed after every frame, and
+// a NullAudioDevice at each speed drains them.  Both sides go by emulated
+// time (frames at the NTSC rate, the device advanced by a frame's worth each
+// time) so the run is quick and the same every time.
+//
+// The ring must never run dry or overflow, and once the first --settle
+// seconds are over the latency just after a push has to stay under 40 ms and
+// the ratio has to hold on the device's speed, which is what keeps the fill
+// steady: within 0.05% on average, 0.1% at worst.
+//
+//     audio_rate_control <dir with nestest.nes> [--seconds N] [--settle N]
+//
+// Prints what each speed came to and exits 1 if any of them failed.
+
+#include "APU.h"
+#include "AudioOutput.h"
+#include "Cartridge.h"
+#include "NESDriver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace raunnes {
+
+static const uint32_t kSampleRate = 48000;
+static const double kMaxLatencyMs = 40.0;
+
+// How close the settled ratio has to be to the device's speed.  The fill
+// it's steering by is only read once a frame, so it wanders a little.
+static const double kMeanRatioTolerance = 0.0005;
+static const double kRatioTolerance = 0.001;
+
+// An NTSC frame is 29780.5 CPU cycles, every other one skipping a dot
+static const double kFrameSeconds = 29780.5 / APU::kClockRate;
+
+static bool RunAtSpeed(const Cartridge& cartridge, double speed, double seconds, double settle) {
+    NESDriver driver(cartridge);
+    AudioOutput output(kSampleRate);
+    NullAudioDevice device(output, 256, speed);
+
+    uint32_t frames = (uint32_t)(seconds / kFrameSeconds);
+    uint32_t settleFrames = (uint32_t)(settle / kFrameSeconds);
+
+    double maxLatency = 0;
+    double minRatio = 2;
+    double maxRatio = 0;
+    double ratioSum = 0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        driver.RunFrame(false);
+        output.Push(driver.Apu());
+
+        AudioOutput::Stats stats = output.GetStats();
+        if (i >= settleFrames) {
+            maxLatency = std::max(maxLatency, stats.LatencyMs);
+            minRatio = std::min(minRatio, stats.Ratio);
+            maxRatio = std::max(maxRatio, stats.Ratio);
+            ratioSum += stats.Ratio;
+        }
+
+        device.Advance(kFrameSeconds);
+    }
+
+    AudioOutput::Stats stats = output.GetStats();
+    double meanRatio = ratioSum / (frames - settleFrames);
+
+    bool ok = stats.Underruns == 0 && stats.Overruns == 0 && maxLatency < kMaxLatencyMs &&
+        std::fabs(meanRatio - speed) < kMeanRatioTolerance &&
+        std::fabs(minRatio - speed) < kRatioTolerance && std::fabs(maxRatio - speed) < kRatioTolerance;
+
+    printf("speed %.3f: latency up to %.1f ms, ratio %.5f (%.5f to %.5f), %llu underruns, %llu overruns: %s\n",
+        speed, maxLatency, meanRatio, minRatio, maxRatio,
+        (unsigned long long)stats.Underruns, (unsigned long long)stats.Overruns, ok ? "ok" : "failed");
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace raunnes;
+
+    const char* directory = nullptr;
+    double seconds = 60;
+    double settle = 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--settle") == 0 && i + 1 < argc) {
+            settle = atof(argv[++i]);
+        } else if (directory == nullptr && argv[i][0] != '-') {
+            directory = argv[i];
+        } else {
+            directory = nullptr;
+            break;
+        }
+    }
+
+    if (directory == nullptr || settle >= seconds) {
+        printf("usage: %s <dir with nestest.nes> [--seconds N] [--settle N]\n", argv[0]);
+        return 2;
+    }
+
+    Cartridge cartridge;
+    if (!cartridge.Load(std::string(directory) + "/nestest.nes", nullptr)) {
+        printf("unable to load %s/nestest.nes\n", directory);
+        return 1;
+    }
+
+    uint32_t failures = 0;
+    for (double speed : { 0.995, 0.998, 1.0, 1.002, 1.005 }) {
+        failures += RunAtSpeed(cartridge, speed, seconds, settle) ? 0 : 1;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
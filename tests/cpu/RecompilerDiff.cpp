@@ -0,0 +1,272 @@
+// Runs the recompiler against the interpreter on random machines: two CPUs,
+// each over its own MemoryMap with nothing attached (flat RAM) holding the
+// same bytes, one of them with a recompiler translating on first sight.
+// Whatever the translated side runs, the interpreter runs the same number
+// of instructions of, and the registers, cycles taken and all 64 KiB of
+// memory have to come out the same.
+//
+// The first pass takes every opcode the recompiler translates (see
+// Recompiler::Translates) as a one instruction block, --cases times each
+// with random registers, operands, zero page and stack and a scattering of
+// other random bytes, so page crossings, wrapping pointers and every flag
+// combination come up.  The second runs --blocks blocks of up to 8 random
+// translatable instructions, for what's carried from one to the next.
+//
+//     cpu_recompiler_diff [--cases N] [--blocks N] [--seed N]
+//
+// Prints the first mismatches and exits 1 if there were any, or if an
+// opcode never ran translated.  Exits 77 (skipped) when there's no
+// recompiler.
+
+#include "6502Core.h"
+#include "MemoryMap.h"
+#include "Recompiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace raunnes {
+
+// One CPU with its memory, optionally recompiling
+class Machine {
+public:
+    Machine(const std::vector<uint8_t>& prg, const Recompiler::Options* options) :
+        m_Memory(prg.data(), prg.size(), nullptr, 0),
+        m_CPU(m_Memory) {
+        if (options != nullptr) {
+            m_Recompiler.reset(new Recompiler(m_Memory, *options));
+            m_Memory.AttachRecompiler(m_Recompiler.get());
+            m_CPU.AttachRecompiler(m_Recompiler.get());
+        }
+    }
+
+    MemoryMap& Memory() { return m_Memory; }
+    CPUCore6502& Cpu() { return m_CPU; }
+
+    void SetRegisters(const CPUCore6502::CPUCore6502State& registers) {
+        m_CPU.PC() = registers.PC;
+        m_CPU.A() = registers.A;
+        m_CPU.X() = registers.X;
+        m_CPU.Y() = registers.Y;
+        m_CPU.P() = registers.P;
+        m_CPU.SP() = registers.SP;
+    }
+
+public:
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+private:
+    MemoryMap m_Memory;
+    CPUCore6502 m_CPU;
+    std::unique_ptr<Recompiler> m_Recompiler;
+};
+
+class Differ {
+public:
+    Differ(uint32_t seed, uint32_t maxInstructions) :
+        m_Random(seed),
+        m_Prg(0x4000, 0),
+        m_Options({ 1, maxInstructions, false }),
+        m_Interpreted(m_Prg, nullptr),
+        m_Translated(m_Prg, &m_Options),
+        m_Failures(0) {
+        for (uint32_t address = 0; address < 0x10000; address++) {
+            Write((uint16_t)address, (uint8_t)m_Random());
+        }
+    }
+
+    uint32_t Failures() const { return m_Failures; }
+
+    // Both memories get the same bytes, through Write() so the translated
+    // side drops blocks that were translated from there
+    void Write(uint16_t address, uint8_t value) {
+        m_Interpreted.Memory().Write(address, value);
+        m_Translated.Memory().Write(address, value);
+    }
+
+    // Fresh registers, zero page, stack and some scattered bytes, with code
+    // at a random address; returns that address
+    uint16_t Shuffle(const uint8_t* code, uint32_t size) {
+        for (uint32_t address = 0; address < 0x200; address++) {
+            Write((uint16_t)address, (uint8_t)m_Random());
+        }
+        for (uint32_t i = 0; i < 64; i++) {
+            Write((uint16_t)m_Random(), (uint8_t)m_Random());
+        }
+
+        // Not so close to the top that the block would wrap around
+        uint16_t pc = (uint16_t)(0x200 + m_Random() % (0xfe00 - size));
+        for (uint32_t i = 0; i < size; i++) {
+            Write((uint16_t)(pc + i), code[i]);
+        }
+
+        CPUCore6502::CPUCore6502State registers;
+        registers.PC = pc;
+        registers.A = (uint8_t)m_Random();
+        registers.X = (uint8_t)m_Random();
+        registers.Y = (uint8_t)m_Random();
+        registers.P = (uint8_t)((m_Random() & 0xef) | 0x20);
+        registers.SP = (uint8_t)m_Random();
+        m_Interpreted.SetRegisters(registers);
+        m_Translated.SetRegisters(registers);
+        return pc;
+    }
+
+    uint8_t Random() { return (uint8_t)m_Random(); }
+
+    // Runs a block from the PC Shuffle() chose on the translated side and as
+    // many instructions on the interpreter, returning how many that was
+    uint32_t Run() {
+        CPUCore6502& interpreted = m_Interpreted.Cpu();
+        CPUCore6502& translated = m_Translated.Cpu();
+        uint16_t pc = interpreted.PC();
+        uint64_t interpretedStart = interpreted.Cycles();
+        uint64_t translatedStart = translated.Cycles();
+
+        uint16_t lastPC;
+        uint32_t ran = translated.ExecuteBlock(UINT64_MAX, lastPC);
+        for (uint32_t i = 0; i < ran; i++) {
+            interpreted.Execute();
+        }
+        if (ran == 0) {
+            return 0;
+        }
+
+        const CPUCore6502::CPUCore6502State& a = interpreted.Registers();
+        const CPUCore6502::CPUCore6502State& b = translated.Registers();
+        uint64_t interpretedCycles = interpreted.Cycles() - interpretedStart;
+        uint64_t translatedCycles = translated.Cycles() - translatedStart;
+        int32_t differs = FirstDifference();
+
+        if (a.PC != b.PC || a.A != b.A || a.X != b.X || a.Y != b.Y || a.P != b.P || a.SP != b.SP ||
+            interpretedCycles != translatedCycles || differs >= 0) {
+            if (m_Failures++ < 20) {
+                MemoryMap& memory = m_Interpreted.Memory();
+                printf("%04x: %02x %02x %02x, %u instructions: pc %04x a %02x x %02x y %02x p %02x sp %02x %llu cycles, interpreter %04x %02x %02x %02x %02x %02x %llu",
+                    pc, memory.Peek(pc), memory.Peek((uint16_t)(pc + 1)), memory.Peek((uint16_t)(pc + 2)), ran,
+                    b.PC, b.A, b.X, b.Y, b.P, b.SP, (unsigned long long)translatedCycles,
+                    a.PC, a.A, a.X, a.Y, a.P, a.SP, (unsigned long long)interpretedCycles);
+                if (differs >= 0) {
+                    printf(", memory differs from %04x", differs);
+                }
+                printf("\n");
+            }
+
+            // Carry on from the interpreter's memory
+            for (uint32_t address = 0; address < 0x10000; address++) {
+                m_Translated.Memory().Write((uint16_t)address, m_Interpreted.Memory().Peek((uint16_t)address));
+            }
+        }
+        return ran;
+    }
+
+public:
+    Differ(const Differ&) = delete;
+    Differ& operator=(const Differ&) = delete;
+
+private:
+    int32_t FirstDifference() {
+        for (uint32_t page = 0; page < 256; page++) {
+            const uint8_t* a = m_Interpreted.Memory().DirectPage((uint8_t)page, false);
+            const uint8_t* b = m_Translated.Memory().DirectPage((uint8_t)page, false);
+            if (memcmp(a, b, 0x100) != 0) {
+                for (uint32_t offset = 0; offset < 0x100; offset++) {
+                    if (a[offset] != b[offset]) {
+                        return (int32_t)(page << 8 | offset);
+                    }
+                }
+            }
+        }
+        return -1;
+    }
+
+private:
+    std::mt19937 m_Random;
+    std::vector<uint8_t> m_Prg;
+    Recompiler::Options m_Options;
+    Machine m_Interpreted;
+    Machine m_Translated;
+    uint32_t m_Failures;
+};
+
+}
+
+int main(int argc, char** argv) {
+    using namespace raunnes;
+
+    uint32_t cases = 300;
+    uint32_t blocks = 20000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cases") == 0 && i + 1 < argc) {
+            cases = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+            blocks = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)atoi(argv[++i]);
+        } else {
+            printf("usage: %s [--cases N] [--blocks N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (!Recompiler::Supported()) {
+        printf("no recompiler on this host\n");
+        return 77;
+    }
+
+    std::vector<uint8_t> opcodes;
+    for (uint32_t opcode = 0; opcode < 256; opcode++) {
+        if (Recompiler::Translates((uint8_t)opcode)) {
+            opcodes.push_back((uint8_t)opcode);
+        }
+    }
+
+    // Every opcode on its own
+    Differ single(seed, 1);
+    uint32_t untranslated = 0;
+    uint64_t singleRuns = 0;
+    for (uint8_t opcode : opcodes) {
+        uint32_t ran = 0;
+        for (uint32_t i = 0; i < cases; i++) {
+            uint8_t code[3] = { opcode, single.Random(), single.Random() };
+            single.Shuffle(code, sizeof(code));
+            ran += single.Run();
+        }
+        if (ran == 0) {
+            printf("%02x never ran translated\n", opcode);
+            untranslated++;
+        }
+        singleRuns += ran;
+    }
+
+    // Runs of them
+    Differ multiple(seed, 8);
+    uint64_t multipleRuns = 0;
+    for (uint32_t i = 0; i < blocks; i++) {
+        uint8_t code[8 * 3];
+        uint32_t size = 0;
+        for (uint32_t n = 0; n < 8; n++) {
+            uint8_t opcode = opcodes[multiple.Random() % opcodes.size()];
+            code[size++] = opcode;
+            for (uint32_t operand = 1; operand < CPUCore6502::Details(opcode).InstructionSize; operand++) {
+                code[size++] = multiple.Random();
+            }
+        }
+        multiple.Shuffle(code, size);
+        multipleRuns += multiple.Run();
+    }
+
+    uint32_t failures = single.Failures() + multiple.Failures();
+    printf("%zu opcodes, %llu instructions one at a time, %llu in blocks of up to 8: %s\n",
+        opcodes.size(), (unsigned long long)singleRuns, (unsigned long long)multipleRuns,
+        failures == 0 && untranslated == 0 ? "ok" : "failed");
+
+    return failures == 0 && untranslated == 0 ? 0 : 1;
+}
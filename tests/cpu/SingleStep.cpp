@@ -0,0 +1,481 @@
+// Runs single instruction CPU tests in the format of the SingleStepTests
+// suite: one file per opcode, 00.json to ff.json, each an array of cases
+// giving the registers and RAM before and after one instruction and the
+// bus cycles it took.
+// https://github.com/SingleStepTests/65x02/tree/main/nes6502
+//
+// The suite itself goes in tests/cpu/v1.  tests/cpu/sample has 100 cases
+// each for a few opcodes (LDA #, INX, ADC #, BNE, STA abs, KIL) in the same
+// format, worked out from the documented behaviour, so there's always
+// something to run.
+//
+// Every opcode file is a separate job; a worker per core takes the next one,
+// parses it straight into a reused case (no DOM) and runs each case on its
+// own CPU over a MemoryMap with nothing attached, which is flat RAM.  The
+// per cycle bus log isn't compared, only how many cycles there were.
+//
+//     cpu_single_step <dir> [--threads N] [--jit]
+//
+// Prints a line for every opcode that isn't clean and exits 1 if any case
+// failed.  KIL opcodes only need to jam the CPU; unofficial opcodes that
+// aren't emulated are listed and skipped.
+//
+// --jit runs every case the recompiler can take as a one instruction block,
+// translated on first sight, and the rest interpreted.  Exits 77 (skipped)
+// when there's no recompiler.
+
+#include "6502Core.h"
+#include "MemoryMap.h"
+#include "Recompiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace raunnes {
+
+struct CPUTestState {
+    uint16_t PC;
+    uint8_t S;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    std::vector<std::pair<uint16_t, uint8_t>> Ram;
+};
+
+struct CPUTestCase {
+    std::string Name;
+    CPUTestState Initial;
+    CPUTestState Final;
+    uint32_t Cycles;
+};
+
+struct OpcodeResult {
+    bool Found;
+    bool ParseError;
+    uint32_t Cases;
+    uint32_t Failed;
+    uint32_t Halted;
+    uint32_t Translated;
+    std::string FirstFailure;
+};
+
+// Just enough JSON for the test files, read in place
+class JsonCursor {
+public:
+    JsonCursor(const char* begin, const char* end) : m_At(begin), m_End(end), m_Ok(true) {}
+
+    bool Ok() const { return m_Ok; }
+
+    void SkipSpace() {
+        while (m_At < m_End && (*m_At == ' ' || *m_At == '\n' || *m_At == '\r' || *m_At == '\t')) {
+            m_At++;
+        }
+    }
+
+    bool Peek(char c) {
+        SkipSpace();
+        return m_At < m_End && *m_At == c;
+    }
+
+    void Expect(char c) {
+        SkipSpace();
+        if (m_At < m_End && *m_At == c) {
+            m_At++;
+        } else {
+            m_Ok = false;
+            m_At = m_End;
+        }
+    }
+
+    // After an element: true if there's another, having eaten the comma
+    bool Next(char close) {
+        SkipSpace();
+        if (m_At < m_End && *m_At == ',') {
+            m_At++;
+            return true;
+        }
+        Expect(close);
+        return false;
+    }
+
+    uint32_t Number() {
+        SkipSpace();
+        uint32_t value = 0;
+        const char* start = m_At;
+        while (m_At < m_End && *m_At >= '0' && *m_At <= '9') {
+            value = value * 10 + (*m_At++ - '0');
+        }
+        if (m_At == start) {
+            m_Ok = false;
+            m_At = m_End;
+        }
+        return value;
+    }
+
+    // No escapes in these files
+    void String(std::string& out) {
+        Expect('"');
+        const char* start = m_At;
+        while (m_At < m_End && *m_At != '"') {
+            m_At++;
+        }
+        out.assign(start, m_At);
+        Expect('"');
+    }
+
+    // Compares a key without copying it
+    bool Key(const char* name) {
+        SkipSpace();
+        size_t length = strlen(name);
+        if (m_At + length + 2 <= m_End && m_At[0] == '"' && memcmp(m_At + 1, name, length) == 0 && m_At[length + 1] == '"') {
+            m_At += length + 2;
+            Expect(':');
+            return true;
+        }
+        return false;
+    }
+
+    void SkipValue() {
+        SkipSpace();
+        if (m_At >= m_End) {
+            m_Ok = false;
+            return;
+        }
+
+        if (*m_At == '"') {
+            m_At++;
+            while (m_At < m_End && *m_At != '"') {
+                m_At++;
+            }
+            m_At++;
+        } else if (*m_At == '[' || *m_At == '{') {
+            char close = *m_At == '[' ? ']' : '}';
+            m_At++;
+            if (Peek(close)) {
+                m_At++;
+                return;
+            }
+            do {
+                if (close == '}') {
+                    SkipValue();
+                    Expect(':');
+                }
+                SkipValue();
+            } while (Next(close));
+        } else {
+            while (m_At < m_End && *m_At != ',' && *m_At != ']' && *m_At != '}') {
+                m_At++;
+            }
+        }
+    }
+
+private:
+    const char* m_At;
+    const char* m_End;
+    bool m_Ok;
+};
+
+static void ParseState(JsonCursor& json, CPUTestState& state) {
+    state.Ram.clear();
+
+    json.Expect('{');
+    do {
+        if (json.Key("pc")) {
+            state.PC = (uint16_t)json.Number();
+        } else if (json.Key("s")) {
+            state.S = (uint8_t)json.Number();
+        } else if (json.Key("a")) {
+            state.A = (uint8_t)json.Number();
+        } else if (json.Key("x")) {
+            state.X = (uint8_t)json.Number();
+        } else if (json.Key("y")) {
+            state.Y = (uint8_t)json.Number();
+        } else if (json.Key("p")) {
+            state.P = (uint8_t)json.Number();
+        } else if (json.Key("ram")) {
+            json.Expect('[');
+            if (!json.Peek(']')) {
+                do {
+                    json.Expect('[');
+                    uint16_t address = (uint16_t)json.Number();
+                    json.Expect(',');
+                    uint8_t value = (uint8_t)json.Number();
+                    json.Expect(']');
+                    state.Ram.push_back(std::make_pair(address, value));
+                } while (json.Next(']'));
+            } else {
+                json.Expect(']');
+            }
+        } else {
+            json.SkipValue();
+            json.Expect(':');
+            json.SkipValue();
+        }
+    } while (json.Ok() && json.Next('}'));
+}
+
+static void ParseCase(JsonCursor& json, CPUTestCase& test) {
+    test.Cycles = 0;
+
+    json.Expect('{');
+    do {
+        if (json.Key("name")) {
+            json.String(test.Name);
+        } else if (json.Key("initial")) {
+            ParseState(json, test.Initial);
+        } else if (json.Key("final")) {
+            ParseState(json, test.Final);
+        } else if (json.Key("cycles")) {
+            json.Expect('[');
+            if (!json.Peek(']')) {
+                do {
+                    json.SkipValue();
+                    test.Cycles++;
+                } while (json.Next(']'));
+            } else {
+                json.Expect(']');
+            }
+        } else {
+            json.SkipValue();
+            json.Expect(':');
+            json.SkipValue();
+        }
+    } while (json.Ok() && json.Next('}'));
+}
+
+static bool ReadFile(const std::string& path, std::vector<char>& out) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    out.resize(size > 0 ? (size_t)size : 0);
+    bool ok = fread(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return ok;
+}
+
+// Runs one case, describing the first difference in failure
+static bool RunCase(CPUCore6502& cpu, MemoryMap& memory, const CPUTestCase& test, bool& halted, bool& translated, std::string& failure) {
+    for (const auto& ram : test.Initial.Ram) {
+        memory.Write(ram.first, ram.second);
+    }
+
+    cpu.PC() = test.Initial.PC;
+    cpu.SP() = test.Initial.S;
+    cpu.A() = test.Initial.A;
+    cpu.X() = test.Initial.X;
+    cpu.Y() = test.Initial.Y;
+    cpu.P() = test.Initial.P;
+
+    uint64_t start = cpu.Cycles();
+    uint16_t lastPC;
+    translated = cpu.ExecuteBlock(UINT64_MAX, lastPC) != 0;
+    if (!translated) {
+        cpu.Execute();
+    }
+    uint32_t cycles = (uint32_t)(cpu.Cycles() - start);
+
+    halted = cpu.Halted();
+
+    char buffer[160];
+    failure.clear();
+    if (!halted) {
+        const CPUTestState& expect = test.Final;
+        if (cpu.PC() != expect.PC || cpu.SP() != expect.S || cpu.A() != expect.A ||
+            cpu.X() != expect.X || cpu.Y() != expect.Y || cpu.P() != expect.P) {
+            snprintf(buffer, sizeof(buffer), "registers pc %04x s %02x a %02x x %02x y %02x p %02x, expected %04x %02x %02x %02x %02x %02x",
+                cpu.PC(), cpu.SP(), cpu.A(), cpu.X(), cpu.Y(), cpu.P(),
+                expect.PC, expect.S, expect.A, expect.X, expect.Y, expect.P);
+            failure = buffer;
+        }
+
+        for (const auto& ram : expect.Ram) {
+            if (failure.empty() && memory.Peek(ram.first) != ram.second) {
+                snprintf(buffer, sizeof(buffer), "ram %04x is %02x, expected %02x", ram.first, memory.Peek(ram.first), ram.second);
+                failure = buffer;
+            }
+        }
+
+        if (failure.empty() && cycles != test.Cycles) {
+            snprintf(buffer, sizeof(buffer), "%u cycles, expected %u", cycles, test.Cycles);
+            failure = buffer;
+        }
+    }
+
+    // Back to all zero for the next case
+    for (const auto& ram : test.Initial.Ram) {
+        memory.Write(ram.first, 0);
+    }
+    for (const auto& ram : test.Final.Ram) {
+        memory.Write(ram.first, 0);
+    }
+    if (halted) {
+        cpu.Reset();
+    }
+
+    return failure.empty();
+}
+
+static void RunOpcode(const std::string& directory, uint32_t opcode, std::vector<char>& file, CPUCore6502& cpu, MemoryMap& memory, OpcodeResult& result) {
+    char name[8];
+    snprintf(name, sizeof(name), "%02x.json", opcode);
+    if (!ReadFile(directory + "/" + name, file)) {
+        snprintf(name, sizeof(name), "%02X.json", opcode);
+        if (!ReadFile(directory + "/" + name, file)) {
+            return;
+        }
+    }
+    result.Found = true;
+
+    JsonCursor json(file.data(), file.data() + file.size());
+    CPUTestCase test;
+    std::string failure;
+
+    json.Expect('[');
+    if (json.Peek(']')) {
+        return;
+    }
+
+    do {
+        ParseCase(json, test);
+        if (!json.Ok()) {
+            break;
+        }
+
+        bool halted = false;
+        bool translated = false;
+        result.Cases++;
+        if (!RunCase(cpu, memory, test, halted, translated, failure)) {
+            if (result.Failed++ == 0) {
+                result.FirstFailure = test.Name + ": " + failure;
+            }
+        }
+        result.Halted += halted ? 1 : 0;
+        result.Translated += translated ? 1 : 0;
+    } while (json.Next(']'));
+
+    result.ParseError = !json.Ok();
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace raunnes;
+
+    const char* directory = nullptr;
+    uint32_t threads = std::thread::hardware_concurrency();
+    bool recompile = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            recompile = true;
+        } else {
+            directory = argv[i];
+        }
+    }
+
+    if (directory == nullptr) {
+        printf("usage: %s <dir of 00.json - ff.json> [--threads N] [--jit]\n", argv[0]);
+        return 2;
+    }
+    if (recompile && !Recompiler::Supported()) {
+        printf("no recompiler on this host\n");
+        return 77;
+    }
+    threads = threads ? threads : 1;
+
+    std::vector<OpcodeResult> results(256, OpcodeResult{ false, false, 0, 0, 0, 0, std::string() });
+    std::atomic<uint32_t> nextOpcode(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threads; i++) {
+        workers.emplace_back([&]() {
+            // A CPU of its own over flat RAM; the reset vector is never used
+            std::vector<uint8_t> prg(0x4000, 0);
+            MemoryMap memory(prg.data(), prg.size(), nullptr, 0);
+            CPUCore6502 cpu(memory);
+            std::vector<char> file;
+
+            std::unique_ptr<Recompiler> recompiler;
+            if (recompile) {
+                Recompiler::Options options = { 1, 1, false };
+                recompiler.reset(new Recompiler(memory, options));
+                memory.AttachRecompiler(recompiler.get());
+                cpu.AttachRecompiler(recompiler.get());
+            }
+
+            uint32_t opcode;
+            while ((opcode = nextOpcode.fetch_add(1)) < 256) {
+                if (CPUCore6502::Implemented((uint8_t)opcode)) {
+                    RunOpcode(directory, opcode, file, cpu, memory, results[opcode]);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t files = 0;
+    uint64_t cases = 0;
+    uint64_t failed = 0;
+    uint64_t translated = 0;
+    uint32_t failedOpcodes = 0;
+    std::string notImplemented;
+
+    for (uint32_t opcode = 0; opcode < 256; opcode++) {
+        const OpcodeResult& result = results[opcode];
+        if (!CPUCore6502::Implemented((uint8_t)opcode)) {
+            char hex[4];
+            snprintf(hex, sizeof(hex), " %02x", opcode);
+            notImplemented += hex;
+            continue;
+        }
+        if (!result.Found) {
+            continue;
+        }
+
+        files++;
+        cases += result.Cases;
+        failed += result.Failed;
+        translated += result.Translated;
+
+        if (result.Failed > 0 || result.ParseError) {
+            failedOpcodes++;
+            printf("%02x  %u of %u failed%s  first: %s\n", opcode, result.Failed, result.Cases,
+                result.ParseError ? ", file didn't parse" : "", result.FirstFailure.c_str());
+        } else if (result.Halted > 0) {
+            printf("%02x  jammed in %u of %u\n", opcode, result.Halted, result.Cases);
+        }
+    }
+
+    if (!notImplemented.empty()) {
+        printf("not emulated, skipped:%s\n", notImplemented.c_str());
+    }
+    printf("%u opcodes, %llu cases, %llu failed in %u opcodes, %.2f s on %u threads\n",
+        files, (unsigned long long)cases, (unsigned long long)failed, failedOpcodes, seconds, threads);
+    if (recompile) {
+        printf("%llu cases translated\n", (unsigned long long)translated);
+    }
+
+    return files > 0 && failedOpcodes == 0 ? 0 : 1;
+}
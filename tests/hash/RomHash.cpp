@@ -0,0 +1,114 @@
+// Known answers for the ROM hashes, and the PCLMULQDQ CRC32 and SHA-NI
+// SHA-1 paths against the portable ones.  The sizes are the ones the paths
+// split on: under a block, SHA-1's padding fitting in the last block or
+// not (55 / 56 bytes), one byte short of a block and exactly one, the
+// 64 bytes the folded CRC needs, odd tails, and a 512 KiB ROM's worth.
+//
+//     rom_hash
+//
+// Prints every mismatch and exits 1 if there were any.  On a host without
+// the instructions only the portable paths are checked.
+
+#include "RomHash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace raunnes {
+
+static int g_Failures = 0;
+
+static std::string Hex(const uint8_t* bytes, size_t size) {
+    std::string text;
+    char digits[3];
+    for (size_t i = 0; i < size; i++) {
+        snprintf(digits, sizeof(digits), "%02x", bytes[i]);
+        text += digits;
+    }
+    return text;
+}
+
+static void Check(bool ok, const char* what, size_t size) {
+    if (!ok) {
+        printf("%s: mismatch at %zu bytes\n", what, size);
+        g_Failures++;
+    }
+}
+
+static void CheckKnown(const char* text, uint32_t crc, const char* sha1) {
+    const uint8_t* data = (const uint8_t*)text;
+    size_t size = strlen(text);
+    uint8_t digest[20];
+
+    Check(Crc32(data, size) == crc, "crc32 known answer", size);
+    Check(Crc32Portable(data, size) == crc, "portable crc32 known answer", size);
+    Sha1(data, size, digest);
+    Check(Hex(digest, sizeof(digest)) == sha1, "sha1 known answer", size);
+    Sha1Portable(data, size, digest);
+    Check(Hex(digest, sizeof(digest)) == sha1, "portable sha1 known answer", size);
+}
+
+}
+
+int main() {
+    using namespace raunnes;
+
+    CheckKnown("", 0x00000000, "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    CheckKnown("123456789", 0xcbf43926, "f7c3bc1d808e04732adf679965ccc34ca7ae3441");
+    CheckKnown("abc", 0x352441c2, "a9993e364706816aba3e25717850c26c9cd0d89d");
+    CheckKnown("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 0x171a3f5f,
+        "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+    // Anything but a repeating pattern, so a block taken from the wrong
+    // offset shows
+    std::vector<uint8_t> data(512 * 1024);
+    uint32_t seed = 0x12345678;
+    for (uint8_t& byte : data) {
+        seed = seed * 1103515245 + 12345;
+        byte = (uint8_t)(seed >> 16);
+    }
+
+    const size_t sizes[] = {
+        0, 1, 15, 16, 17, 55, 56, 57, 63, 64, 65, 79, 80, 119, 120, 127, 128, 129,
+        191, 255, 256, 1000, 4095, 4096, 16384, 40976, 512 * 1024 - 1, 512 * 1024,
+    };
+
+    for (size_t size : sizes) {
+        // Off an odd address as well, the loads mustn't assume alignment
+        for (size_t offset : { (size_t)0, (size_t)1 }) {
+            if (offset + size > data.size()) {
+                continue;
+            }
+            const uint8_t* at = data.data() + offset;
+
+            Check(Crc32(at, size) == Crc32Portable(at, size), "crc32", size);
+            Check(Crc32(at, size, 0xdeadbeef) == Crc32Portable(at, size, 0xdeadbeef), "running crc32", size);
+
+            uint8_t fast[20], portable[20];
+            Sha1(at, size, fast);
+            Sha1Portable(at, size, portable);
+            Check(memcmp(fast, portable, sizeof(fast)) == 0, "sha1", size);
+        }
+
+        // PRG and CHR hashed apart and combined, as RomFingerprint does
+        size_t split = size / 3;
+        uint32_t crcA = Crc32(data.data(), split);
+        uint32_t crcB = Crc32(data.data() + split, size - split);
+        Check(Crc32Combine(crcA, crcB, size - split) == Crc32Portable(data.data(), size), "crc32 combine", size);
+
+        RomFingerprint fingerprint = RomFingerprint::Compute(data.data(), split, data.data() + split, size - split);
+        uint8_t whole[20];
+        Sha1Portable(data.data(), size, whole);
+        Check(fingerprint.Crc32 == Crc32Portable(data.data(), size), "fingerprint crc32", size);
+        Check(memcmp(fingerprint.Sha1, whole, sizeof(whole)) == 0, "fingerprint sha1", size);
+    }
+
+    printf("crc32 %s, sha1 %s: %s\n",
+        Crc32Accelerated() ? "pclmulqdq" : "portable",
+        Sha1Accelerated() ? "sha-ni" : "portable",
+        g_Failures == 0 ? "ok" : "failed");
+
+    return g_Failures == 0 ? 0 : 1;
+}
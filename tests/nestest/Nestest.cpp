@@ -0,0 +1,173 @@
+// Runs nestest's automated mode and compares the CPU against nestest.log,
+// the reference trace: registers and cycle count before every instruction,
+// from $C000 to the end of the tests.  At the end $02 and $03 hold the
+// codes of the first failed official and unofficial test, 0 when they all
+// passed.
+// https://www.qmtpro.com/~nes/misc/nestest.txt
+//
+// It's a MemoryMap with nothing attached, so the PPU and APU registers the
+// tests poke are just memory, which is what the log was made with.
+//
+//     cpu_nestest <dir with nestest.nes and nestest.log> [--jit]
+//
+// --jit translates every block on first sight.  Blocks can only be checked
+// where they end, so the trace is compared there, and the run fails if
+// nothing ran translated.  Exits 77 (skipped) when there's no recompiler.
+
+#include "6502Core.h"
+#include "Cartridge.h"
+#include "MemoryMap.h"
+#include "Recompiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace raunnes {
+
+struct TraceLine {
+    CPUCore6502::CPUCore6502State Registers;
+    uint64_t Cycles;
+};
+
+// "C000  4C F5 C5  JMP $C5F5    A:00 X:00 Y:00 P:24 SP:FD PPU:  0,  0 CYC:7"
+static bool ParseLine(const char* text, TraceLine& line) {
+    const char* registers = strstr(text, "A:");
+    const char* cycles = strstr(text, "CYC:");
+    unsigned pc, a, x, y, p, sp;
+    unsigned long long cyc;
+
+    if (registers == nullptr || cycles == nullptr ||
+        sscanf(text, "%4x", &pc) != 1 ||
+        sscanf(registers, "A:%x X:%x Y:%x P:%x SP:%x", &a, &x, &y, &p, &sp) != 5 ||
+        sscanf(cycles, "CYC:%llu", &cyc) != 1) {
+        return false;
+    }
+
+    line.Registers.PC = (uint16_t)pc;
+    line.Registers.A = (uint8_t)a;
+    line.Registers.X = (uint8_t)x;
+    line.Registers.Y = (uint8_t)y;
+    line.Registers.P = (uint8_t)p;
+    line.Registers.SP = (uint8_t)sp;
+    line.Cycles = cyc;
+    return true;
+}
+
+static bool LoadTrace(const std::string& path, std::vector<TraceLine>& lines) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char text[256];
+    TraceLine line;
+    bool ok = true;
+    while (ok && fgets(text, sizeof(text), file) != nullptr) {
+        ok = ParseLine(text, line);
+        lines.push_back(line);
+    }
+    fclose(file);
+    return ok && !lines.empty();
+}
+
+static bool Matches(const CPUCore6502& cpu, const TraceLine& line) {
+    const CPUCore6502::CPUCore6502State& registers = cpu.Registers();
+    return registers.PC == line.Registers.PC &&
+        registers.A == line.Registers.A &&
+        registers.X == line.Registers.X &&
+        registers.Y == line.Registers.Y &&
+        registers.P == line.Registers.P &&
+        registers.SP == line.Registers.SP &&
+        cpu.Cycles() == line.Cycles;
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace raunnes;
+
+    const char* directory = nullptr;
+    bool recompile = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            recompile = true;
+        } else {
+            directory = argv[i];
+        }
+    }
+
+    if (directory == nullptr) {
+        printf("usage: %s <dir of nestest.nes and nestest.log> [--jit]\n", argv[0]);
+        return 2;
+    }
+    if (recompile && !Recompiler::Supported()) {
+        printf("no recompiler on this host\n");
+        return 77;
+    }
+
+    Cartridge cartridge;
+    std::vector<TraceLine> lines;
+    if (!cartridge.Load(std::string(directory) + "/nestest.nes", nullptr) ||
+        !LoadTrace(std::string(directory) + "/nestest.log", lines)) {
+        printf("unable to load nestest from %s %s\n", directory, cartridge.Error().c_str());
+        return 1;
+    }
+
+    MemoryMap memory(cartridge.PRG().data(), cartridge.PRG().size(),
+        cartridge.CHR().data(), cartridge.CHR().size(), cartridge.HasCHRRAM());
+    CPUCore6502 cpu(memory);
+    cpu.PC() = 0xc000;
+
+    std::unique_ptr<Recompiler> recompiler;
+    if (recompile) {
+        Recompiler::Options options = Recompiler::kDefaultOptions;
+        options.HotCount = 1;
+        recompiler.reset(new Recompiler(memory, options));
+        memory.AttachRecompiler(recompiler.get());
+        cpu.AttachRecompiler(recompiler.get());
+    }
+
+    // Instructions run so far, which is the line the CPU should be at
+    size_t at = 0;
+    while (at < lines.size()) {
+        if (!Matches(cpu, lines[at])) {
+            const CPUCore6502::CPUCore6502State& registers = cpu.Registers();
+            const TraceLine& expect = lines[at];
+            printf("line %zu: %04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu, expected %04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+                at + 1,
+                registers.PC, registers.A, registers.X, registers.Y, registers.P, registers.SP, (unsigned long long)cpu.Cycles(),
+                expect.Registers.PC, expect.Registers.A, expect.Registers.X, expect.Registers.Y, expect.Registers.P, expect.Registers.SP,
+                (unsigned long long)expect.Cycles);
+            return 1;
+        }
+
+        uint16_t lastPC;
+        uint32_t ran = cpu.ExecuteBlock(UINT64_MAX, lastPC);
+        if (ran == 0) {
+            cpu.Execute();
+            ran = 1;
+        }
+        at += ran;
+    }
+
+    uint8_t official = memory.Peek(0x02);
+    uint8_t unofficial = memory.Peek(0x03);
+    if (official != 0 || unofficial != 0) {
+        printf("failed: official %02x, unofficial %02x\n", official, unofficial);
+        return 1;
+    }
+
+    uint64_t translated = recompiler ? recompiler->Translated() : 0;
+    printf("%zu instructions match", lines.size());
+    if (recompile) {
+        printf(", %llu translated", (unsigned long long)translated);
+    }
+    printf("\n");
+
+    return recompile && translated == 0 ? 1 : 0;
+}
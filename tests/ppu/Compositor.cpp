@@ -0,0 +1,139 @@
+// Every compositor kernel the host can run against the scalar one, on random
+// rows: background and sprite pixels, priorities, palettes, greyscale and
+// sprite 0 somewhere or nowhere.  Output pixels have to match, and so does
+// where sprite 0 first hits, found by compositing ever longer prefixes of
+// the row 32 pixels at a time and, for a sprite 0 of a single pixel,
+// exactly.  Rows start off 16 byte boundaries as well.
+//
+//     ppu_composite [--rows N] [--seed N]
+//
+// Prints every mismatch (up to a limit) and exits 1 if there were any.
+
+#include "Compositor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace raunnes {
+
+static const uint32_t kRow = 256;
+
+struct Row {
+    uint8_t Bg[kRow + 1];
+    uint8_t Sprites[kRow + 1];
+    uint8_t Palette[32];
+    uint8_t Greyscale;
+};
+
+static void RandomRow(std::mt19937& random, Row& row, uint32_t offset) {
+    // Mostly long runs of each kind, like real pictures, with noise mixed in
+    uint32_t bgDensity = random() % 5;
+    uint32_t spriteDensity = random() % 5;
+
+    for (uint32_t x = 0; x < kRow; x++) {
+        uint8_t bg = (uint8_t)(random() & 0x0f);
+        if (random() % 4 >= bgDensity) {
+            bg &= 0x0c;
+        }
+
+        uint8_t sprite = 0;
+        if (random() % 4 < spriteDensity) {
+            sprite = (uint8_t)(0x10 | (random() & 0x0f) | (random() & 0x40));
+        }
+
+        row.Bg[offset + x] = bg;
+        row.Sprites[offset + x] = sprite;
+    }
+
+    // Sprite 0: an 8 pixel span, a single pixel, or not on this line
+    switch (random() % 3) {
+    case 0: {
+        uint32_t left = random() % kRow;
+        for (uint32_t x = left; x < left + 8 && x < kRow; x++) {
+            row.Sprites[offset + x] |= 0x80;
+        }
+        break;
+    }
+    case 1:
+        row.Sprites[offset + random() % kRow] |= 0x80;
+        break;
+    }
+
+    for (uint8_t& color : row.Palette) {
+        color = (uint8_t)(random() % 64);
+    }
+    row.Greyscale = (random() & 1) ? 0x30 : 0x3f;
+}
+
+}
+
+int main(int argc, char** argv) {
+    using namespace raunnes;
+
+    uint32_t rows = 20000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            rows = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)atoi(argv[++i]);
+        } else {
+            printf("usage: %s [--rows N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    CompositeFunction scalar = GetCompositeFunction(CompositeKernelScalar);
+    uint32_t failures = 0;
+    std::string checked;
+
+    for (int k = CompositeKernelScalar; k <= CompositeKernelAVX2; k++) {
+        CompositeKernel kernel = (CompositeKernel)k;
+        CompositeFunction composite = GetCompositeFunction(kernel);
+        if (composite == nullptr) {
+            continue;
+        }
+        checked += checked.empty() ? "" : ", ";
+        checked += CompositeKernelName(kernel);
+
+        std::mt19937 random(seed);
+        uint32_t hits = 0;
+        Row row;
+        uint8_t expect[kRow + 1];
+        uint8_t out[kRow + 1];
+
+        for (uint32_t i = 0; i < rows; i++) {
+            uint32_t offset = i & 1;
+            RandomRow(random, row, offset);
+            const uint8_t* bg = row.Bg + offset;
+            const uint8_t* sprites = row.Sprites + offset;
+
+            bool expectHit = scalar(bg, sprites, row.Palette, row.Greyscale, expect, kRow);
+            bool hit = composite(bg, sprites, row.Palette, row.Greyscale, out + offset, kRow);
+            hits += expectHit;
+
+            bool same = hit == expectHit && memcmp(expect, out + offset, kRow) == 0;
+            for (uint32_t count = 32; same && count < kRow; count += 32) {
+                same = composite(bg, sprites, row.Palette, row.Greyscale, out + offset, count) ==
+                    scalar(bg, sprites, row.Palette, row.Greyscale, expect, count);
+            }
+
+            if (!same && failures++ < 20) {
+                printf("%s: row %u differs, hit %d, scalar %d\n", CompositeKernelName(kernel), i, hit, expectHit);
+            }
+        }
+
+        // Not much of a check if sprite 0 never hit, or always did
+        if (hits == 0 || hits == rows) {
+            printf("%s: sprite 0 hit %u of %u rows\n", CompositeKernelName(kernel), hits, rows);
+            failures++;
+        }
+    }
+
+    printf("%u rows through %s: %s\n", rows, checked.c_str(), failures == 0 ? "ok" : "failed");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include "Cartridge.h"
+#include "Compositor.h"
+#include "Input.h"
+#include "Movie.h"
+#include "NESDriver.h"
+#include "Recompiler.h"
+#include "RomHash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Emulation speed for comparing builds and changes: each ROM runs from power
+// on for a fixed number of frames in each PPU mode, several times over, and
+// the best and median frame rates are reported along with the last frame's
+// CRC, which has to match between the builds being compared.
+//
+//   raunnes_bench [--frames n] [--repeat n] [--ppu scanline|dot|both] [--movie file]
+//                 [--no-idle-skip] [--jit] [--composite scalar|sse2|avx2] [rom ...]
+//
+// With no ROM it runs nestest through all its tests.
+
+using namespace raunnes;
+
+struct Result {
+    double BestFps;
+    double MedianFps;
+    uint32_t FrameCrc;
+};
+
+static Result Run(const Cartridge& cartridge, Cartridge::PPUAccuracy accuracy, CompositeKernel composite, const Movie& movie, uint32_t frames, uint32_t repeat, bool idleSkip, bool recompile) {
+    std::vector<double> fps;
+    uint32_t frameCrc = 0;
+
+    for (uint32_t run = 0; run < repeat; run++) {
+        NESDriver driver(cartridge);
+        driver.Ppu().SetAccuracy(accuracy);
+        driver.Ppu().SetCompositeKernel(composite);
+        driver.SetIdleSkip(idleSkip);
+        driver.SetRecompile(recompile);
+
+        InputSnapshot input;
+        driver.Pads().AttachInput(&input);
+
+        // Every frame drawn and its audio drained, as when playing
+        int16_t samples[4096];
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < frames; i++) {
+            input.SetAll(movie.ButtonsAt(i));
+            driver.RunFrame(true);
+            while (driver.Apu().ReadSamples(samples, 4096)) {
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        fps.push_back(frames / seconds);
+        frameCrc = Crc32(driver.Ppu().CurrentFrame().Pixels, PPU::kScreenWidth * PPU::kScreenHeight);
+    }
+
+    std::sort(fps.begin(), fps.end());
+    Result result = { fps.back(), fps[fps.size() / 2], frameCrc };
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = 1800;
+    uint32_t repeat = 5;
+    bool scanline = true;
+    bool dot = true;
+    bool idleSkip = true;
+    bool recompile = false;
+    CompositeKernel composite = BestCompositeKernel();
+    const char* moviePath = nullptr;
+    std::vector<std::string> roms;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--movie" && i + 1 < argc) {
+            moviePath = argv[++i];
+        } else if (arg == "--no-idle-skip") {
+            idleSkip = false;
+        } else if (arg == "--jit") {
+            recompile = true;
+        } else if (arg == "--composite" && i + 1 < argc) {
+            if (!CompositeKernelFromName(argv[++i], composite)) {
+                fprintf(stderr, "Unknown compositor %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--ppu" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            scanline = mode == "scanline" || mode == "both";
+            dot = mode == "dot" || mode == "both";
+            if (!scanline && !dot) {
+                fprintf(stderr, "Unknown PPU mode %s\n", mode.c_str());
+                return 1;
+            }
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return 1;
+        } else {
+            roms.push_back(arg);
+        }
+    }
+
+    if (roms.empty()) {
+        roms.push_back("../tests/nestest/nestest.nes");
+        if (moviePath == nullptr) {
+            moviePath = "../tests/nestest/nestest.movie";
+        }
+    }
+    if (recompile && !Recompiler::Supported()) {
+        fprintf(stderr, "No recompiler on this host\n");
+        return 1;
+    }
+    if (GetCompositeFunction(composite) == nullptr) {
+        fprintf(stderr, "No %s compositor on this host\n", CompositeKernelName(composite));
+        return 1;
+    }
+    frames = std::max(frames, 1u);
+    repeat = std::max(repeat, 1u);
+
+    Movie movie;
+    if (moviePath != nullptr && !movie.Load(moviePath)) {
+        fprintf(stderr, "Unable to load movie %s\n", moviePath);
+        return 1;
+    }
+
+    printf("%-40s %-8s %10s %10s %10s  %s\n", "rom", "ppu", "best fps", "median", "us/frame", "frame crc32");
+
+    for (const std::string& path : roms) {
+        Cartridge cartridge;
+        if (!cartridge.Load(path, nullptr)) {
+            fprintf(stderr, "Unable to load %s: %s\n", path.c_str(), cartridge.Error().c_str());
+            return 1;
+        }
+
+        for (int mode = 0; mode < 2; mode++) {
+            if ((mode == 0 && !scanline) || (mode == 1 && !dot)) {
+                continue;
+            }
+
+            Cartridge::PPUAccuracy accuracy = mode == 0 ? Cartridge::PPUAccuracyScanline : Cartridge::PPUAccuracyDot;
+            Result result = Run(cartridge, accuracy, composite, movie, frames, repeat, idleSkip, recompile);
+            printf("%-40s %-8s %10.1f %10.1f %10.1f  %08x\n",
+                path.c_str(), mode == 0 ? "scanline" : "dot",
+                result.BestFps, result.MedianFps, 1e6 / result.BestFps, result.FrameCrc);
+        }
+    }
+
+    return 0;
+}
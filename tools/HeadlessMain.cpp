@@ -0,0 +1,6 @@
+#include "Headless.h"
+
+// The emulator without a window or SFML, see HeadlessMain() for the options
+int main(int argc, char** argv) {
+    return raunnes::HeadlessMain(argc, argv);
+}
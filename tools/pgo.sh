@@ -0,0 +1,30 @@
+#!/bin/sh
+# Profile-guided, link time optimized build.
+#
+#   tools/pgo.sh [build dir]     (default build-pgo)
+#
+# Builds instrumented binaries, trains them on nestest run through all its
+# tests in both PPU modes (tests/nestest/nestest.movie), then rebuilds the
+# same tree with the profile.  The build directory has to stay the same
+# between the two, the profile is keyed on object paths.
+set -e
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-build-pgo}
+PROFILE=$(mkdir -p "$BUILD" && cd "$BUILD" && pwd)/pgo
+
+rm -rf "$PROFILE"
+cmake -S "$SOURCE" -B "$BUILD" -DCMAKE_BUILD_TYPE=Release -DRAUNNES_LTO=ON \
+    -DRAUNNES_PGO=GENERATE -DRAUNNES_PGO_DIR="$PROFILE"
+cmake --build "$BUILD" --clean-first --target raunnes_bench
+
+"$BUILD/raunnes_bench" --frames 1800 --repeat 1 \
+    --movie "$SOURCE/tests/nestest/nestest.movie" "$SOURCE/tests/nestest/nestest.nes"
+
+# Clang writes raw profiles that have to be merged first
+if ls "$PROFILE"/*.profraw > /dev/null 2>&1; then
+    llvm-profdata merge -output="$PROFILE/default.profdata" "$PROFILE"/*.profraw
+fi
+
+cmake -S "$SOURCE" -B "$BUILD" -DRAUNNES_PGO=USE
+cmake --build "$BUILD" --clean-first